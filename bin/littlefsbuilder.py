@@ -1,2 +1,174 @@
-Import("env")
-env.Replace( MKSPIFFSTOOL=env.get("PROJECT_DIR") + '/mklittlefs' )  # PlatformIO now believes it has actually created a SPIFFS
+import gzip
+import hashlib
+import os
+import re
+import struct
+import sys
+
+try:
+    Import("env")
+    env.Replace( MKSPIFFSTOOL=env.get("PROJECT_DIR") + '/mklittlefs' )  # PlatformIO now believes it has actually created a SPIFFS
+    PROJECT_DIR = env.get("PROJECT_DIR")
+except NameError:
+    # run by hand: python bin/littlefsbuilder.py
+    env = None
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+#
+#   Web UI: web/* is minified, gzipped and written to data/ui/ with content
+#   hashes in the asset names. index.html is the only entry point without
+#   a hash, the firmware serves it with revalidation and everything else
+#   as immutable.
+#
+
+UI_SRC = os.path.join(PROJECT_DIR, "web")
+UI_OUT = os.path.join(PROJECT_DIR, "data", "ui")
+UI_ENTRY = "index.html"
+
+
+def minify_css(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    text = re.sub(r"\s+", " ", text)
+    text = re.sub(r"\s*([{}:;,>])\s*", r"\1", text)
+    return text.replace(";}", "}").strip()
+
+
+def minify_js(text):
+    # line based only, strings and regexps are left alone
+    lines = []
+    for line in text.splitlines():
+        line = line.strip()
+        if line and not line.startswith("//"):
+            lines.append(line)
+    return "\n".join(lines)
+
+
+def minify_html(text):
+    text = re.sub(r"<!--.*?-->", "", text, flags=re.S)
+    return "\n".join(line.strip() for line in text.splitlines() if line.strip())
+
+
+MINIFY = {
+    ".css": minify_css,
+    ".js": minify_js,
+    ".html": minify_html,
+}
+
+
+def gzip_bytes(data):
+    # mtime 0 so the same input always gives the same bytes and ETag
+    return gzip.compress(data, compresslevel=9, mtime=0)
+
+
+def build_ui(*args, **kwargs):
+    if not os.path.isdir(UI_SRC):
+        return
+
+    os.makedirs(UI_OUT, exist_ok=True)
+    for name in os.listdir(UI_OUT):
+        os.remove(os.path.join(UI_OUT, name))
+
+    names = sorted(n for n in os.listdir(UI_SRC) if os.path.isfile(os.path.join(UI_SRC, n)))
+    sources = {}
+    renamed = {}
+
+    for name in names:
+        with open(os.path.join(UI_SRC, name), "rb") as f:
+            raw = f.read()
+        ext = os.path.splitext(name)[1]
+        text = raw.decode("utf-8")
+        if ext in MINIFY:
+            text = MINIFY[ext](text)
+        sources[name] = (len(raw), text)
+
+        if name != UI_ENTRY:
+            digest = hashlib.sha256(text.encode("utf-8")).hexdigest()[:8]
+            base, ext = os.path.splitext(name)
+            renamed[name] = "%s.%s%s" % (base, digest, ext)
+
+    manifest = []
+    raw_total = 0
+    gz_total = 0
+
+    for name in names:
+        raw_size, text = sources[name]
+        if name == UI_ENTRY:
+            for old, new in renamed.items():
+                text = text.replace('"%s"' % old, '"%s"' % new)
+
+        data = gzip_bytes(text.encode("utf-8"))
+        out_name = renamed.get(name, name)
+        etag = hashlib.sha256(data).hexdigest()[:16]
+
+        with open(os.path.join(UI_OUT, out_name + ".gz"), "wb") as f:
+            f.write(data)
+
+        manifest.append("%s %s %d %d" % (out_name, etag, raw_size, len(data)))
+        raw_total += raw_size
+        gz_total += len(data)
+        print("ui: %-24s %6d -> %6d bytes" % (out_name, raw_size, len(data)))
+
+    with open(os.path.join(UI_OUT, "manifest.txt"), "w") as f:
+        f.write("# name etag raw_size gz_size\n")
+        f.write("\n".join(manifest) + "\n")
+
+    print("ui: %d files, %d -> %d bytes on the wire" % (len(names), raw_total, gz_total))
+
+
+#
+#   VS1053 plugins: VLSI's .plg files are C arrays of the compressed
+#   plugin format. plugins/*.plg is written to data/plugins/ as raw
+#   little-endian words, which the firmware streams over SCI. Names keep
+#   their order, prefix them with a number when patches must go first.
+#
+
+PLUGIN_SRC = os.path.join(PROJECT_DIR, "plugins")
+PLUGIN_OUT = os.path.join(PROJECT_DIR, "data", "plugins")
+
+
+def parse_plg(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    text = re.sub(r"//[^\n]*", "", text)
+    body = re.search(r"plugin\s*\[[^\]]*\]\s*=\s*\{(.*?)\}", text, flags=re.S)
+    if not body:
+        raise ValueError("no plugin[] array")
+    words = [int(w, 0) for w in re.findall(r"0[xX][0-9a-fA-F]+|\d+", body.group(1))]
+
+    # walk the records so a truncated file fails here and not on the chip
+    i = 0
+    while i < len(words):
+        if i + 1 >= len(words):
+            raise ValueError("record at word %d cut short" % i)
+        n = words[i + 1]
+        i += 3 if n & 0x8000 else 2 + n
+    if i != len(words):
+        raise ValueError("last record runs past the end")
+    return words
+
+
+def build_plugins(*args, **kwargs):
+    if not os.path.isdir(PLUGIN_SRC):
+        return
+
+    os.makedirs(PLUGIN_OUT, exist_ok=True)
+    for name in os.listdir(PLUGIN_OUT):
+        os.remove(os.path.join(PLUGIN_OUT, name))
+
+    for name in sorted(os.listdir(PLUGIN_SRC)):
+        base, ext = os.path.splitext(name)
+        if ext != ".plg":
+            continue
+        with open(os.path.join(PLUGIN_SRC, name)) as f:
+            words = parse_plg(f.read())
+        with open(os.path.join(PLUGIN_OUT, base + ".bin"), "wb") as f:
+            f.write(struct.pack("<%dH" % len(words), *words))
+        print("plugin: %-24s %6d words" % (base + ".bin", len(words)))
+
+
+if env is None:
+    build_ui()
+    build_plugins()
+elif set(["buildfs", "uploadfs", "uploadfsota"]) & set(COMMAND_LINE_TARGETS):
+    build_ui()
+    build_plugins()
@@ -0,0 +1,49 @@
+#ifndef __AGC_H
+#define __AGC_H
+
+#include <Arduino.h>
+
+#include "agc_policy.h"
+
+/*
+    Loudness loop: the Si4713 input level (ASQ) is sampled on a fixed
+    cadence and smoothed, then VS1053 volume and the transmitter
+    compressor gain are nudged toward the target. Volume is used up to
+    the programme ceiling first, compressor gain only past that. ASQ
+    reads the level ahead of the compressor, so the gain is set open
+    loop from the remaining shortfall rather than stepped on it. One
+    I2C transaction per call at most, properties are written only when
+    they change. The decision itself is in agc_policy.
+*/
+
+#define AGC_THRESHOLD_DBFS -16  // PROP_TX_ACOMP_THRESHOLD
+#define AGC_LINE_ATTEN 3        // PROP_TX_LINE_LEVEL_INPUT_LEVEL, 636 mVpk range
+#define AGC_LINE_LEVEL_MV 636
+
+typedef struct
+{
+    uint32_t samples;
+    uint32_t adjusts;
+    uint32_t volume_changes;
+    uint32_t prop_writes;
+    uint32_t overmod;
+} agc_stats;
+
+/*
+    iface for devices
+*/
+
+void agc_init(uint8_t ceiling);
+void agc_handle();
+
+void agc_enable(bool);        // takes effect on the next agc_handle()
+void agc_set_target(int dbfs);
+void agc_set_ceiling(uint8_t volume);
+
+/*
+    iface for web
+*/
+
+void agc_print_json(Print &);
+
+#endif
\ No newline at end of file
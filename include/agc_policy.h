@@ -0,0 +1,54 @@
+#ifndef __AGC_POLICY_H
+#define __AGC_POLICY_H
+
+#include <stdint.h>
+
+/*
+    Loudness policy, kept free of Arduino and IDF so recorded level
+    traces can be replayed through it on the host:
+
+        g++ -Iinclude src/agc_policy.cpp test/agc/replay.cpp -o test/bin/agc_replay
+
+    Traces and their expected settle times are in test/agc, see replay.cpp.
+
+    Every sample goes into a moving average, every adjustment moves the
+    volume up to AGC_VOLUME_STEP_MAX steps toward the target and sets the
+    compressor gain for what the volume at the ceiling falls short by.
+*/
+
+#define AGC_SAMPLE_MS 100
+#define AGC_ADJUST_MS 1000
+#define AGC_EMA_SHIFT 3         // 1/8 per sample, about a second
+
+#define AGC_TARGET_DBFS -12
+#define AGC_DEADBAND_DB 2
+#define AGC_SILENCE_DBFS -50    // don't chase gaps between tracks
+
+#define AGC_VOLUME_MIN 60
+#define AGC_VOLUME_STEP_DB10 13 // VS1053 attenuation per volume step, 0.1 dB
+#define AGC_VOLUME_STEP_MAX 3   // per adjustment
+
+#define AGC_GAIN_MAX 15         // PROP_TX_ACOMP_GAIN, dB, chip allows 20
+
+#define AGC_REASON_HOLD 0       // inside the deadband
+#define AGC_REASON_QUIET 1      // silence or not playing, nothing to go by
+#define AGC_REASON_UP 2
+#define AGC_REASON_DOWN 3
+
+typedef struct
+{
+    int target;          // dBFS
+    uint8_t ceiling;     // volume the programme allows
+    int32_t level_q8;    // smoothed dBFS, 8 fractional bits
+    bool level_valid;
+    uint8_t gain;        // compressor gain, dB
+} agc_policy;
+
+void agc_policy_init(agc_policy *, int target, uint8_t ceiling);
+void agc_policy_sample(agc_policy *, int level);
+// smoothed level, whole dB
+int agc_policy_level(const agc_policy *);
+// updates *volume and p->gain, returns AGC_REASON_x
+uint8_t agc_decide(agc_policy *p, uint8_t *volume, bool playing);
+
+#endif
\ No newline at end of file
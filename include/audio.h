@@ -0,0 +1,118 @@
+#ifndef __AUDIO_H
+#define __AUDIO_H
+
+#include <Arduino.h>
+
+#include "ring.h"
+#include "http.h"
+#include "hls.h"
+#include "frame.h"
+
+/*
+    Audio pipeline: network sources fill their own rings, the sink feeds
+    the active one into the VS1053. Sources are progressive HTTP
+    (Icecast/Shoutcast) or HLS playlists. A second source can be opened and
+    prebuffered in the background and then cut over to without a gap.
+    While the live source is drained the sink plays local fallback audio.
+    Between ring and decoder every source goes through a frame parser,
+    only whole frames of a locked stream are fed, see frame.h. Streams
+    declared as a type the parser doesn't read, or undeclared ones that
+    never lock, pass through unparsed. A declared MP3/AAC/Ogg stream
+    that never locks fails. Cuts to the standby source, and between live
+    and fallback audio, wait for the frame being fed to end, a cut to
+    another codec restarts the decoder.
+*/
+
+#define AUDIO_SOURCES 2
+#define AUDIO_RING_SIZE (128 * 1024)      // per source, PSRAM
+#define AUDIO_RING_SIZE_SMALL (16 * 1024) // per source, without PSRAM
+#define AUDIO_PREBUFFER_PCT 25           // of the ring before a source may play
+#define AUDIO_READ_CHUNK 1460
+#define AUDIO_SINK_CHUNK 32              // VS1053 accepts 32 bytes per DREQ
+#define AUDIO_FALLBACK_AFTER_MS 1000      // live audio missing this long - play from flash
+#define AUDIO_READY_TIMEOUT_MS 100        // DREQ up after a decoder reset, about 2 ms on a VS1053
+#define AUDIO_CONNECT_TIMEOUT_MS 20000    // open to first byte, HLS takes two playlists and a segment
+
+#define AUDIO_TITLE_SIZE 64
+
+#define AUDIO_SRC_IDLE 0
+#define AUDIO_SRC_CONNECTING 1
+#define AUDIO_SRC_BUFFERING 2
+#define AUDIO_SRC_READY 3
+#define AUDIO_SRC_FAILED 4
+
+typedef struct
+{
+    unsigned int state;
+    bool eof;
+
+    http_conn http;
+    hls_session *hls;   // NULL - progressive HTTP
+    audio_ring ring;
+    frame_parser frame; // ICY metadata and frame sync
+
+    uint32_t bytes_in;
+    unsigned long opened_ms;
+    unsigned long ready_ms;
+} audio_source;
+
+typedef struct
+{
+    uint32_t bytes_out;
+    uint32_t underruns;
+    uint32_t switches;
+    uint32_t last_switch_gap_us;
+    uint32_t last_startup_ms;
+    uint32_t fallback_in;
+    uint32_t fallback_out;
+    uint32_t last_fallback_in_us;  // last live byte to first fallback byte
+    uint32_t last_fallback_out_us; // and back
+    uint32_t resyncs;              // decoder restarts on a cut to another codec
+    uint32_t net_us;               // time spent pumping sources
+    uint32_t sink_us;              // and feeding the decoder
+} audio_stats;
+
+// pipeline load snapshot, counters are cumulative
+typedef struct
+{
+    uint32_t net_us;
+    uint32_t sink_us;
+    uint32_t bytes_out;
+    uint8_t margin_pct; // fill of the ring being played
+    bool playing;       // live or fallback audio going to the decoder
+    bool filling;       // a source is connecting or prebuffering
+} audio_load;
+
+/*
+    iface for devices
+*/
+
+void audio_init();
+void audio_handle();
+
+bool audio_play(const char *);
+void audio_stop();
+bool audio_active();
+bool audio_running();
+bool audio_on_fallback();
+
+void audio_set_volume(uint8_t);
+uint8_t audio_volume();
+
+void audio_get_load(audio_load *);
+
+/*
+    iface for the scheduler
+*/
+
+bool audio_prepare(const char *);
+bool audio_prepared();
+bool audio_switch();
+
+/*
+    iface for web
+*/
+
+void audio_print_json(Print &);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <Arduino.h>
+
+/*
+    Micro benchmarks of the data path. The numbers that matter are the
+    S3's: built only with BENCH_ENABLE, see env:lolin_s3_mini_bench,
+    /bench?run=1 starts the suite, one case per loop pass, /bench
+    returns the results. The governor is held at POWER_HIGH while the
+    suite runs, so every case sees the clock in "mhz". With BENCH_ALLOC
+    malloc, calloc, realloc and free are wrapped at link time and
+    allocations made by the loop task during a case are counted.
+
+    The cases in bench_portable.cpp (ring, frame, TS, URL, Si47xx
+    encoders) also build on the host, env:native_bench or the g++ line
+    in test/bench/host.cpp. Their host baseline is committed as
+    test/bench/host_baseline.json, test/bench.sh --host compares
+    against it. Target baselines depend on the board and flash,
+    test/bench.sh keeps them in test/bench_baseline.json, ignored by git.
+*/
+
+#define BENCH_CALIBRATE_MS 5
+#define BENCH_TARGET_MS 50  // per case, audio stalls for about this long
+#define BENCH_MAX_CASES 16
+
+typedef struct
+{
+    const char *name;
+    uint32_t iters;
+    uint32_t cycles;
+    uint32_t us;
+    uint32_t allocs;
+    uint32_t alloc_bytes;
+    int32_t peak_bytes;    // heap held at once, above the start of the case
+} bench_result;
+
+typedef struct
+{
+    const char *name;
+    void (*op)();
+} bench_case;
+
+/*
+    iface for the runners
+*/
+
+extern const bench_case bench_portable_cases[];
+extern const unsigned int bench_portable_count;
+
+void bench_portable_prepare();
+
+/*
+    iface for devices
+*/
+
+void bench_request();
+void bench_handle();
+
+/*
+    iface for web
+*/
+
+void bench_print_json(Print &);
+
+#endif
\ No newline at end of file
@@ -2,6 +2,10 @@
 #define __CON_H
 
 #include <string.h>
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "mem.h"
 
 #define WIFI_RECONNECT_INTERVAL_MS 60000 
 #define DELAY_AFTER_FILE_OP_MS 3000
@@ -11,22 +15,58 @@
 
 #define CONFIG_FILE "/config.txt"
 
+#define WIFI_HOST_SIZE 32
+#define WIFI_SSID_SIZE 33
+#define WIFI_KEY_SIZE 65
+
 #define CON_STATE_UNDEFINED 0
 #define CON_STATE_AP 1
 #define CON_STATE_CLIENT 2
 
+// live reconfiguration, see con_try_config()
+#define CON_TRIAL_TIMEOUT_MS 20000
+#define CON_TRIAL_SETTLE_MS 1000   // old link status may linger right after begin()
+#define CON_TRIAL_AP_LINGER_MS 30000 // keep the AP so the client can read the result
+#define CON_TRIAL_GAP_WINDOW_MS 30000 // audio recovery counted this long after the switch
+
+#define CON_TRIAL_IDLE 0
+#define CON_TRIAL_CONNECTING 1
+#define CON_TRIAL_DONE 2
+#define CON_TRIAL_FAILED 3
+
 typedef unsigned int con_state_t;
 
 typedef struct 
 {
     con_state_t state = CON_STATE_UNDEFINED;
 
-    String host_id = "";
-    String ssid = "";
-    String key = "";
+    fstr<WIFI_HOST_SIZE> host_id;
+    fstr<WIFI_HOST_SIZE + 8> mdns_name;
+    fstr<WIFI_SSID_SIZE> ssid;
+    fstr<WIFI_KEY_SIZE> key;
 
 } wifi_state;
 
+typedef struct
+{
+    unsigned int state = CON_TRIAL_IDLE;
+    bool start = false; // set from the web task, acted on in con_handle()
+    con_state_t prev_state;
+
+    fstr<WIFI_SSID_SIZE> ssid;
+    fstr<WIFI_KEY_SIZE> key;
+    const char *reason = "";
+
+    unsigned long started_ms;
+    unsigned long finished_ms;
+    uint32_t reconfig_ms;
+
+    // audio interruption around the switch
+    bool measuring;
+    unsigned long gap_start_ms;
+    uint32_t audio_gap_ms;
+} con_trial;
+
 /*
     iface for main
 */
@@ -42,10 +82,13 @@ void con_handle();
     iface for web
 */
 
-String get_availible_nets_json();
-String get_mdns_name();
+void print_availible_nets_json(Print &);
+const char *get_mdns_name();
 
-bool save_config(String, String);
+bool save_config(const char *, const char *);
+bool con_try_config(const char *, const char *);
+void print_con_status_json(Print &);
+void print_json_string(Print &, const char *); // quoted and escaped
 void do_restart();
 
 /*
@@ -54,4 +97,12 @@ void do_restart();
 
 void con_reset();
 
+/*
+    iface for bench
+*/
+
+const char *con_config_parse(Stream &, fstr<WIFI_SSID_SIZE> *, fstr<WIFI_KEY_SIZE> *); // NULL or what is missing
+void con_config_write(Print &, const char *ssid, const char *key);
+void print_ap_json(Print &, const wifi_ap_record_t *);
+
 #endif
\ No newline at end of file
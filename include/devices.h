@@ -17,6 +17,18 @@ void devices_init_before();
 void devices_init_after();
 void devices_handle();
 
+// boot timeline, /boot
+
+#define BOOT_STEPS 12
+
+typedef struct
+{
+    const char *name;
+    uint32_t ms; // since power-up, at the end of the step
+} boot_step;
+
+void devices_boot_mark(const char *);
+
 // led
 
 #define LED_PIN 47
@@ -38,7 +50,14 @@ void set_led_state(CRGB);
 
 #define VS1053_VOLUME 100
 
+#define STREAM_URL_SIZE 256
+#define STATION_PS_SIZE 9
+#define STREAM_RETRY_MS 3000
+
+void set_station_ps(const char *);
+
 // transmitter
 #define FM_FREQ 93200
+#define FM_POWER 120
 
 #endif
\ No newline at end of file
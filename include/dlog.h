@@ -0,0 +1,109 @@
+#ifndef __DLOG_H
+#define __DLOG_H
+
+#include <Arduino.h>
+
+/*
+    Deferred binary log. Call sites store the format string pointer
+    (it lives in flash, so it serves as the format ID) and raw arguments
+    into a lock-free ring. Text is rendered only when the ring is read.
+*/
+
+#define DLOG_RING_SIZE 128 // entries, power of two
+#define DLOG_MAX_ARGS 8
+#define DLOG_STR_SIZE 48   // storage for string arguments per entry
+
+#define DLOG_RATE_MS 10000 // rate limit window per call site
+#define DLOG_RATE_BURST 3  // entries per window per call site
+
+#define DLOG_LINE_SIZE 192
+#define DLOG_SERIAL_KEY 'l' // dump the ring to serial on this key
+
+#define DLOG_ERROR 1
+#define DLOG_WARN 2
+#define DLOG_INFO 3
+#define DLOG_DEBUG 4
+
+typedef struct
+{
+    uint32_t window_ms;
+    uint16_t count;
+    uint16_t suppressed;
+} dlog_site;
+
+typedef struct
+{
+    volatile uint32_t seq; // index + 1 once committed
+    uint32_t ts_ms;
+    const char *tag;
+    const char *fmt;
+    uint16_t suppressed;
+    uint8_t level;
+    uint8_t str_used;
+    uint32_t args[DLOG_MAX_ARGS];
+    char str[DLOG_STR_SIZE];
+} dlog_entry;
+
+/*
+    iface for main
+*/
+
+void dlog_init();
+void dlog_handle();
+
+/*
+    iface for readers
+*/
+
+void dlog_print(Print &);
+size_t dlog_format(const dlog_entry *, char *, size_t);
+
+/*
+    call sites
+*/
+
+bool dlog_admit(dlog_site *);
+dlog_entry *dlog_begin(dlog_site *, uint8_t, const char *, const char *, uint32_t *);
+void dlog_commit(dlog_entry *, uint32_t);
+
+uint32_t dlog_arg(dlog_entry *, const char *);
+
+inline uint32_t dlog_arg(dlog_entry *e, char *s) { return dlog_arg(e, (const char *) s); }
+inline uint32_t dlog_arg(dlog_entry *, int v) { return (uint32_t) v; }
+inline uint32_t dlog_arg(dlog_entry *, unsigned int v) { return v; }
+inline uint32_t dlog_arg(dlog_entry *, long v) { return (uint32_t) v; }
+inline uint32_t dlog_arg(dlog_entry *, unsigned long v) { return (uint32_t) v; }
+
+inline uint32_t dlog_arg(dlog_entry *, double v)
+{
+    float f = (float) v;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+template<typename... A>
+inline void dlog_write(dlog_site *site, uint8_t level, const char *tag, const char *fmt, A... args)
+{
+    static_assert(sizeof...(A) <= DLOG_MAX_ARGS, "too many log arguments");
+
+    uint32_t seq;
+    dlog_entry *e = dlog_begin(site, level, tag, fmt, &seq);
+    uint32_t v[sizeof...(A) + 1] = { dlog_arg(e, args)... };
+
+    memcpy(e->args, v, sizeof(uint32_t) * sizeof...(A));
+    dlog_commit(e, seq);
+}
+
+#define DLOG(level, fmt, ...) do { \
+        static dlog_site __dlog_site; \
+        if(dlog_admit(&__dlog_site)) \
+            dlog_write(&__dlog_site, level, TAG, fmt, ##__VA_ARGS__); \
+    } while(0)
+
+#define DLOG_E(fmt, ...) DLOG(DLOG_ERROR, fmt, ##__VA_ARGS__)
+#define DLOG_W(fmt, ...) DLOG(DLOG_WARN, fmt, ##__VA_ARGS__)
+#define DLOG_I(fmt, ...) DLOG(DLOG_INFO, fmt, ##__VA_ARGS__)
+#define DLOG_D(fmt, ...) DLOG(DLOG_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+#ifndef __FALLBACK_H
+#define __FALLBACK_H
+
+#include <Arduino.h>
+
+#include "ring.h"
+
+/*
+    Local audio for network outages. A station ID / loop file and a
+    rolling cache of recent live audio are played from LittleFS, in
+    turn, through the same sink as the network sources.
+
+    The cache is refreshed rarely and in whole filesystem blocks, with a
+    daily write budget, so the flash is not worn by the live stream.
+    Only MP3 is captured, the frame parser says what is playing. The
+    loop copies fed bytes into staging blocks, a low priority writer
+    task puts them into the file, so LittleFS and erase waits never
+    block the loop. A sector erase still stops the flash cache on both
+    cores while it runs, the decoder FIFO and the ring ride that out.
+*/
+
+#define FALLBACK_FILE "/fallback.mp3"      // uploaded with the filesystem image
+#define FALLBACK_CACHE_FILE "/recent.mp3"
+#define FALLBACK_CACHE_TMP "/recent.tmp"
+
+#define FALLBACK_RING_SIZE (8 * 1024)
+#define FALLBACK_READ_CHUNK 4096
+
+#define FALLBACK_CACHE_SIZE (256 * 1024)            // about 16 s at 128 kbps
+#define FALLBACK_BLOCK_SIZE 4096                    // LittleFS block, written whole
+#define FALLBACK_WRITE_GAP_MS 250                   // writer pause between blocks
+#define FALLBACK_STEADY_MS (5 * 60 * 1000UL)        // live playing this long before a capture
+#define FALLBACK_REFRESH_MS (2 * 3600 * 1000UL)
+#define FALLBACK_DAILY_BUDGET (4 * 1024 * 1024UL)   // flash bytes written per day
+
+#define FALLBACK_TASK_STACK 4096
+#define FALLBACK_TASK_PRIO 1                        // below the network tasks
+#define FALLBACK_TASK_CORE 0                        // away from the loop
+
+typedef struct
+{
+    // playback
+    uint32_t starts;
+    uint32_t read_bytes;
+    uint32_t read_us;
+    uint32_t fed_bytes;
+    uint32_t fed_ms;
+
+    // cache
+    uint32_t refreshes;
+    uint32_t aborted;
+    uint32_t written_bytes;
+    uint32_t write_max_ms;
+    uint32_t budget_used;
+} fallback_stats;
+
+/*
+    iface for audio
+*/
+
+void fallback_init();
+void fallback_handle(unsigned long live_steady_ms);
+
+bool fallback_available();
+void fallback_start();
+void fallback_stop();
+bool fallback_playing();
+audio_ring *fallback_ring();
+void fallback_fed(uint32_t bytes);
+
+void fallback_capture(const uint8_t *, uint32_t, bool mp3);
+
+/*
+    iface for web
+*/
+
+void fallback_print_json(Print &);
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef __FRAME_H
+#define __FRAME_H
+
+#include <Arduino.h>
+
+#include "mem.h"
+#include "ring.h"
+
+/*
+    Parse stage between a source ring and the decoder. Network bytes are
+    ICY-stripped in place as they land in the ring, frame_scan() then
+    walks the new data header to header - MP3 (MPEG 1/2/2.5, layers
+    I-III), ADTS AAC or Ogg pages - and records whole valid frames as
+    runs of ring positions. The sink reads only those runs straight from
+    the ring, anything in between is consumed unplayed.
+
+    Sync is declared after FRAME_SYNC_FRAMES consistent headers in a
+    row. Once locked, every header must keep the version, layer and
+    sample rate (profile and channels for ADTS), a mismatch drops the
+    lock and hunting starts again at that header. Frame bodies are not
+    read, so the cost is a header per frame while locked and at most
+    FRAME_SYNC_FRAMES headers per byte while hunting. Payload CRCs are
+    not checked. Bytes before the first queued frame are consumed as
+    soon as they are known to be garbage, so junk never fills a ring.
+
+    Spans handed to the sink end at frame ends, the header at the tail is
+    read again as the sink gets to it. frame_partial() is what is left of
+    the frame the sink is in the middle of, a cut to another stream waits
+    for it to be 0 so the decoder never sees half a frame.
+
+    Formats the parser doesn't know (FLAC, WMA, WAV, MP4, LATM...) go
+    through unparsed after frame_passthrough(): every byte counts as
+    valid and reaches the decoder as it came. frame_parses() tells from
+    a Content-Type whether to parse at all, frame_lost() that a stream
+    dropped FRAME_HUNT_LIMIT bytes without ever locking.
+*/
+
+#define FRAME_RUNS 16           // queued runs of contiguous valid frames
+#define FRAME_SYNC_FRAMES 3
+#define FRAME_RATE_WINDOW_S 5   // bitrate averaged over this much audio
+#define FRAME_META_SIZE 128
+#define FRAME_HUNT_LIMIT (64 * 1024) // dropped before the first lock, then the stream isn't one we parse
+
+#define FRAME_CODEC_UNKNOWN 0
+#define FRAME_CODEC_MP3 1
+#define FRAME_CODEC_AAC 2
+#define FRAME_CODEC_OGG 3
+#define FRAME_CODEC_RAW 4      // passed through unparsed
+
+typedef struct
+{
+    uint32_t start; // ring position
+    uint32_t len;
+} frame_run;
+
+typedef struct
+{
+    uint32_t frames;
+    uint32_t bytes;        // in valid frames
+    uint32_t dropped;      // skipped while out of sync
+    uint32_t syncs;        // locks gained
+    uint32_t losses;       // locks lost on a bad header
+    uint32_t sample_rate;
+    uint32_t bitrate;      // bit/s of the audio, from frame sizes and durations
+} frame_stats;
+
+typedef struct
+{
+    // ICY metadata, stripped before frame_scan() sees the bytes
+    int icy_interval;      // 0 - no metadata in the stream
+    int icy_audio_left;    // audio bytes until the next metadata block
+    int icy_meta_left;     // -1 - next byte is the metadata length
+    bool meta_ready;       // a block has ended, meta holds its text
+    fstr<FRAME_META_SIZE> meta;
+
+    uint8_t codec;
+    bool passthrough;
+    bool locked;
+    uint32_t sig;          // header bits that must not change while locked
+    uint32_t scan;         // next ring position to look at
+
+    frame_run runs[FRAME_RUNS];
+    uint8_t run_first;
+    uint8_t run_count;
+    uint32_t feed_end;     // sink side, end of the frame being fed
+
+    // bitrate window
+    uint32_t rate_bytes;
+    uint64_t rate_samples;
+    int64_t granule;       // last Ogg granule position, -1 - none yet
+
+    frame_stats stats;
+} frame_parser;
+
+void frame_reset(frame_parser *, uint32_t pos, int icy_interval);
+// from the scan position on, no frames are looked for
+void frame_passthrough(frame_parser *);
+// Content-Type of a stream the parser reads, an empty one counts as unknown
+bool frame_parses(const char *content_type);
+bool frame_lost(const frame_parser *);
+
+// in place, returns the audio bytes left at the start of data
+size_t frame_icy_strip(frame_parser *, uint8_t *data, size_t len);
+
+void frame_scan(frame_parser *, audio_ring *);
+// contiguous valid bytes at the tail, bytes before them are consumed
+uint32_t frame_span(frame_parser *, audio_ring *, uint8_t **p);
+// valid bytes not yet consumed
+uint32_t frame_available(const frame_parser *, const audio_ring *);
+// bytes to the end of the frame being fed, 0 - at a frame boundary or passing through
+uint32_t frame_partial(const frame_parser *, const audio_ring *);
+
+void frame_print_json(Print &, const frame_parser *);
+
+#endif
\ No newline at end of file
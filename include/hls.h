@@ -0,0 +1,114 @@
+#ifndef __HLS_H
+#define __HLS_H
+
+#include <Arduino.h>
+
+#include "mem.h"
+#include "ring.h"
+#include "http.h"
+#include "ts.h"
+
+/*
+    HLS source. The master playlist picks a variant, the media playlist
+    is reloaded on its target duration while live, and segments are
+    fetched in order into the audio ring with up to HLS_FETCHES of them
+    in flight. Segments ahead of the one playing connect and fill a
+    small stage, so their setup overlaps the current download.
+
+    MPEG-TS is demuxed in place in the ring, see ts.h. Packed audio
+    (ADTS/MP3 segments) passes through untouched.
+*/
+
+#define HLS_FETCHES 2               // segments in flight
+#define HLS_SEGMENTS 8              // queued segment URLs
+#define HLS_PLAYLIST_SIZE 4096
+#define HLS_STAGE_SIZE (16 * 1024)  // per fetch, PSRAM
+#define HLS_STAGE_SIZE_SMALL 4096   // per fetch, without PSRAM
+#define HLS_READ_CHUNK 1460
+
+#define HLS_LIVE_EDGE 3             // segments back from the live end to start at
+#define HLS_MAX_BANDWIDTH 192000    // highest variant we want
+#define HLS_FAIL_SEGMENTS 3         // failed in a row, the session fails
+
+#define HLS_STATE_IDLE 0
+#define HLS_STATE_LOADING 1
+#define HLS_STATE_PLAYING 2
+#define HLS_STATE_DONE 3
+#define HLS_STATE_FAILED 4
+
+#define HLS_KIND_UNKNOWN 0
+#define HLS_KIND_TS 1
+#define HLS_KIND_RAW 2
+
+typedef struct
+{
+    uint32_t seq;
+    fstr<HTTP_URL_SIZE> url;
+} hls_segment;
+
+typedef struct
+{
+    http_conn http;
+    audio_ring stage;
+    bool busy;
+    uint8_t kind;
+    uint32_t seq;
+    unsigned long started_ms;
+} hls_fetch;
+
+typedef struct
+{
+    unsigned long opened_ms;
+    uint32_t playlist_ms;    // until the first media playlist was parsed
+    uint32_t first_byte_ms;  // until the first audio byte reached the ring
+    uint32_t bandwidth;      // of the chosen variant
+    uint32_t segments;
+    uint32_t failed;
+    uint32_t skipped;        // dropped out of the live window before fetched
+    uint32_t reloads;
+    uint32_t bytes_in;
+    uint64_t busy_us;        // at least one segment in flight
+    uint64_t overlap_us;     // two or more in flight
+} hls_stats;
+
+typedef struct
+{
+    unsigned int state;
+
+    // playlists
+    http_conn list;
+    bool list_busy;
+    char *list_buf;
+    uint32_t list_len;
+    unsigned long list_started_ms;
+    unsigned long reload_ms;
+    fstr<HTTP_URL_SIZE> media_url;
+    unsigned int target_s;
+    bool endlist;
+    uint32_t last_seq;       // highest sequence seen, for change detection
+
+    // segments
+    hls_segment queue[HLS_SEGMENTS];
+    unsigned int queued;
+    uint32_t next_seq;       // next sequence to queue
+    uint32_t play_seq;       // sequence going into the ring
+    bool started;
+    unsigned int failed_run; // segments failed in a row
+    hls_fetch fetch[HLS_FETCHES];
+
+    ts_demux ts;
+
+    uint32_t tick_us;
+    hls_stats stats;
+} hls_session;
+
+void hls_init(hls_session *);
+bool hls_is_playlist(const char *url);
+
+bool hls_open(hls_session *, const char *url);
+unsigned int hls_poll(hls_session *, audio_ring *);
+void hls_close(hls_session *);
+
+void hls_print_json(Print &, const hls_session *);
+
+#endif
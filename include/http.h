@@ -0,0 +1,114 @@
+#ifndef __HTTP_H
+#define __HTTP_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "mem.h"
+#include "tls.h"
+#include "http_url.h"
+
+/*
+    Minimal streaming HTTP client. Requests go out as HTTP/1.0 so that
+    servers never answer with chunked encoding. DNS, TCP connect and the
+    TLS handshake block for up to HTTP_CONNECT_TIMEOUT_MS plus
+    TLS_HANDSHAKE_TIMEOUT_MS, so they run on a connector task: http_open()
+    only queues the connection, http_poll() reports CONNECTING until the
+    request is out and the loop keeps feeding audio meanwhile. Headers
+    and body are polled. Closing a connection that is still connecting
+    leaves it to the connector to drop; opening it again meanwhile is
+    held and started by http_poll() once the connector lets go. A body that stays silent for
+    HTTP_STALL_TIMEOUT_MS while the caller keeps asking for data fails
+    the connection, a half-open socket still looks connected.
+
+    Host names are resolved through a small cache. lwIP doesn't hand out
+    record TTLs, so entries live HTTP_DNS_TTL_MS and are dropped early
+    when a connect to the cached address fails.
+*/
+
+#define HTTP_CONNECT_TIMEOUT_MS 3000
+#define HTTP_HEADER_TIMEOUT_MS 5000
+#define HTTP_STALL_TIMEOUT_MS 10000
+#define HTTP_MAX_REDIRECTS 3
+
+#define HTTP_DNS_CACHE 4
+#define HTTP_DNS_TTL_MS 300000
+
+#define HTTP_LINE_SIZE 256
+#define HTTP_NAME_SIZE 64
+
+#define HTTP_USER_AGENT "esp32-fm"
+
+#define HTTP_STATE_IDLE 0
+#define HTTP_STATE_HEADERS 1
+#define HTTP_STATE_BODY 2
+#define HTTP_STATE_DONE 3
+#define HTTP_STATE_FAILED 4
+#define HTTP_STATE_CONNECTING 5
+
+#define HTTP_CONNECT_QUEUE 8
+#define HTTP_CONNECT_STACK 12288     // mbedTLS handshake
+#define HTTP_CONNECT_PRIO 1
+#define HTTP_CONNECT_CORE 0          // away from the loop
+
+// connect cost of the last connection, -1 - step not taken
+typedef struct
+{
+    int32_t dns_ms;
+    int32_t tcp_ms;
+    int32_t tls_ms;
+    int32_t first_byte_ms; // request sent to first response byte
+    uint32_t tls_heap;
+    bool dns_cached;
+    bool tls_resumed;
+} http_timing;
+
+typedef struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t failures;
+} http_dns_stats;
+
+typedef struct
+{
+    WiFiClient tcp;
+    TlsClient tls;
+    Client *client;
+
+    unsigned int state;
+    volatile bool connecting;  // owned by the connector task while set
+    volatile bool cancel;      // closed meanwhile, the connector drops it
+    bool reopen;               // http_open() while the connector still had it
+    bool reopen_icy;
+    fstr<HTTP_URL_SIZE> reopen_url;
+    int status;
+    int content_length;
+    int metaint;
+    bool icy;
+
+    fstr<HTTP_URL_SIZE> url;
+    fstr<HTTP_URL_SIZE> location;
+    fstr<HTTP_NAME_SIZE> content_type;
+    fstr<HTTP_NAME_SIZE> name;
+    fstr<HTTP_LINE_SIZE> line;
+
+    unsigned int redirects;
+    unsigned long opened_ms;
+    uint32_t body_bytes;
+    bool idle;               // last read found nothing
+    unsigned long idle_ms;   // since then
+    http_timing timing;
+} http_conn;
+
+void http_init();
+
+bool http_open(http_conn *, const char *url, bool icy = false);
+unsigned int http_poll(http_conn *);
+int http_read(http_conn *, uint8_t *, size_t);
+void http_close(http_conn *);
+
+void http_print_timing_json(Print &, const http_conn *);
+void http_print_dns_json(Print &);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef __HTTP_URL_H
+#define __HTTP_URL_H
+
+#include <Arduino.h>
+
+#include "mem.h"
+
+/*
+    http:// and https:// URLs split into host, port and path. Apart from
+    the client so the parser runs in the host bench, see
+    test/bench/host.cpp.
+*/
+
+#define HTTP_URL_SIZE 256
+#define HTTP_HOST_SIZE 64
+
+typedef struct
+{
+    fstr<HTTP_HOST_SIZE> host;
+    fstr<HTTP_URL_SIZE> path;
+    uint16_t port;
+    bool tls;
+} http_url;
+
+bool http_parse_url(const char *, http_url *);
+
+#endif
\ No newline at end of file
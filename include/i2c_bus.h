@@ -0,0 +1,82 @@
+#ifndef __I2C_BUS_H
+#define __I2C_BUS_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#define I2C_BUS_CLOCK 400000 // fast mode
+#define I2C_BUS_TIMEOUT_MS 20
+
+#define I2C_MUX_ADDR 0x70  // TCA9548A
+#define I2C_MUX_NONE 0xFF
+
+#define I2C_TRACE_SIZE 256 // entries, allocated on first enable
+#define I2C_TRACE_DATA 12  // tx bytes followed by rx bytes, truncated
+
+#define I2C_OP_WRITE 1
+#define I2C_OP_READ 2
+#define I2C_OP_WRITE_READ 3
+
+typedef struct {
+  uint32_t transactions;
+  uint32_t errors;
+  uint32_t timeouts;
+  uint32_t bytes;
+  uint32_t bus_us;
+  uint32_t mux_switches;
+} i2c_bus_stats;
+
+typedef struct {
+  uint32_t ts_us;
+  uint16_t dur_us;
+  uint8_t op;
+  uint8_t addr;
+  uint8_t result; // 0 - ok, otherwise Wire error code
+  uint8_t tx_len;
+  uint8_t rx_len;
+  uint8_t data[I2C_TRACE_DATA];
+} i2c_trace_entry;
+
+/*
+  Transaction layer over TwoWire. Every transfer is accounted in stats,
+  and with tracing enabled recorded as
+    <ts_us> <dur_us> <W|R|WR> <addr> <result> <tx hex> / <rx hex>
+  one line per transaction, so a session can be replayed off-target.
+*/
+
+class I2cBus {
+  public:
+    I2cBus(TwoWire &wire) : _wire(wire) {}
+
+    bool begin(uint32_t clock = I2C_BUS_CLOCK);
+
+    bool write(uint8_t addr, const uint8_t *tx, size_t tx_len);
+    bool read(uint8_t addr, uint8_t *rx, size_t rx_len);
+    // write, repeated start, read - one bus transaction
+    bool write_read(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len);
+
+    // route the bus through a TCA9548A channel, a no-op when already there
+    bool select_mux(uint8_t channel, uint8_t mux_addr = I2C_MUX_ADDR);
+
+    void trace(bool on);
+    void print_trace(Print &out);
+    void print_stats_json(Print &out);
+
+    i2c_bus_stats stats = {};
+
+  private:
+    TwoWire &_wire;
+    bool _begun = false;
+    uint8_t _mux_channel = I2C_MUX_NONE;
+
+    bool _tracing = false;
+    i2c_trace_entry *_trace = NULL;
+    uint32_t _trace_head = 0;
+
+    bool _account(uint8_t op, uint8_t addr, uint8_t result, uint32_t start_us,
+      const uint8_t *tx, size_t tx_len, const uint8_t *rx, size_t rx_len);
+};
+
+extern I2cBus i2c0;
+
+#endif // __I2C_BUS_H
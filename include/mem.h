@@ -0,0 +1,139 @@
+#ifndef __MEM_H
+#define __MEM_H
+
+#include <Arduino.h>
+
+/*
+    Long-lived state comes from static arenas and is never freed,
+    per-request scratch from fixed-block pools, so the heap does not
+    fragment over days of uptime.
+*/
+
+#define MEM_ARENA_SIZE (16 * 1024)   // internal RAM, carved at boot
+#define MEM_BULK_SIZE (512 * 1024)   // PSRAM when present, for bulk buffers
+#define MEM_BULK_FALLBACK (96 * 1024) // internal heap when there is no PSRAM
+
+#define MEM_POOL_BLOCK_SIZE 1024
+#define MEM_POOL_BLOCKS 4            // up to 32
+
+#define MEM_SAMPLE_MS 10000
+
+typedef struct
+{
+    uint8_t *base;
+    size_t size;
+    size_t used;
+} mem_arena;
+
+typedef struct
+{
+    uint8_t *base;
+    size_t block_size;
+    unsigned int blocks;
+    uint32_t free_mask;
+    unsigned int used;
+    unsigned int peak;
+    unsigned int failed;
+} mem_pool;
+
+/*
+    fixed-capacity string
+*/
+
+template<size_t N>
+class fstr {
+  public:
+    fstr() { _buf[0] = 0; _len = 0; }
+    fstr(const char *s) { set(s); }
+
+    const char *c_str() const { return _buf; }
+    size_t length() const { return _len; }
+    size_t capacity() const { return N - 1; }
+    char *data() { return _buf; }
+
+    void clear() { _buf[0] = 0; _len = 0; }
+
+    fstr &set(const char *s) {
+        clear();
+        return append(s);
+    }
+
+    fstr &append(const char *s) {
+        while(s && *s && _len < N - 1) {
+            _buf[_len++] = *s++;
+        }
+        _buf[_len] = 0;
+        return *this;
+    }
+
+    fstr &append(char c) {
+        if(_len < N - 1) {
+            _buf[_len++] = c;
+            _buf[_len] = 0;
+        }
+        return *this;
+    }
+
+    fstr &printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(_buf + _len, N - _len, fmt, args);
+        va_end(args);
+        if(n > 0) {
+            _len = (_len + n < N - 1) ? _len + n : N - 1;
+        }
+        return *this;
+    }
+
+    // re-sync the length after writing through data()
+    void sync() { _len = strnlen(_buf, N - 1); _buf[_len] = 0; }
+
+    void trim() {
+        size_t start = 0;
+        while(start < _len && isspace((unsigned char) _buf[start])) start++;
+        while(_len > start && isspace((unsigned char) _buf[_len - 1])) _len--;
+        if(start) memmove(_buf, _buf + start, _len - start);
+        _len -= start;
+        _buf[_len] = 0;
+    }
+
+    bool operator==(const char *s) const { return strcmp(_buf, s ? s : "") == 0; }
+    bool operator!=(const char *s) const { return !(*this == s); }
+
+    fstr &operator=(const char *s) { return set(s); }
+    fstr &operator+=(const char *s) { return append(s); }
+
+  private:
+    char _buf[N];
+    size_t _len;
+};
+
+/*
+    iface for main
+*/
+
+void mem_init();
+void mem_handle();
+
+/*
+    arenas - never freed
+*/
+
+void *mem_alloc(size_t);
+void *mem_bulk_alloc(size_t);
+bool mem_has_psram();
+
+/*
+    per-request scratch
+*/
+
+void *mem_pool_alloc();
+void mem_pool_free(void *);
+
+/*
+    iface for web
+*/
+
+void mem_print_json(Print &);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef __PLUGIN_H
+#define __PLUGIN_H
+
+#include <Arduino.h>
+
+#include "mem.h"
+
+/*
+    VS1053 patches and plugins from LittleFS. Images are VLSI's
+    compressed .plg arrays as little-endian 16 bit words, converted by
+    bin/littlefsbuilder.py from the .plg files in plugins/ into
+    PLUGIN_DIR, and loaded in name order:
+
+        addr, n, n words        n < 0x8000 - words written in turn
+        addr, 0x8000 | n, word  the same word written n times
+
+    Every record goes out as one SCI multiple write (XCS held low, DREQ
+    polled between words) at the fastest clock the VS1053 allows.
+    X, Y and instruction RAM written through SCI_WRAMADDR / SCI_WRAM is
+    read back and compared before the image touches any other register
+    or I/O space (WRAMADDR from PLUGIN_WRAM_IO on), as that may start
+    the code just loaded. I/O registers are written, never read back -
+    they don't read as written. A software or hardware reset drops
+    everything, so the loader runs after each decoder reset.
+
+    test/plugin/sim.cpp runs the loader against a host model of SCI
+    and WRAM.
+*/
+
+#define PLUGIN_DIR "/plugins"
+#define PLUGIN_EXT ".bin"
+#define PLUGIN_FILES 4
+#define PLUGIN_NAME_SIZE 32
+#define PLUGIN_CHUNK 256                  // words read from flash at once
+
+#define PLUGIN_CLOCKF 0x6000              // SC_MULT 3.0, as VS1053::begin() leaves it
+#define PLUGIN_CLKI_HZ (12288000 * 3)
+#define PLUGIN_SCI_WRITE_HZ (PLUGIN_CLKI_HZ / 4)
+#define PLUGIN_SCI_READ_HZ (PLUGIN_CLKI_HZ / 7)
+#define PLUGIN_SCI_SLOW_HZ 1000000        // XTALI / 7 with rounding, until CLOCKF is set
+#define PLUGIN_DREQ_TIMEOUT_US 100000
+#define PLUGIN_WRAM_IO 0xC000             // WRAMADDR of the I/O space, X/Y/I RAM below
+
+typedef struct
+{
+    fstr<PLUGIN_NAME_SIZE> name;
+    bool ok;
+    uint32_t words;      // in the image
+    uint32_t written;    // words sent over SCI
+    uint32_t verified;   // words read back
+    uint32_t io;         // words written to I/O space, not read back
+    uint32_t mismatches;
+    uint32_t load_us;
+    uint32_t verify_us;
+} plugin_file;
+
+typedef struct
+{
+    uint32_t loads;      // decoder resets served
+    uint32_t failures;
+    uint32_t last_ms;    // whole load, files and verification
+    unsigned int files;
+    plugin_file file[PLUGIN_FILES];
+} plugin_stats;
+
+/*
+    iface for audio
+*/
+
+bool plugin_load(uint8_t cs, uint8_t dreq);
+
+/*
+    iface for web
+*/
+
+void plugin_print_json(Print &);
+
+#endif
\ No newline at end of file
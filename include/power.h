@@ -0,0 +1,61 @@
+#ifndef __POWER_H
+#define __POWER_H
+
+#include <Arduino.h>
+
+#include "power_policy.h"
+
+/*
+    Power governor: samples pipeline load from audio_get_load() and
+    moves CPU clock and Wi-Fi modem sleep between three levels, see
+    power_policy.h. With CONFIG_PM_ENABLE the clock goes through
+    esp_pm (DFS capped at the level, a max-frequency lock held at
+    POWER_HIGH), otherwise setCpuFrequencyMhz(). Modem sleep is only
+    used while connected as a station.
+*/
+
+#define POWER_SAMPLE_MS 1000
+#define POWER_LOG_SIZE 16 // last decisions kept for /power
+
+typedef struct
+{
+    uint32_t ms;
+    uint8_t from;
+    uint8_t to;
+    uint8_t reason;
+    uint8_t duty_pct;
+    uint8_t margin_pct;
+    uint16_t kbps;
+} power_decision;
+
+typedef struct
+{
+    uint32_t samples;
+    uint32_t changes;
+    uint32_t safety;
+    uint32_t state_ms[POWER_LEVELS];
+} power_stats;
+
+/*
+    iface for devices
+*/
+
+void power_init();
+void power_handle();
+
+void power_enable(bool);      // takes effect on the next power_handle()
+
+/*
+    iface for bench
+*/
+
+// held at POWER_HIGH without sampling until released, so a run sees one clock
+void power_hold(bool);
+
+/*
+    iface for web
+*/
+
+void power_print_json(Print &);
+
+#endif
\ No newline at end of file
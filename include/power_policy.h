@@ -0,0 +1,63 @@
+#ifndef __POWER_POLICY_H
+#define __POWER_POLICY_H
+
+#include <stdint.h>
+
+/*
+    Governor policy, kept free of Arduino and IDF so recorded load
+    traces can be replayed through it on the host:
+
+        g++ -Iinclude src/power_policy.cpp test/power/replay.cpp -o test/bin/replay
+
+    Traces and their expected levels are in test/power, see replay.cpp.
+
+    Steps up at once, steps down one level at a time and only after
+    POWER_DOWN_HOLD samples in a row had room for it at the lower clock.
+*/
+
+#define POWER_LOW 0  //  80 MHz, max modem sleep
+#define POWER_MID 1  // 160 MHz, min modem sleep
+#define POWER_HIGH 2 // 240 MHz, no modem sleep
+#define POWER_LEVELS 3
+
+#define POWER_LOW_MHZ 80
+#define POWER_MID_MHZ 160
+#define POWER_HIGH_MHZ 240
+
+#define POWER_DUTY_UP_PCT 60      // busier than this - next level up
+#define POWER_DUTY_DOWN_PCT 35    // projected at the lower clock, to step down
+#define POWER_MARGIN_SAFE_PCT 20  // buffer below this - full speed right away
+#define POWER_MARGIN_DOWN_PCT 50  // buffer needed to step down
+#define POWER_DOWN_HOLD 10        // samples
+#define POWER_LOW_KBPS_MAX 160    // modem sleep latency only for light streams
+
+#define POWER_REASON_HOLD 0
+#define POWER_REASON_SAFETY 1
+#define POWER_REASON_FILL 2
+#define POWER_REASON_LOAD 3
+#define POWER_REASON_RELAX 4
+
+typedef struct
+{
+    uint8_t duty_pct;   // network + decoder time over wall time
+    uint8_t margin_pct; // fill of the ring being played
+    uint16_t kbps;      // into the decoder
+    bool playing;
+    bool filling;
+} power_input;
+
+typedef struct
+{
+    uint8_t level;
+    uint8_t relax;      // samples in a row that allowed a step down
+} power_policy;
+
+void power_policy_init(power_policy *, uint8_t level);
+// updates p->level, returns POWER_REASON_x
+uint8_t power_decide(power_policy *p, const power_input *in);
+// cheap check for every loop pass, between samples
+bool power_unsafe(const power_input *in);
+
+uint16_t power_level_mhz(uint8_t level);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef __RING_H
+#define __RING_H
+
+#include <Arduino.h>
+
+/*
+    Single producer / single consumer byte ring. Head and tail are free
+    running counters, the size is a power of two. Producers and consumers
+    work on contiguous spans in place, so data is copied at most once
+    (network -> ring -> decoder).
+*/
+
+typedef struct
+{
+    uint8_t *buf;
+    uint32_t size;
+    volatile uint32_t head; // total bytes written
+    volatile uint32_t tail; // total bytes consumed
+} audio_ring;
+
+inline void ring_init(audio_ring *r, uint8_t *buf, uint32_t size)
+{
+    r->buf = buf;
+    r->size = buf ? size : 0;
+    r->head = 0;
+    r->tail = 0;
+}
+
+inline void ring_reset(audio_ring *r)
+{
+    r->head = 0;
+    r->tail = 0;
+}
+
+inline uint32_t ring_used(const audio_ring *r)
+{
+    return r->head - r->tail;
+}
+
+inline uint32_t ring_free(const audio_ring *r)
+{
+    return r->size - ring_used(r);
+}
+
+// contiguous free space at the head
+inline uint32_t ring_write_span(const audio_ring *r, uint8_t **p)
+{
+    uint32_t pos = r->head & (r->size - 1);
+    uint32_t n = r->size - pos;
+    uint32_t f = ring_free(r);
+
+    *p = r->buf + pos;
+    return (n < f) ? n : f;
+}
+
+inline void ring_commit(audio_ring *r, uint32_t n)
+{
+    r->head += n;
+}
+
+// contiguous data at the tail, or at an absolute position not yet consumed
+inline uint32_t ring_read_span_at(const audio_ring *r, uint32_t at, uint32_t end, uint8_t **p)
+{
+    uint32_t pos = at & (r->size - 1);
+    uint32_t n = r->size - pos;
+    uint32_t u = end - at;
+
+    *p = r->buf + pos;
+    return (n < u) ? n : u;
+}
+
+inline uint32_t ring_read_span(const audio_ring *r, uint8_t **p)
+{
+    return ring_read_span_at(r, r->tail, r->head, p);
+}
+
+inline void ring_consume(audio_ring *r, uint32_t n)
+{
+    r->tail += n;
+}
+
+inline uint32_t ring_push(audio_ring *r, const uint8_t *data, uint32_t len)
+{
+    uint32_t done = 0;
+    uint8_t *p;
+
+    while(done < len) {
+        uint32_t n = ring_write_span(r, &p);
+        if(!n) break;
+        if(n > len - done) n = len - done;
+        memcpy(p, data + done, n);
+        ring_commit(r, n);
+        done += n;
+    }
+    return done;
+}
+
+inline uint32_t ring_pop(audio_ring *r, uint8_t *out, uint32_t len)
+{
+    uint32_t done = 0;
+    uint8_t *p;
+
+    while(done < len) {
+        uint32_t n = ring_read_span(r, &p);
+        if(!n) break;
+        if(n > len - done) n = len - done;
+        memcpy(out + done, p, n);
+        ring_consume(r, n);
+        done += n;
+    }
+    return done;
+}
+
+#endif
\ No newline at end of file
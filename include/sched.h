@@ -0,0 +1,65 @@
+#ifndef __SCHED_H
+#define __SCHED_H
+
+#include <Arduino.h>
+
+#include "mem.h"
+#include "devices.h"
+
+/*
+    Time-of-day programme schedule, read from LittleFS:
+
+        # comment
+        TZ MSK-3
+        06:00 10:00 90 MORNING http://host/morning
+        22:00 06:00 70 NIGHT http://host/night
+
+    start end volume ps url - ranges may wrap midnight, outside of any
+    range the built-in default is played.
+*/
+
+#define SCHED_FILE "/schedule.txt"
+#define SCHED_MAX_ENTRIES 16
+#define SCHED_TZ_SIZE 32
+
+#define SCHED_TZ "UTC0"
+#define SCHED_NTP_SERVER "pool.ntp.org"
+
+#define SCHED_PREWARM_S 5       // open the next source this early
+#define SCHED_SWITCH_GRACE_MS 3000 // wait for prebuffer past the boundary
+#define SCHED_CHECK_MS 50
+
+#define SCHED_TIME_VALID 1600000000 // anything earlier is not synced yet
+
+typedef struct
+{
+    uint16_t start_min;
+    uint16_t end_min;
+    uint8_t volume;
+    fstr<STATION_PS_SIZE> ps;
+    fstr<STREAM_URL_SIZE> url;
+} sched_entry;
+
+typedef struct
+{
+    uint32_t switches;
+    int32_t last_late_ms;  // switch time relative to the boundary
+    bool last_prewarmed;
+} sched_stats;
+
+/*
+    iface for devices
+*/
+
+void sched_init(const char *url, const char *ps, uint8_t volume);
+void sched_handle();
+
+const char *sched_url();
+
+/*
+    iface for web
+*/
+
+void sched_print_json(Print &);
+
+#endif
\ No newline at end of file
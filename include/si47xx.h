@@ -23,20 +23,43 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef __SI4713_H
 #define __SI4713_H
 
-#define SI47XX_CHIP_VERSION 128
+#include "i2c_bus.h"
+
+#define SI47XX_CHIP_VERSION 13 // GET_REV part number, Si4713
 #define SI47XX_I2C_ADDR 0x63
 
 #define SI47XX_PIN_RESET 9
 #define SI47XX_BUF_SIZE 10
+#define SI47XX_RESP_SIZE 16
+#define SI47XX_PS_SIZE 8       // RDS PS characters, two slots
 
 #define SI47XX_MAX_AWAIT 3000 // 3 sec
-#define SI47XX_STEP_AWAIT 100 
+#define SI47XX_STEP_AWAIT 1   // ms, for slow commands and STC
+#define SI47XX_POLL_US 50     // CTS poll interval for fast commands
+#define SI47XX_FAST_AWAIT_US 2000
+#define SI47XX_POWER_UP_MS 110 // reset released to POWER_UP
+
+#define SI47XX_PROP_CACHE 8 // last written values, for delta writes
+
+// properties and flags used by control loops outside the driver
+#define SI47XX_PROP_LINE_LEVEL 0x2104
+#define SI47XX_PROP_ACOMP_THRESHOLD 0x2201
+#define SI47XX_PROP_ACOMP_GAIN 0x2204
+#define SI47XX_ASQ_OVERMOD 0x04
+
+#define SI47XX_BUSY 0
+#define SI47XX_DONE 1
+#define SI47XX_ERROR 2
 
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
 class Si47xx {
   public:
+    Si47xx(I2cBus *bus = &i2c0, uint8_t addr = SI47XX_I2C_ADDR, 
+      int reset_pin = SI47XX_PIN_RESET, int mux_channel = -1)
+      : _bus(bus), _addr(addr), _reset_pin(reset_pin), _mux_channel(mux_channel) {}
+
     bool begin();
     void tune_fm(unsigned int freqKHz);
     void read_tune_status(void);
@@ -48,6 +71,19 @@ class Si47xx {
     void set_rds_station(const char *s);
     void set_rds_buffer(const char *s);
 
+    // Non-blocking bring-up: power up, tune, set power and RDS. Call step()
+    // until it is not BUSY; the chip works on a command between calls.
+    void begin_async(unsigned int freqKHz, unsigned int pwr, unsigned int programID, const char *ps);
+    unsigned int step(void);
+
+    // Non-blocking single commands for control loops: start one, then
+    // call done() until it returns true. start_property() returns false
+    // without touching the bus when the chip already has the value.
+    bool start_asq_status(void);
+    bool start_property(unsigned int p, unsigned int v);
+    bool done(void);
+    bool has_property(unsigned int p, unsigned int v);
+
     unsigned int CurrFreq;
     unsigned int CurrdBuV;
     unsigned int CurrAntCap;
@@ -55,15 +91,71 @@ class Si47xx {
     unsigned int CurrASQ;
     int CurrInLevel;
 
+    uint32_t commands = 0;
+    uint32_t timeouts = 0;
+    uint32_t props_skipped = 0;
+    uint32_t bus_us = 0;      // bus time of this chip's transfers
+
+    // last tune (command to STC) and RDS PS update, wall and bus time
+    uint32_t tune_us = 0;
+    uint32_t tune_bus_us = 0;
+    uint32_t rds_us = 0;
+    uint32_t rds_bus_us = 0;
+
     void set_gpio(unsigned int x);
     void set_gpio_ctl(unsigned int x);
 
-  private:
-    unsigned int _cmd_buff[SI47XX_BUF_SIZE]; // holds the command buffer
+    I2cBus &bus() { return *_bus; }
+    uint8_t addr() const { return _addr; }
+    int mux_channel() const { return _mux_channel; }
+
+    // command encoders, return the command length
+    static unsigned int encode_property(uint8_t *buf, unsigned int p, unsigned int v);
+    static unsigned int encode_tune(uint8_t *buf, unsigned int cmd, unsigned int freqKHz);
+    static unsigned int encode_power(uint8_t *buf, unsigned int pwr, unsigned int antcap);
+    static unsigned int encode_rds_ps(uint8_t *buf, unsigned int slot, const char *s);
+    static unsigned int encode_rds_buffer(uint8_t *buf, unsigned int slot, const char *s);
 
-    void _send_command(unsigned int len, bool need_status = true);
+  private:
+    I2cBus *_bus;
+    uint8_t _addr;
+    int _reset_pin;
+    int _mux_channel;
+
+    uint8_t _cmd_buff[SI47XX_BUF_SIZE]; // holds the command buffer
+    uint8_t _resp_buff[SI47XX_RESP_SIZE]; // status byte followed by the response
+
+    // begin_async() state
+    uint8_t _step = 0;
+    uint8_t _sub = 0;
+    bool _pending = false;
+    unsigned int _pending_resp = 0;
+    uint32_t _step_ms = 0;
+    uint32_t _poll_ms = 0;
+    unsigned int _async_freq = 0;
+    unsigned int _async_pwr = 0;
+    unsigned int _async_pi = 0;
+    char _async_ps[SI47XX_PS_SIZE + 1] = {}; // padded copy, the caller's string may change
+    uint32_t _mark_us = 0;
+    uint32_t _mark_bus_us = 0;
+
+    uint8_t _op = 0;
+    uint16_t _prop_key[SI47XX_PROP_CACHE] = {};
+    uint16_t _prop_val[SI47XX_PROP_CACHE] = {};
+    uint8_t _prop_next = 0;
+
+    void _mark(void);
+    void _measure(uint32_t *us, uint32_t *bus);
+    void _select(void);
+    void _reset(void);
+    bool _send_command(unsigned int len, unsigned int resp_len = 0);
+    bool _issue(unsigned int len, unsigned int resp_len);
+    int _poll(void);
     void _set_property(unsigned int p, unsigned int v);
+    void _cache_property(unsigned int p, unsigned int v);
     unsigned int _get_status(void);
+    bool _wait_stc(void);
+    bool _check_rev(void);
 };
 
 #endif // __SI4713_H
@@ -0,0 +1,26 @@
+#ifndef __SI47XX_CMD_H
+#define __SI47XX_CMD_H
+
+#include <Arduino.h>
+
+// Si4713 command codes, shared by the driver and the command encoders
+
+constexpr unsigned int CMD_POWER_UP PROGMEM = 0x01;
+constexpr unsigned int CMD_GET_REV PROGMEM = 0x10;
+constexpr unsigned int CMD_POWER_DOWN PROGMEM = 0x11;
+constexpr unsigned int CMD_SET_PROPERTY PROGMEM = 0x12;
+constexpr unsigned int CMD_GET_PROPERTY PROGMEM = 0x13;
+constexpr unsigned int CMD_GET_INT_STATUS PROGMEM = 0x14;
+constexpr unsigned int CMD_PATCH_ARGS PROGMEM = 0x15;
+constexpr unsigned int CMD_PATCH_DATA PROGMEM = 0x16;
+constexpr unsigned int CMD_TX_TUNE_FREQ PROGMEM = 0x30;
+constexpr unsigned int CMD_TX_TUNE_POWER PROGMEM = 0x31;
+constexpr unsigned int CMD_TX_TUNE_MEASURE PROGMEM = 0x32;
+constexpr unsigned int CMD_TX_TUNE_STATUS PROGMEM = 0x33;
+constexpr unsigned int CMD_TX_ASQ_STATUS PROGMEM = 0x34;
+constexpr unsigned int CMD_TX_RDS_BUFF PROGMEM = 0x35;
+constexpr unsigned int CMD_TX_RDS_PS PROGMEM = 0x36;
+constexpr unsigned int CMD_GPO_CTL PROGMEM = 0x80;
+constexpr unsigned int CMD_GPO_SET PROGMEM = 0x81;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef __TLS_H
+#define __TLS_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "mbedtls/ssl.h"
+
+#define TLS_CA_FILE "/ca.pem"
+#define TLS_HANDSHAKE_TIMEOUT_MS 8000
+#define TLS_WRITE_TIMEOUT_MS 3000
+
+#define TLS_SESSIONS 4     // hosts with a resumable session, LRU
+#define TLS_HOST_SIZE 64
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t last_ms;
+    uint32_t total_ms;
+    uint32_t last_heap;  // heap taken at the peak of the handshake
+    uint32_t max_heap;
+} tls_handshake_stats;
+
+typedef struct
+{
+    tls_handshake_stats full;
+    tls_handshake_stats resumed;
+    uint32_t failed;
+    uint32_t offered;  // handshakes that offered a cached session
+} tls_stats;
+
+/*
+    mbedTLS over an already connected WiFiClient. Servers are checked
+    against the CA bundle in TLS_CA_FILE only - keep it to the roots the
+    stations actually chain to, every certificate costs heap. The session
+    (ticket or ID, whatever the server hands out) is kept per host:port
+    and offered on the next connect, a resumed handshake skips the
+    certificate chain and the key exchange.
+
+    begin() and connect() block their caller until the handshake is done,
+    up to TLS_HANDSHAKE_TIMEOUT_MS, without feeding audio. http only calls
+    them from its connector task, see http.h - don't use them on the loop.
+*/
+
+class TlsClient : public Client {
+  public:
+    bool begin(WiFiClient *tcp, const char *host, uint16_t port);
+    bool resumed() const { return _resumed; }
+    uint32_t heap_peak() const { return _heap_before - _heap_min; }
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char *host, uint16_t port);
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *buf, size_t size);
+    int available();
+    int read();
+    int read(uint8_t *buf, size_t size);
+    int peek();
+    void flush() {}
+    void stop();
+    uint8_t connected();
+    operator bool() { return connected(); }
+
+  private:
+    WiFiClient *_tcp = NULL;
+    WiFiClient _own;  // connect() without a caller supplied socket
+    mbedtls_ssl_context _ssl;
+    bool _setup = false;
+    bool _open = false;
+    bool _resumed = false;
+    int _peek = -1;
+
+    uint32_t _heap_before = 0;
+    uint32_t _heap_min = 0;
+
+    void _free();
+    void _sample_heap();
+    static int _send(void *ctx, const unsigned char *buf, size_t len);
+    static int _recv(void *ctx, unsigned char *buf, size_t len);
+};
+
+bool tls_init();
+bool tls_ready();
+void tls_print_json(Print &out);
+
+#endif
\ No newline at end of file
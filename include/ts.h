@@ -0,0 +1,36 @@
+#ifndef __TS_H
+#define __TS_H
+
+#include <Arduino.h>
+
+#include "ring.h"
+
+/*
+    MPEG-TS audio demux for HLS segments. The first audio stream of the
+    first programme is kept, TS and PES headers are squeezed out. Only
+    packets that start a PAT or PMT section are read, which is all
+    segmenters send. Kept apart from the HLS session so the demux runs
+    in the host bench, see test/bench/host.cpp.
+*/
+
+#define TS_PACKET 188
+#define TS_SYNC 0x47
+#define TS_PID_PAT 0x0000
+#define TS_PID_NONE 0xFFFF
+
+typedef struct
+{
+    uint16_t pmt_pid;
+    uint16_t audio_pid;
+    uint8_t carry[TS_PACKET];
+    uint8_t carry_len;
+} ts_demux;
+
+void ts_reset(ts_demux *);
+
+// audio payloads of whole packets compacted in place, the tail goes to carry
+uint32_t ts_inplace(ts_demux *, uint8_t *, uint32_t);
+// through carry, payloads are copied to the ring, returns the bytes taken
+uint32_t ts_copy(ts_demux *, const uint8_t *, uint32_t, audio_ring *);
+
+#endif
\ No newline at end of file
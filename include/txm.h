@@ -0,0 +1,62 @@
+#ifndef __TXM_H
+#define __TXM_H
+
+#include <Arduino.h>
+
+#include "si47xx.h"
+
+/*
+    Several Si4713 on one or more I2C buses, directly or behind a
+    TCA9548A mux. Units come up in parallel - each handle() call gives
+    every unit one non-blocking step - so boot time is bounded by the
+    slowest chip instead of the sum of all of them.
+*/
+
+#define TXM_MAX 8
+#define TXM_PI 0xADAF
+
+#define TXM_STATE_IDLE 0
+#define TXM_STATE_INIT 1
+#define TXM_STATE_READY 2
+#define TXM_STATE_FAILED 3
+
+typedef struct
+{
+    I2cBus *bus;
+    uint8_t addr;
+    int reset_pin;    // -1 - shared reset, already done
+    int mux_channel;  // -1 - no mux
+    unsigned int freq;
+    unsigned int power;
+} txm_config;
+
+typedef struct
+{
+    Si47xx chip;
+    uint8_t state;
+    uint32_t started_ms;
+    uint32_t init_ms;
+    unsigned int freq;
+} txm_unit;
+
+/*
+    iface for devices
+*/
+
+void txm_init(const txm_config *, unsigned int count, const char *ps);
+void txm_handle();
+
+unsigned int txm_count();
+bool txm_ready(unsigned int);
+bool txm_any_ready();
+Si47xx *txm_chip(unsigned int);
+
+void txm_set_rds_station(const char *);
+
+/*
+    iface for web
+*/
+
+void txm_print_json(Print &);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef __UI_H
+#define __UI_H
+
+#include <Arduino.h>
+
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+#include "mem.h"
+
+/*
+    Static web UI, built by bin/littlefsbuilder.py into /ui on LittleFS
+    as pre-gzipped files plus a manifest:
+
+        name etag raw_size gz_size
+
+    Files go out as stored with Content-Encoding: gzip, a client that
+    doesn't accept gzip gets 406 as there is no plain copy. /ui is
+    redirected to /ui/ so the relative asset hrefs resolve. Hashed
+    asset names never change content, so they are cached for a year;
+    the entry page is revalidated with its ETag.
+*/
+
+#define UI_DIR "/ui"
+#define UI_MANIFEST UI_DIR "/manifest.txt"
+#define UI_ENTRY "index.html"
+
+#define UI_MAX_FILES 16
+#define UI_NAME_SIZE 32
+#define UI_ETAG_SIZE 20
+
+#define UI_CACHE_IMMUTABLE "public, max-age=31536000, immutable"
+#define UI_CACHE_ENTRY "no-cache"
+
+typedef struct
+{
+    fstr<UI_NAME_SIZE> name;
+    fstr<UI_ETAG_SIZE> etag; // quoted, as sent
+    uint32_t raw_size;
+    uint32_t gz_size;
+} ui_file;
+
+typedef struct
+{
+    uint32_t requests;
+    uint32_t not_modified;
+    uint32_t not_acceptable; // no gzip in Accept-Encoding
+    uint32_t bytes_sent;   // gzip bodies
+    uint32_t bytes_raw;    // what the same bodies would be uncompressed
+} ui_stats;
+
+/*
+    iface for web
+*/
+
+void ui_init();
+void ui_web_init(AsyncWebServer *);
+
+void ui_print_json(Print &);
+
+#endif
@@ -0,0 +1,187 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "audio.h"
+#include "txm.h"
+#include "agc.h"
+
+#define AGC_PROPS 3
+
+static bool g_enabled = true;
+static volatile int8_t g_enable_req = -1; // from web, applied in the loop
+static agc_policy g_policy = { AGC_TARGET_DBFS, 100, 0, false, 0 };
+static int g_last_level = 0;
+
+static Si47xx *g_busy = NULL;  // chip with a command in flight
+static bool g_reading = false;
+
+static unsigned long g_sample_ms = 0;
+static unsigned long g_adjust_ms = 0;
+
+static agc_stats g_stats;
+
+static void agc_props(uint16_t props[AGC_PROPS][2])
+{
+    props[0][0] = SI47XX_PROP_LINE_LEVEL;
+    props[0][1] = (AGC_LINE_ATTEN << 12) | AGC_LINE_LEVEL_MV;
+    props[1][0] = SI47XX_PROP_ACOMP_THRESHOLD;
+    props[1][1] = (uint16_t) AGC_THRESHOLD_DBFS;
+    props[2][0] = SI47XX_PROP_ACOMP_GAIN;
+    props[2][1] = g_policy.gain;
+}
+
+// first unit whose properties are behind, started; false if all are in sync
+static bool agc_write_props()
+{
+    uint16_t props[AGC_PROPS][2];
+
+    agc_props(props);
+    for(unsigned int i = 0; i < txm_count(); i++) {
+        if(!txm_ready(i)) {
+            continue;
+        }
+
+        Si47xx *chip = txm_chip(i);
+        for(unsigned int k = 0; k < AGC_PROPS; k++) {
+            if(chip->start_property(props[k][0], props[k][1])) {
+                g_busy = chip;
+                g_stats.prop_writes++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void agc_sample(Si47xx *chip)
+{
+    int level = chip->CurrInLevel;
+
+    g_stats.samples++;
+    g_last_level = level;
+    if(chip->CurrASQ & SI47XX_ASQ_OVERMOD) {
+        g_stats.overmod++;
+    }
+
+    agc_policy_sample(&g_policy, level);
+}
+
+static void agc_adjust()
+{
+    uint8_t volume = audio_volume();
+    uint8_t reason = agc_decide(&g_policy, &volume, audio_running());
+
+    if(reason == AGC_REASON_UP || reason == AGC_REASON_DOWN) {
+        g_stats.adjusts++;
+    }
+    if(volume != audio_volume()) {
+        audio_set_volume(volume);
+        g_stats.volume_changes++;
+    }
+}
+
+/*
+    devices
+*/
+
+void agc_init(uint8_t ceiling)
+{
+    agc_policy_init(&g_policy, AGC_TARGET_DBFS, ceiling);
+    g_sample_ms = g_adjust_ms = millis();
+}
+
+static void agc_apply_enable(bool on)
+{
+    if(on != g_enabled) {
+        DLOG_I("AGC %s", on ? "on" : "off");
+    }
+    g_enabled = on;
+    if(!on) {
+        g_policy.gain = 0;
+        audio_set_volume(g_policy.ceiling);
+        g_policy.level_valid = false;
+    }
+}
+
+void agc_handle()
+{
+    if(g_enable_req >= 0) {
+        agc_apply_enable(g_enable_req);
+        g_enable_req = -1;
+    }
+
+    if(g_busy) {
+        if(!g_busy->done()) {
+            return;
+        }
+        if(g_reading) {
+            agc_sample(g_busy);
+            g_reading = false;
+        }
+        g_busy = NULL;
+    }
+
+    if(!txm_any_ready()) {
+        return;
+    }
+
+    // properties first, they are the output of the last adjustment - while
+    // off, until every ready unit has the gain cleared, then nothing
+    if(agc_write_props() || !g_enabled) {
+        return;
+    }
+
+    unsigned long current_ms = millis();
+
+    if((current_ms - g_sample_ms) >= AGC_SAMPLE_MS) {
+        for(unsigned int i = 0; i < txm_count(); i++) {
+            // all units take the same line input, the first one speaks for them
+            if(txm_ready(i) && txm_chip(i)->start_asq_status()) {
+                g_busy = txm_chip(i);
+                g_reading = true;
+                break;
+            }
+        }
+        g_sample_ms = current_ms;
+        return;
+    }
+
+    if(g_policy.level_valid && (current_ms - g_adjust_ms) >= AGC_ADJUST_MS) {
+        agc_adjust();
+        g_adjust_ms = current_ms;
+    }
+}
+
+// web handlers run on the network task, volume and level are the loop's
+void agc_enable(bool on)
+{
+    g_enable_req = on;
+}
+
+void agc_set_target(int dbfs)
+{
+    g_policy.target = constrain(dbfs, -40, 0);
+}
+
+void agc_set_ceiling(uint8_t volume)
+{
+    g_policy.ceiling = volume;
+    if(audio_volume() > volume || !g_enabled) {
+        audio_set_volume(volume);
+    }
+}
+
+/*
+    web
+*/
+
+void agc_print_json(Print &out)
+{
+    out.printf("{ \"result\": \"ok\", \"enabled\": %s, \"target\": %d, \"level\": %d, \"last_level\": %d",
+        g_enabled ? "true" : "false", g_policy.target, agc_policy_level(&g_policy), g_last_level);
+    out.printf(", \"volume\": %u, \"ceiling\": %u, \"gain\": %u",
+        audio_volume(), g_policy.ceiling, g_policy.gain);
+    out.printf(", \"samples\": %u, \"adjusts\": %u, \"volume_changes\": %u, \"prop_writes\": %u, \"overmod\": %u }",
+        g_stats.samples, g_stats.adjusts, g_stats.volume_changes, g_stats.prop_writes, g_stats.overmod);
+}
@@ -0,0 +1,78 @@
+#include "agc_policy.h"
+
+void agc_policy_init(agc_policy *p, int target, uint8_t ceiling)
+{
+    p->target = target;
+    p->ceiling = ceiling;
+    p->level_q8 = 0;
+    p->level_valid = false;
+    p->gain = 0;
+}
+
+void agc_policy_sample(agc_policy *p, int level)
+{
+    // gaps between tracks and pauses in speech would drag the average
+    // down and have the next adjustment chase them
+    if(level < AGC_SILENCE_DBFS) {
+        return;
+    }
+    if(!p->level_valid) {
+        p->level_q8 = level * 256;
+        p->level_valid = true;
+    } else {
+        p->level_q8 += (level * 256 - p->level_q8) >> AGC_EMA_SHIFT;
+    }
+}
+
+int agc_policy_level(const agc_policy *p)
+{
+    return p->level_q8 / 256;
+}
+
+uint8_t agc_decide(agc_policy *p, uint8_t *volume, bool playing)
+{
+    int level = agc_policy_level(p);
+    int error = p->target - level; // > 0 - too quiet
+
+    if(!p->level_valid || !playing) {
+        return AGC_REASON_QUIET;
+    }
+    if(error >= -AGC_DEADBAND_DB && error <= AGC_DEADBAND_DB) {
+        // nothing short any more, a gain left from before would stay for good
+        if(error <= 0) {
+            p->gain = 0;
+        }
+        return AGC_REASON_HOLD;
+    }
+
+    int steps = error * 10 / AGC_VOLUME_STEP_DB10;
+    if(steps > AGC_VOLUME_STEP_MAX) {
+        steps = AGC_VOLUME_STEP_MAX;
+    } else if(steps < -AGC_VOLUME_STEP_MAX) {
+        steps = -AGC_VOLUME_STEP_MAX;
+    } else if(!steps) {
+        steps = (error > 0) ? 1 : -1;
+    }
+
+    // ASQ measures the input ahead of the compressor, its gain never shows
+    // in the level and stepping it on the error would only ratchet it up -
+    // it covers open loop what the volume at the ceiling falls short by,
+    // followed only past the deadband so programme swings cost no writes
+    int gain = 0;
+    if(*volume >= p->ceiling && error > 0) {
+        gain = (error < AGC_GAIN_MAX) ? error : AGC_GAIN_MAX;
+    }
+    if(!gain || gain > p->gain + AGC_DEADBAND_DB || gain + AGC_DEADBAND_DB < p->gain) {
+        p->gain = gain;
+    }
+
+    int v = *volume;
+    if(error > 0 && v < p->ceiling) {
+        v = (v + steps < p->ceiling) ? v + steps : p->ceiling;
+    } else if(error < 0 && v > AGC_VOLUME_MIN) {
+        v = (v + steps > AGC_VOLUME_MIN) ? v + steps : AGC_VOLUME_MIN;
+    }
+    *volume = v;
+
+    return (error > 0) ? AGC_REASON_UP : AGC_REASON_DOWN;
+}
@@ -0,0 +1,625 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <VS1053.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "mem.h"
+#include "con.h"
+#include "devices.h"
+#include "audio.h"
+#include "fallback.h"
+#include "plugin.h"
+
+static VS1053 player(VS1053_CS, VS1053_DCS, VS1053_DREQ);
+
+static audio_source g_src[AUDIO_SOURCES];
+static hls_session g_hls[AUDIO_SOURCES];
+static int g_active = -1;
+static int g_standby = -1;
+
+static uint8_t g_volume = VS1053_VOLUME;
+static uint32_t g_prebuffer = 0;
+
+static audio_stats g_stats;
+static fstr<AUDIO_TITLE_SIZE> g_title;
+
+// for gap measurement on cut-over, the next fed chunk closes it
+static uint32_t g_last_feed_us = 0;
+static uint32_t *g_gap_pending = NULL;
+
+static bool g_fallback = false;
+static frame_parser g_fallback_frame;
+static bool g_stopped = false;        // audio_stop() - silence wanted, no fallback
+static unsigned long g_live_ms = 0;   // last live chunk fed
+static unsigned long g_steady_ms = 0; // live playing since
+
+// what the decoder was fed last, cuts to another stream wait for its frame to end
+static frame_parser *g_fed = NULL;
+static audio_ring *g_fed_ring = NULL;
+static uint8_t g_fed_codec = FRAME_CODEC_UNKNOWN;
+static bool g_resync = false;         // left in the middle of a frame that won't end
+static bool g_switching = false;      // audio_switch() waiting for a frame boundary
+
+static const char *audio_state_names[] = { "idle", "connecting", "buffering", "ready", "failed" };
+
+static void audio_icy_title(audio_source *s)
+{
+    const char *t = strstr(s->frame.meta.c_str(), "StreamTitle='");
+
+    s->frame.meta_ready = false;
+    if(!t) {
+        return;
+    }
+    t += 13;
+
+    const char *end = strstr(t, "';");
+    g_title.clear();
+    while(*t && t != end) {
+        g_title.append(*t++);
+    }
+    DLOG_I("Stream Title - %s", g_title.c_str());
+}
+
+/*
+    sources
+*/
+
+static void audio_source_close(audio_source *s)
+{
+    if(g_fed == &s->frame) {
+        g_resync |= frame_partial(&s->frame, &s->ring) > 0;
+        g_fed = NULL;
+    }
+
+    http_close(&s->http);
+    if(s->hls) {
+        hls_close(s->hls);
+        s->hls = NULL;
+    }
+    ring_reset(&s->ring);
+    frame_reset(&s->frame, 0, 0);
+    s->state = AUDIO_SRC_IDLE;
+    s->eof = false;
+}
+
+static bool audio_source_open(audio_source *s, const char *url)
+{
+    audio_source_close(s);
+
+    s->bytes_in = 0;
+    s->opened_ms = millis();
+    s->ready_ms = 0;
+
+    if(!s->ring.size) {
+        DLOG_E("No buffer for audio source");
+        s->state = AUDIO_SRC_FAILED;
+        return false;
+    }
+
+    if(hls_is_playlist(url)) {
+        s->hls = &g_hls[s - g_src];
+        s->http.url.set(url);
+        if(!hls_open(s->hls, url)) {
+            s->state = AUDIO_SRC_FAILED;
+            return false;
+        }
+    } else if(!http_open(&s->http, url, true)) {
+        s->state = AUDIO_SRC_FAILED;
+        return false;
+    }
+
+    s->state = AUDIO_SRC_CONNECTING;
+    return true;
+}
+
+static void audio_source_level(audio_source *s)
+{
+    if(frame_lost(&s->frame)) {
+        // a declared type we parse should have locked by now, anything else may be a format we don't
+        if(!s->hls && s->http.content_type.length()) {
+            DLOG_E("No %s frames in %u bytes - %s", s->http.content_type.c_str(), s->frame.stats.dropped,
+                s->http.url.c_str());
+            s->state = AUDIO_SRC_FAILED;
+            return;
+        }
+        DLOG_W("No frames in %u bytes, passing through", s->frame.stats.dropped);
+        frame_passthrough(&s->frame);
+    }
+
+    frame_scan(&s->frame, &s->ring);
+
+    uint32_t valid = frame_available(&s->frame, &s->ring);
+
+    // a full ring is as much as can be buffered, however much of it is junk
+    if(s->state == AUDIO_SRC_BUFFERING && (valid >= g_prebuffer || s->eof || !ring_free(&s->ring))) {
+        s->state = AUDIO_SRC_READY;
+        if(!s->ready_ms) {
+            s->ready_ms = millis();
+        }
+    }
+
+    if(s->eof && !valid) {
+        s->state = AUDIO_SRC_FAILED;
+    }
+}
+
+static void audio_source_pump_hls(audio_source *s)
+{
+    if(s->state != AUDIO_SRC_CONNECTING && s->state != AUDIO_SRC_BUFFERING && s->state != AUDIO_SRC_READY) {
+        return;
+    }
+
+    unsigned int st = hls_poll(s->hls, &s->ring);
+
+    s->bytes_in = s->hls->stats.bytes_in;
+    if(st == HLS_STATE_FAILED) {
+        s->state = AUDIO_SRC_FAILED;
+        return;
+    }
+    if(st == HLS_STATE_DONE) {
+        s->eof = true;
+    }
+    if(s->state == AUDIO_SRC_CONNECTING && st != HLS_STATE_LOADING) {
+        s->state = AUDIO_SRC_BUFFERING;
+    }
+
+    audio_source_level(s);
+}
+
+static void audio_source_pump(audio_source *s)
+{
+    // a server that takes the connection and sends nothing, or a playlist
+    // that never yields a segment - failed, the retry in devices reopens it
+    if(s->state == AUDIO_SRC_CONNECTING && (millis() - s->opened_ms) >= AUDIO_CONNECT_TIMEOUT_MS) {
+        DLOG_W("No audio after %u ms - %s", AUDIO_CONNECT_TIMEOUT_MS, s->http.url.c_str());
+        s->state = AUDIO_SRC_FAILED;
+        return;
+    }
+
+    if(s->hls) {
+        audio_source_pump_hls(s);
+        return;
+    }
+
+    if(s->state == AUDIO_SRC_CONNECTING) {
+        unsigned int st = http_poll(&s->http);
+
+        if(st == HTTP_STATE_BODY) {
+            const char *type = s->http.content_type.c_str();
+
+            frame_reset(&s->frame, s->ring.head, s->http.metaint);
+            if(type[0] && !frame_parses(type)) {
+                DLOG_I("Passing %s through unparsed", type);
+                frame_passthrough(&s->frame);
+            }
+            s->state = AUDIO_SRC_BUFFERING;
+
+            if(s->http.name.length()) {
+                DLOG_W("Station - %s", s->http.name.c_str());
+            }
+        } else if(st == HTTP_STATE_FAILED) {
+            s->state = AUDIO_SRC_FAILED;
+        }
+        return;
+    }
+
+    if(s->state != AUDIO_SRC_BUFFERING && s->state != AUDIO_SRC_READY) {
+        return;
+    }
+
+    if(!s->eof) {
+        uint8_t *p;
+        uint32_t span = ring_write_span(&s->ring, &p);
+
+        if(span) {
+            int n = http_read(&s->http, p, min(span, (uint32_t) AUDIO_READ_CHUNK));
+
+            if(n > 0) {
+                s->bytes_in += n;
+                ring_commit(&s->ring, frame_icy_strip(&s->frame, p, n));
+                if(s->frame.meta_ready) {
+                    audio_icy_title(s);
+                }
+            } else if(n < 0 && s->http.state == HTTP_STATE_FAILED) {
+                // stalled, the retry in devices reconnects
+                s->state = AUDIO_SRC_FAILED;
+                return;
+            } else if(n < 0) {
+                DLOG_W("EOF - %s", s->http.url.c_str());
+                s->eof = true;
+            }
+        }
+    }
+
+    audio_source_level(s);
+}
+
+/*
+    sink
+*/
+
+// finish - only the rest of the frame being fed
+static uint32_t audio_feed(audio_ring *r, frame_parser *f, bool finish, bool *empty)
+{
+    uint32_t total = 0;
+
+    *empty = false;
+    while(player.data_request()) {
+        if(finish && !frame_partial(f, r)) {
+            break;
+        }
+
+        uint8_t *p;
+        uint32_t n = frame_span(f, r, &p);
+
+        if(!n) {
+            *empty = true;
+            break;
+        }
+
+        n = min(n, (uint32_t) AUDIO_SINK_CHUNK);
+        player.playChunk(p, n);
+        if(f != &g_fallback_frame) {
+            fallback_capture(p, n, f->codec == FRAME_CODEC_MP3);
+        }
+        ring_consume(r, n);
+        total += n;
+
+        if(g_gap_pending) {
+            *g_gap_pending = micros() - g_last_feed_us;
+            g_gap_pending = NULL;
+        }
+        g_last_feed_us = micros();
+    }
+
+    if(total) {
+        g_fed = f;
+        g_fed_ring = r;
+        g_fed_codec = f->codec;
+    }
+    g_stats.bytes_out += total;
+    return total;
+}
+
+static void audio_sink(audio_source *s)
+{
+    bool empty;
+
+    if(s->state != AUDIO_SRC_READY) {
+        return;
+    }
+
+    if(audio_feed(&s->ring, &s->frame, false, &empty)) {
+        g_live_ms = millis();
+    }
+    if(empty && !s->eof) {
+        g_stats.underruns++;
+        s->state = AUDIO_SRC_BUFFERING;
+    }
+}
+
+static void audio_fallback_sink()
+{
+    bool empty;
+
+    frame_scan(&g_fallback_frame, fallback_ring());
+    fallback_fed(audio_feed(fallback_ring(), &g_fallback_frame, false, &empty));
+}
+
+/*
+    cuts between streams
+*/
+
+// the rest of the frame on its way into the decoder, true once it's out
+static bool audio_finish()
+{
+    bool empty;
+
+    if(!g_fed) {
+        return true;
+    }
+    audio_feed(g_fed_ring, g_fed, true, &empty);
+    return !frame_partial(g_fed, g_fed_ring);
+}
+
+static void audio_restart()
+{
+    player.stopSong();
+    player.startSong();
+    g_fed = NULL;
+    g_fed_codec = FRAME_CODEC_UNKNOWN;
+    g_resync = false;
+}
+
+// at a frame boundary, the next stream is in codec; the decoder only takes
+// another codec, or anything after a frame cut short, from a clean start
+static void audio_cut(uint8_t codec)
+{
+    if(g_resync || (g_fed_codec != FRAME_CODEC_UNKNOWN && (codec != g_fed_codec || codec == FRAME_CODEC_RAW))) {
+        audio_restart();
+        g_stats.resyncs++;
+    }
+    g_fed = NULL;
+}
+
+/*
+    decoder
+*/
+
+// patches don't survive a reset, anything resetting the VS1053 goes through here
+static void audio_decoder_reset()
+{
+    player.switchToMp3Mode(); // ends in a soft reset
+    if(!plugin_load(VS1053_CS, VS1053_DREQ)) {
+        // a half loaded patch is worse than none
+        DLOG_W("Decoder runs ROM firmware");
+        player.softReset();
+    }
+    player.setVolume(g_volume);
+
+    // the decoder takes data once DREQ is up, nothing else to wait for
+    unsigned long start_ms = millis();
+    while(!player.data_request()) {
+        if(millis() - start_ms >= AUDIO_READY_TIMEOUT_MS) {
+            DLOG_E("VS1053 not ready after reset");
+            break;
+        }
+        delay(1);
+    }
+}
+
+// scheduled cut to the standby source, once the active one is between frames
+static void audio_switch_cut()
+{
+    if(!g_fallback && !audio_finish()) {
+        return;
+    }
+    g_switching = false;
+
+    if(g_active >= 0) {
+        audio_source_close(&g_src[g_active]);
+    }
+
+    g_active = g_standby;
+    g_standby = -1;
+    g_stats.switches++;
+    g_gap_pending = &g_stats.last_switch_gap_us;
+
+    // the first chunk from the new source closes the gap measurement
+    if(!g_fallback) {
+        audio_cut(g_src[g_active].frame.codec);
+        audio_sink(&g_src[g_active]);
+    }
+}
+
+/*
+    devices
+*/
+
+void audio_init()
+{
+    uint32_t size = mem_has_psram() ? AUDIO_RING_SIZE : AUDIO_RING_SIZE_SMALL;
+
+    http_init();
+    for(unsigned int i = 0; i < AUDIO_SOURCES; i++) {
+        ring_init(&g_src[i].ring, (uint8_t *) mem_bulk_alloc(size), size);
+        g_src[i].state = AUDIO_SRC_IDLE;
+        g_src[i].hls = NULL;
+        frame_reset(&g_src[i].frame, 0, 0);
+        hls_init(&g_hls[i]);
+    }
+    g_prebuffer = size / 100 * AUDIO_PREBUFFER_PCT;
+
+    fallback_init();
+    g_live_ms = millis();
+
+    SPI.begin();
+    player.begin();
+    audio_decoder_reset();
+    devices_boot_mark("plugins");
+}
+
+void audio_handle()
+{
+    unsigned long current_ms = millis();
+    uint32_t start_us = micros();
+
+    for(unsigned int i = 0; i < AUDIO_SOURCES; i++) {
+        audio_source_pump(&g_src[i]);
+    }
+    g_stats.net_us += micros() - start_us;
+
+    if(g_switching) {
+        audio_switch_cut();
+    }
+
+    audio_source *s = (g_active >= 0) ? &g_src[g_active] : NULL;
+    bool live = s && s->state == AUDIO_SRC_READY;
+
+    if(live && s->ready_ms && !g_stats.last_startup_ms) {
+        g_stats.last_startup_ms = s->ready_ms - s->opened_ms;
+    }
+
+    if(g_fallback && live) {
+        // live has prebuffered again, back once the fallback frame on its way is out
+        if(audio_finish()) {
+            fallback_stop();
+            g_fallback = false;
+            audio_cut(s->frame.codec);
+            g_stats.fallback_out++;
+            g_gap_pending = &g_stats.last_fallback_out_us;
+        }
+    } else if(!g_fallback && !live && !g_stopped && (current_ms - g_live_ms) >= AUDIO_FALLBACK_AFTER_MS && fallback_available()
+        && audio_finish()) {
+        fallback_start();
+        g_fallback = fallback_playing();
+        if(g_fallback) {
+            frame_reset(&g_fallback_frame, fallback_ring()->head, 0);
+            audio_cut(FRAME_CODEC_MP3);
+            g_stats.fallback_in++;
+            g_gap_pending = &g_stats.last_fallback_in_us;
+        }
+    }
+
+    if(!live || g_fallback) {
+        g_steady_ms = 0;
+    } else if(!g_steady_ms) {
+        g_steady_ms = current_ms;
+    }
+    fallback_handle(g_steady_ms ? current_ms - g_steady_ms : 0);
+
+    start_us = micros();
+    if(g_fallback) {
+        audio_fallback_sink();
+    } else if(s && !g_switching) {
+        audio_sink(s);
+    }
+    g_stats.sink_us += micros() - start_us;
+}
+
+bool audio_play(const char *url)
+{
+    for(unsigned int i = 0; i < AUDIO_SOURCES; i++) {
+        audio_source_close(&g_src[i]);
+    }
+
+    g_active = 0;
+    g_standby = -1;
+    g_switching = false;
+    g_stopped = false;
+    g_stats.last_startup_ms = 0;
+    // a fallback on air keeps the decoder busy until the new source is ready,
+    // the cut back restarts it if the new one turns out another codec
+    if(!g_fallback) {
+        audio_restart();
+    }
+
+    return audio_source_open(&g_src[g_active], url);
+}
+
+void audio_stop()
+{
+    for(unsigned int i = 0; i < AUDIO_SOURCES; i++) {
+        audio_source_close(&g_src[i]);
+    }
+    g_active = -1;
+    g_standby = -1;
+    g_switching = false;
+    fallback_stop();
+    g_fallback = false;
+    g_stopped = true;
+    audio_restart();
+}
+
+bool audio_active()
+{
+    return g_active >= 0 && g_src[g_active].state != AUDIO_SRC_FAILED
+        && g_src[g_active].state != AUDIO_SRC_IDLE;
+}
+
+bool audio_running()
+{
+    return g_active >= 0 && g_src[g_active].state == AUDIO_SRC_READY && !g_fallback;
+}
+
+bool audio_on_fallback()
+{
+    return g_fallback;
+}
+
+void audio_get_load(audio_load *l)
+{
+    const audio_ring *r = g_fallback ? fallback_ring() : (g_active >= 0 ? &g_src[g_active].ring : NULL);
+
+    l->net_us = g_stats.net_us;
+    l->sink_us = g_stats.sink_us;
+    l->bytes_out = g_stats.bytes_out;
+    l->margin_pct = (r && r->size) ? (uint64_t) ring_used(r) * 100 / r->size : 0;
+    l->playing = g_fallback || audio_running();
+    l->filling = false;
+    for(unsigned int i = 0; i < AUDIO_SOURCES; i++) {
+        if(g_src[i].state == AUDIO_SRC_CONNECTING || g_src[i].state == AUDIO_SRC_BUFFERING) {
+            l->filling = true;
+        }
+    }
+}
+
+void audio_set_volume(uint8_t volume)
+{
+    if(volume != g_volume) {
+        g_volume = volume;
+        player.setVolume(volume);
+    }
+}
+
+uint8_t audio_volume()
+{
+    return g_volume;
+}
+
+/*
+    scheduler
+*/
+
+bool audio_prepare(const char *url)
+{
+    g_standby = (g_active == 0) ? 1 : 0;
+
+    DLOG_I("Prebuffering %s", url);
+    return audio_source_open(&g_src[g_standby], url);
+}
+
+bool audio_prepared()
+{
+    return g_standby >= 0 && g_src[g_standby].state == AUDIO_SRC_READY;
+}
+
+// right away if the decoder is between frames, else audio_handle() finishes it
+bool audio_switch()
+{
+    if(g_standby < 0) {
+        return false;
+    }
+
+    g_switching = true;
+    audio_switch_cut();
+    return true;
+}
+
+/*
+    web
+*/
+
+void audio_print_json(Print &out)
+{
+    out.printf("{ \"result\": \"ok\", \"active\": %d, \"volume\": %u, \"title\": ", g_active, g_volume);
+    print_json_string(out, g_title.c_str());
+    out.print(", \"sources\": [");
+
+    for(unsigned int i = 0; i < AUDIO_SOURCES; i++) {
+        audio_source *s = &g_src[i];
+
+        out.printf("%s{ \"state\": \"%s\", \"url\": ", i ? ", " : "", audio_state_names[s->state]);
+        print_json_string(out, s->http.url.c_str());
+        out.printf(", \"buffered\": %u, \"size\": %u, \"bytes_in\": %u", ring_used(&s->ring), s->ring.size, s->bytes_in);
+        if(s->hls) {
+            out.print(", \"hls\": ");
+            hls_print_json(out, s->hls);
+        } else {
+            out.print(", \"timing\": ");
+            http_print_timing_json(out, &s->http);
+        }
+        out.print(", \"frame\": ");
+        frame_print_json(out, &s->frame);
+        out.print(" }");
+    }
+
+    out.printf("], \"bytes_out\": %u, \"underruns\": %u, \"switches\": %u, \"last_switch_gap_us\": %u, \"startup_ms\": %u, \"resyncs\": %u",
+        g_stats.bytes_out, g_stats.underruns, g_stats.switches, g_stats.last_switch_gap_us, g_stats.last_startup_ms,
+        g_stats.resyncs);
+    out.printf(", \"fallback_in\": %u, \"fallback_out\": %u, \"last_fallback_in_us\": %u, \"last_fallback_out_us\": %u, \"fallback\": ",
+        g_stats.fallback_in, g_stats.fallback_out, g_stats.last_fallback_in_us, g_stats.last_fallback_out_us);
+    fallback_print_json(out);
+    out.print(" }");
+}
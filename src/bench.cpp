@@ -0,0 +1,307 @@
+#ifdef BENCH_ENABLE
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "mem.h"
+#include "con.h"
+#include "power.h"
+#include "bench.h"
+
+#define BENCH_IDLE 0
+#define BENCH_RUNNING 1
+#define BENCH_DONE 2
+
+#define BENCH_APS 20
+
+class NullPrint : public Print {
+  public:
+    size_t write(uint8_t) { bytes++; return 1; }
+    size_t write(const uint8_t *, size_t n) { bytes += n; return n; }
+    uint32_t bytes = 0;
+};
+
+// reads a fixed string, rewound before every op
+class BufStream : public Stream {
+  public:
+    BufStream(const char *s) : _s(s), _len(strlen(s)) { setTimeout(0); }
+    void rewind() { _pos = 0; }
+    int available() { return _len - _pos; }
+    int read() { return (_pos < _len) ? (uint8_t) _s[_pos++] : -1; }
+    int peek() { return (_pos < _len) ? (uint8_t) _s[_pos] : -1; }
+    size_t write(uint8_t) { return 0; }
+
+  private:
+    const char *_s;
+    size_t _len;
+    size_t _pos = 0;
+};
+
+static volatile bool g_requested = false;
+static unsigned int g_state = BENCH_IDLE;
+static unsigned int g_next = 0;
+static unsigned int g_mhz = 0;
+static bool g_prepared = false;
+
+static bench_result g_results[BENCH_MAX_CASES];
+
+// data the cases work on, prepared once
+static wifi_ap_record_t g_aps[BENCH_APS];
+static BufStream g_config("MyHomeNetwork-5G\nsome-long-wpa2-passphrase\n");
+static fstr<WIFI_SSID_SIZE> g_ssid;
+static fstr<WIFI_KEY_SIZE> g_key;
+static NullPrint g_null;
+static volatile uint32_t g_sink;
+
+/*
+    allocation accounting
+*/
+
+static volatile TaskHandle_t g_alloc_task = NULL; // counting while set
+static uint32_t g_allocs = 0;
+static uint32_t g_alloc_bytes = 0;
+static int32_t g_live = 0;
+static int32_t g_peak = 0;
+
+#ifdef BENCH_ALLOC
+extern "C" {
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+void __real_free(void *);
+
+static void bench_alloc_add(void *p)
+{
+    if(p && g_alloc_task == xTaskGetCurrentTaskHandle()) {
+        int32_t size = heap_caps_get_allocated_size(p);
+
+        g_allocs++;
+        g_alloc_bytes += size;
+        g_live += size;
+        if(g_live > g_peak) {
+            g_peak = g_live;
+        }
+    }
+}
+
+static void bench_alloc_sub(void *p)
+{
+    if(p && g_alloc_task == xTaskGetCurrentTaskHandle()) {
+        g_live -= heap_caps_get_allocated_size(p);
+    }
+}
+
+void *__wrap_malloc(size_t size)
+{
+    void *p = __real_malloc(size);
+    bench_alloc_add(p);
+    return p;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    void *p = __real_calloc(n, size);
+    bench_alloc_add(p);
+    return p;
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    bench_alloc_sub(p);
+    void *q = __real_realloc(p, size);
+    bench_alloc_add(q ? q : p);
+    return q;
+}
+
+void __wrap_free(void *p)
+{
+    bench_alloc_sub(p);
+    __real_free(p);
+}
+
+}
+#endif
+
+/*
+    cases
+*/
+
+static void bench_nets_json()
+{
+    g_null.print("{ \"result\": \"ok\", \"list\": [");
+    for(unsigned int i = 0; i < BENCH_APS; i++) {
+        if(i) g_null.print(", ");
+        print_ap_json(g_null, &g_aps[i]);
+    }
+    g_null.print("], \"scan_state\": \"done\"}");
+}
+
+static void bench_config_parse()
+{
+    g_config.rewind();
+    g_sink = con_config_parse(g_config, &g_ssid, &g_key) == NULL;
+}
+
+static void bench_config_write()
+{
+    con_config_write(g_null, "MyHomeNetwork-5G", "some-long-wpa2-passphrase");
+}
+
+// target only, the portable cases in bench_portable.cpp run after these
+static const bench_case bench_cases[] = {
+    { "nets_json", bench_nets_json },
+    { "config_parse", bench_config_parse },
+    { "config_write", bench_config_write },
+};
+
+#define BENCH_TARGET_CASES (sizeof(bench_cases) / sizeof(bench_cases[0]))
+#define BENCH_CASES (BENCH_TARGET_CASES + bench_portable_count)
+
+static const bench_case *bench_case_at(unsigned int i)
+{
+    return (i < BENCH_TARGET_CASES) ? &bench_cases[i] : &bench_portable_cases[i - BENCH_TARGET_CASES];
+}
+
+/*
+    runner
+*/
+
+static void bench_prepare()
+{
+    if(g_prepared) {
+        return;
+    }
+
+    for(unsigned int i = 0; i < BENCH_APS; i++) {
+        wifi_ap_record_t *ap = &g_aps[i];
+
+        memset(ap, 0, sizeof(*ap));
+        snprintf((char *) ap->ssid, sizeof(ap->ssid), "network \"%02u\" \\ %s", i, (i & 1) ? "5G" : "guest");
+        for(unsigned int k = 0; k < 6; k++) {
+            ap->bssid[k] = i * 6 + k;
+        }
+        ap->primary = 1 + i % 13;
+        ap->rssi = -40 - i * 2;
+        ap->authmode = WIFI_AUTH_WPA2_PSK;
+    }
+
+    bench_portable_prepare();
+
+    g_prepared = true;
+}
+
+static uint32_t bench_time_us(const bench_case *c, uint32_t iters)
+{
+    uint32_t start_us = micros();
+
+    for(uint32_t i = 0; i < iters; i++) {
+        c->op();
+    }
+    return micros() - start_us;
+}
+
+static void bench_run(const bench_case *c, bench_result *r)
+{
+    uint32_t iters = 1;
+    uint32_t us;
+
+    // double until a batch is measurable, then scale to the target
+    while((us = bench_time_us(c, iters)) < BENCH_CALIBRATE_MS * 1000 && iters < (1u << 24)) {
+        iters *= 2;
+    }
+    iters = max((uint64_t) 1, (uint64_t) iters * BENCH_TARGET_MS * 1000 / max(us, (uint32_t) 1));
+
+    g_allocs = g_alloc_bytes = 0;
+    g_live = g_peak = 0;
+    g_alloc_task = xTaskGetCurrentTaskHandle();
+
+    uint32_t start_cycles = ESP.getCycleCount();
+    uint32_t start_us = micros();
+    for(uint32_t i = 0; i < iters; i++) {
+        c->op();
+    }
+    r->us = micros() - start_us;
+    r->cycles = ESP.getCycleCount() - start_cycles;
+
+    g_alloc_task = NULL;
+
+    r->name = c->name;
+    r->iters = iters;
+    r->allocs = g_allocs;
+    r->alloc_bytes = g_alloc_bytes;
+    r->peak_bytes = g_peak;
+}
+
+/*
+    devices
+*/
+
+void bench_request()
+{
+    g_requested = true;
+}
+
+void bench_handle()
+{
+    if(g_requested && g_state != BENCH_RUNNING) {
+        g_requested = false;
+        bench_prepare();
+        // the governor would change the clock under the suite
+        power_hold(true);
+        g_mhz = getCpuFrequencyMhz();
+        g_next = 0;
+        g_state = BENCH_RUNNING;
+        DLOG_I("Bench started, %u cases at %u MHz", BENCH_CASES, g_mhz);
+        return;
+    }
+    if(g_state != BENCH_RUNNING) {
+        return;
+    }
+
+    // one case per pass, the rest of the loop gets to run in between
+    bench_run(bench_case_at(g_next), &g_results[g_next]);
+    if(++g_next == BENCH_CASES) {
+        g_state = BENCH_DONE;
+        power_hold(false);
+        DLOG_I("Bench done");
+    }
+}
+
+/*
+    web
+*/
+
+void bench_print_json(Print &out)
+{
+    static const char *states[] = { "idle", "running", "done" };
+
+#ifdef BENCH_ALLOC
+    bool alloc = true;
+#else
+    bool alloc = false;
+#endif
+
+    out.printf("{ \"result\": \"ok\", \"state\": \"%s\", \"mhz\": %u, \"alloc\": %s, \"cases\": [",
+        states[g_state], g_mhz, alloc ? "true" : "false");
+    for(unsigned int i = 0; i < ((g_state == BENCH_DONE) ? BENCH_CASES : g_next); i++) {
+        const bench_result *r = &g_results[i];
+
+        out.printf("%s { \"name\": \"%s\", \"iters\": %u, \"ns_per_op\": %.1f, \"cycles_per_op\": %.1f",
+            i ? "," : "", r->name, r->iters, r->us * 1000.0 / r->iters, (double) r->cycles / r->iters);
+        if(alloc) {
+            out.printf(", \"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f, \"peak_bytes\": %d }",
+                (double) r->allocs / r->iters, (double) r->alloc_bytes / r->iters, r->peak_bytes);
+        } else {
+            out.print(", \"allocs_per_op\": null, \"bytes_per_op\": null, \"peak_bytes\": null }");
+        }
+    }
+    out.print(" ] }");
+}
+
+#endif
\ No newline at end of file
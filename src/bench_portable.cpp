@@ -0,0 +1,226 @@
+#ifdef BENCH_ENABLE
+
+#include <Arduino.h>
+
+#include "mem.h"
+#include "ring.h"
+#include "si47xx.h"
+#include "http_url.h"
+#include "ts.h"
+#include "frame.h"
+#include "bench.h"
+
+/*
+    Cases on code that needs neither Arduino nor IDF beyond the basics,
+    shared by /bench and the host bench, see test/bench/host.cpp. The
+    sizes below follow audio.h and devices.h, which don't build off
+    target.
+*/
+
+#define BENCH_DATA_SIZE (16 * 1024)
+#define BENCH_SEGMENT 1460           // AUDIO_READ_CHUNK, a TCP segment
+#define BENCH_SINK_CHUNK 32          // AUDIO_SINK_CHUNK
+#define BENCH_FM_FREQ 93200          // FM_FREQ
+#define BENCH_FM_POWER 120           // FM_POWER
+#define BENCH_ICY_INTERVAL 4000
+#define BENCH_TS_PACKETS (BENCH_DATA_SIZE / TS_PACKET)
+#define BENCH_TS_PID 0x101
+#define BENCH_RING_SIZE (8 * 1024)
+#define BENCH_MP3_HEADER 0xFFFB9064 // MPEG 1 layer III, 128 kbit/s, 44.1 kHz
+#define BENCH_MP3_FRAME 417
+#define BENCH_DAMAGE_EVERY 8         // frames
+
+static bool g_prepared = false;
+
+static uint8_t *g_data;     // worked on in place
+static uint8_t *g_icy;      // stream with metadata blocks
+static uint8_t *g_ts;       // transport stream packets
+static frame_parser g_icy_parser;
+static frame_parser g_frame;
+static audio_ring g_mp3;     // whole frames
+static audio_ring g_damaged; // every few frames a broken header
+static audio_ring g_noise;
+static ts_demux g_demux;
+static audio_ring g_ring;
+static uint8_t g_cmd[16];
+static volatile uint32_t g_sink;
+
+/*
+    cases
+*/
+
+static void bench_si47xx_encode()
+{
+    uint32_t n = Si47xx::encode_tune(g_cmd, 0x30, BENCH_FM_FREQ);
+    n += Si47xx::encode_power(g_cmd, BENCH_FM_POWER, 0);
+    n += Si47xx::encode_property(g_cmd, 0x2204, 15);
+    g_sink = n;
+}
+
+// set_rds_station() packing, 8 character PS in two slots
+static void bench_rds_ps()
+{
+    const char *s = "HAIIIE  ";
+
+    for(unsigned int i = 0; i < 2; i++, s += 4) {
+        g_sink = Si47xx::encode_rds_ps(g_cmd, i, s);
+    }
+}
+
+// set_rds_buffer() packing, 64 character radiotext in 16 groups
+static void bench_rds_rt()
+{
+    const char *s = "Artist Name - A Rather Long Song Title (Radio Edit) on HAIIIE FM";
+
+    for(unsigned int i = 0; i < 16; i++, s += 4) {
+        g_sink = Si47xx::encode_rds_buffer(g_cmd, i, s);
+    }
+}
+
+// the network writes a TCP segment, the sink drains it in SDI chunks
+static void bench_ring_push_pop()
+{
+    ring_push(&g_ring, g_data, BENCH_SEGMENT);
+    while(ring_used(&g_ring)) {
+        uint8_t *p;
+        uint32_t n = min(ring_read_span(&g_ring, &p), (uint32_t) BENCH_SINK_CHUNK);
+        g_sink = p[0];
+        ring_consume(&g_ring, n);
+    }
+}
+
+// reference for the in-place cases below, they copy their input first
+static void bench_copy_16k()
+{
+    memcpy(g_data, g_icy, BENCH_DATA_SIZE);
+}
+
+static void bench_icy_strip()
+{
+    memcpy(g_data, g_icy, BENCH_DATA_SIZE);
+    g_icy_parser.icy_audio_left = BENCH_ICY_INTERVAL;
+    g_icy_parser.icy_meta_left = -1;
+    g_sink = frame_icy_strip(&g_icy_parser, g_data, BENCH_DATA_SIZE);
+}
+
+// a full ring through the frame parser and out in sink chunks, the data is only read
+static void bench_frame_ring(audio_ring *r)
+{
+    uint8_t *p;
+    uint32_t n;
+
+    r->tail = 0;
+    frame_reset(&g_frame, 0, 0);
+    frame_scan(&g_frame, r);
+    while((n = frame_span(&g_frame, r, &p))) {
+        g_sink = p[0];
+        ring_consume(r, min(n, (uint32_t) BENCH_SINK_CHUNK));
+    }
+}
+
+static void bench_frame_mp3()
+{
+    bench_frame_ring(&g_mp3);
+}
+
+static void bench_frame_damaged()
+{
+    bench_frame_ring(&g_damaged);
+}
+
+// nothing locks, every byte is a sync attempt
+static void bench_frame_noise()
+{
+    bench_frame_ring(&g_noise);
+}
+
+static void bench_ts_demux()
+{
+    memcpy(g_data, g_ts, BENCH_TS_PACKETS * TS_PACKET);
+    g_sink = ts_inplace(&g_demux, g_data, BENCH_TS_PACKETS * TS_PACKET);
+}
+
+static void bench_url_parse()
+{
+    http_url u;
+    g_sink = http_parse_url("https://stream.example.com:8443/live/radio-256.mp3?token=abc", &u);
+}
+
+const bench_case bench_portable_cases[] = {
+    { "si47xx_encode", bench_si47xx_encode },
+    { "rds_ps", bench_rds_ps },
+    { "rds_rt", bench_rds_rt },
+    { "ring_push_pop", bench_ring_push_pop },
+    { "copy_16k", bench_copy_16k },
+    { "icy_strip_16k", bench_icy_strip },
+    { "frame_mp3_16k", bench_frame_mp3 },
+    { "frame_damaged_16k", bench_frame_damaged },
+    { "frame_noise_16k", bench_frame_noise },
+    { "ts_demux_16k", bench_ts_demux },
+    { "url_parse", bench_url_parse },
+};
+
+const unsigned int bench_portable_count = sizeof(bench_portable_cases) / sizeof(bench_portable_cases[0]);
+
+/*
+    data
+*/
+
+void bench_portable_prepare()
+{
+    if(g_prepared) {
+        return;
+    }
+
+    g_data = (uint8_t *) mem_bulk_alloc(BENCH_DATA_SIZE);
+    g_icy = (uint8_t *) mem_bulk_alloc(BENCH_DATA_SIZE);
+    g_ts = (uint8_t *) mem_bulk_alloc(BENCH_DATA_SIZE);
+    ring_init(&g_ring, (uint8_t *) mem_bulk_alloc(BENCH_RING_SIZE), BENCH_RING_SIZE);
+
+    // audio with an empty metadata block every interval, as most servers send
+    for(uint32_t i = 0; i < BENCH_DATA_SIZE; i++) {
+        g_icy[i] = ((i + 1) % (BENCH_ICY_INTERVAL + 1) == 0) ? 0 : (uint8_t) (i * 31);
+    }
+    g_icy_parser.icy_interval = BENCH_ICY_INTERVAL;
+
+    // rings handed over full, cases only rewind the tail
+    ring_init(&g_mp3, (uint8_t *) mem_bulk_alloc(BENCH_DATA_SIZE), BENCH_DATA_SIZE);
+    ring_init(&g_damaged, (uint8_t *) mem_bulk_alloc(BENCH_DATA_SIZE), BENCH_DATA_SIZE);
+    ring_init(&g_noise, (uint8_t *) mem_bulk_alloc(BENCH_DATA_SIZE), BENCH_DATA_SIZE);
+    uint32_t seed = 1;
+    for(uint32_t i = 0; i < BENCH_DATA_SIZE; i++) {
+        uint32_t at = i % BENCH_MP3_FRAME;
+        uint8_t b = (at < 4) ? (uint8_t) (BENCH_MP3_HEADER >> (24 - at * 8)) : (uint8_t) (i * 7);
+
+        g_mp3.buf[i] = b;
+        g_damaged.buf[i] = (at == 1 && (i / BENCH_MP3_FRAME) % BENCH_DAMAGE_EVERY == BENCH_DAMAGE_EVERY - 1) ? 0 : b;
+        seed = seed * 1103515245 + 12345;
+        g_noise.buf[i] = seed >> 16;
+    }
+    ring_commit(&g_mp3, BENCH_DATA_SIZE);
+    ring_commit(&g_damaged, BENCH_DATA_SIZE);
+    ring_commit(&g_noise, BENCH_DATA_SIZE);
+
+    // audio PID only, a PES header every 8 packets
+    for(uint32_t i = 0; i < BENCH_TS_PACKETS; i++) {
+        uint8_t *p = g_ts + i * TS_PACKET;
+        bool pusi = (i % 8) == 0;
+
+        memset(p, (uint8_t) i, TS_PACKET);
+        p[0] = TS_SYNC;
+        p[1] = (pusi ? 0x40 : 0) | (BENCH_TS_PID >> 8);
+        p[2] = BENCH_TS_PID & 0xFF;
+        p[3] = 0x10;
+        if(pusi) {
+            const uint8_t pes[] = { 0, 0, 1, 0xC0, 0, 0, 0x80, 0x80, 5, 0x21, 0, 1, 0, 1 };
+            memcpy(p + 4, pes, sizeof(pes));
+        }
+    }
+    ts_reset(&g_demux);
+    g_demux.pmt_pid = 0x1000;
+    g_demux.audio_pid = BENCH_TS_PID;
+
+    g_prepared = true;
+}
+
+#endif
\ No newline at end of file
@@ -5,10 +5,15 @@
 #include <time.h>
 
 #include "config.h"
+#include "dlog.h"
 #include "con.h"
 #include "devices.h"
+#include "audio.h"
 
 wifi_state g_con;
+static con_trial g_trial;
+
+static const char *con_trial_names[] = { "idle", "connecting", "done", "failed" };
 
 static void con_ap_init() 
 {
@@ -25,10 +30,10 @@ static void con_mdns_init()
     if(MDNS.begin(g_con.host_id.c_str()) != ESP_OK) {
         int s_num = MDNS.addService("http", "tcp", 80);
         if(s_num == 0) {
-            ESP_LOGW(TAG, "Can't add mDNS service to responder");
+            DLOG_W("Can't add mDNS service to responder");
         }      
     } else {
-        ESP_LOGW(TAG, "Error setting up MDNS responder");
+        DLOG_W("Error setting up MDNS responder");
     }
 }
 
@@ -38,7 +43,7 @@ static void con_sta_init()
 
     g_con.state = CON_STATE_CLIENT;
   
-    ESP_LOGI(TAG, "Connecting to WiFi %s (%s)", g_con.ssid.c_str(), g_con.key.c_str());
+    DLOG_I("Connecting to WiFi %s", g_con.ssid.c_str());
   
     WiFi.mode(WIFI_STA);
     WiFi.setHostname(g_con.host_id.c_str());
@@ -50,53 +55,48 @@ static void con_sta_init()
     }
   
     if(WiFi.status() != WL_CONNECTED) {
-        ESP_LOGI(TAG, "Can't connect to %s - timeout. Starting AP", g_con.ssid.c_str());
+        DLOG_I("Can't connect to %s - timeout. Starting AP", g_con.ssid.c_str());
         con_ap_init();
     } else {
-        ESP_LOGI(TAG, "Connected to %s - %s [%d]", g_con.ssid.c_str(), WiFi.localIP().toString().c_str(), WiFi.RSSI());
+        DLOG_I("Connected to %s - %s [%d]", g_con.ssid.c_str(), WiFi.localIP().toString().c_str(), WiFi.RSSI());
         set_led_state(LED_STATE_STA);
     }
 }
 
 
+static void con_read_line(Stream &f, char *buf, size_t size)
+{
+    size_t n = f.readBytesUntil('\n', buf, size - 1);
+    buf[n] = 0;
+
+    // drop the rest of an overlong line
+    if(n == size - 1) {
+        while(f.available() && f.read() != '\n');
+    }
+}
+
 static bool con_config_init() 
 {
     if(LOCALFS.exists(CONFIG_FILE)) {
         File f = LOCALFS.open(CONFIG_FILE, "r", false);
 
         if(!f) {
-            ESP_LOGW(TAG, "Can't open config file");  
+            DLOG_W("Can't open config file");  
             return false;      
         }
-        
-        if(f.available()) {
-            g_con.ssid = f.readStringUntil('\n');
-            g_con.ssid.replace("\n", "");
-            g_con.ssid.trim();
 
-            ESP_LOGI(TAG, "Read SSID from config - %s", g_con.ssid.c_str());    
-        } else {
-            ESP_LOGW(TAG, "Can't read SSID from config - not available");    
-            f.close();
-            return false;      
-        }
-
-        if(f.available()) {
-            g_con.key = f.readStringUntil('\n');
-            g_con.key.replace("\n", "");
-            g_con.key.trim();
+        const char *missing = con_config_parse(f, &g_con.ssid, &g_con.key);
+        f.close();
 
-            ESP_LOGI(TAG, "Read key from config - %s", g_con.key.c_str());    
-        } else {
-            ESP_LOGW(TAG, "Can't read key from config - not available");    
-            f.close();
+        if(missing) {
+            DLOG_W("Can't read %s from config - not available", missing);    
             return false;      
         }
-        f.close();
+        DLOG_I("Read SSID from config - %s", g_con.ssid.c_str());    
 
         return (g_con.ssid.length() > 0);
     } else {
-        ESP_LOGI(TAG, "Config file not found");
+        DLOG_I("Config file not found");
         return false;
     }
 }
@@ -120,6 +120,124 @@ void con_reset()
     do_restart();
 }
 
+/*
+    live reconfiguration - there is one radio, so STA leaves the old
+    network as soon as it starts on the new one and clients that came
+    in over the old network lose the device until the trial ends (at a
+    new address, or back on the old one after a rollback). The AP stays
+    up throughout as a way in. The config file is only written once
+    there is an IP.
+*/
+
+static void con_trial_finish(unsigned int state, const char *reason)
+{
+    g_trial.state = state;
+    g_trial.reason = reason;
+    g_trial.finished_ms = millis();
+    g_trial.reconfig_ms = g_trial.finished_ms - g_trial.started_ms;
+}
+
+static void con_trial_commit()
+{
+    if(!save_config(g_trial.ssid.c_str(), g_trial.key.c_str())) {
+        DLOG_W("Connected to %s, but config not saved", g_trial.ssid.c_str());
+    }
+
+    g_con.ssid.set(g_trial.ssid.c_str());
+    g_con.key.set(g_trial.key.c_str());
+    g_con.state = CON_STATE_CLIENT;
+
+    con_trial_finish(CON_TRIAL_DONE, "");
+    set_led_state(LED_STATE_STA);
+
+    DLOG_I("Switched to %s - %s in %u ms", g_con.ssid.c_str(), WiFi.localIP().toString().c_str(), g_trial.reconfig_ms);
+}
+
+static void con_trial_rollback(const char *reason)
+{
+    DLOG_W("Can't connect to %s (%s), rolling back", g_trial.ssid.c_str(), reason);
+
+    if(g_trial.prev_state == CON_STATE_CLIENT) {
+        WiFi.begin(g_con.ssid.c_str(), g_con.key.c_str());
+        g_con.state = CON_STATE_CLIENT;
+    } else {
+        WiFi.disconnect();
+        g_con.state = CON_STATE_AP;
+    }
+    con_trial_finish(CON_TRIAL_FAILED, reason);
+}
+
+static void con_trial_gap(unsigned long current_ms)
+{
+    if(!audio_running()) {
+        if(!g_trial.gap_start_ms) {
+            g_trial.gap_start_ms = current_ms;
+        }
+    } else if(g_trial.gap_start_ms) {
+        g_trial.audio_gap_ms += current_ms - g_trial.gap_start_ms;
+        g_trial.gap_start_ms = 0;
+    }
+
+    // done once audio is back after the switch, or the window is over
+    if(g_trial.state != CON_TRIAL_CONNECTING && (!g_trial.gap_start_ms 
+        || (current_ms - g_trial.finished_ms) >= CON_TRIAL_GAP_WINDOW_MS)) {
+        if(g_trial.gap_start_ms) {
+            g_trial.audio_gap_ms += current_ms - g_trial.gap_start_ms;
+            g_trial.gap_start_ms = 0;
+        }
+        g_trial.measuring = false;
+    }
+}
+
+static void con_trial_handle()
+{
+    unsigned long current_ms = millis();
+
+    if(g_trial.measuring) {
+        con_trial_gap(current_ms);
+    }
+
+    if(g_trial.start) {
+        g_trial.start = false;
+        g_trial.started_ms = current_ms;
+
+        // STA drops the old network here, the AP keeps a way in
+        if(!(WiFi.getMode() & WIFI_MODE_AP)) {
+            WiFi.mode(WIFI_AP_STA);
+            WiFi.softAP(g_con.host_id.c_str(), DEVICE_WIFI_KEY);
+        } else {
+            WiFi.mode(WIFI_AP_STA);
+        }
+        WiFi.setHostname(g_con.host_id.c_str());
+        WiFi.begin(g_trial.ssid.c_str(), g_trial.key.c_str());
+        return;
+    }
+
+    if(g_trial.state == CON_TRIAL_CONNECTING) {
+        wl_status_t st = WiFi.status();
+
+        if((current_ms - g_trial.started_ms) < CON_TRIAL_SETTLE_MS) {
+            return;
+        }
+
+        if(st == WL_CONNECTED && g_trial.ssid == WiFi.SSID().c_str() 
+            && (uint32_t) WiFi.localIP() != 0) {
+            con_trial_commit();
+        } else if(st == WL_NO_SSID_AVAIL) {
+            con_trial_rollback("no_ssid");
+        } else if(st == WL_CONNECT_FAILED) {
+            con_trial_rollback("connect_failed");
+        } else if((current_ms - g_trial.started_ms) >= CON_TRIAL_TIMEOUT_MS) {
+            con_trial_rollback("timeout");
+        }
+    } else if(g_trial.state != CON_TRIAL_IDLE && g_con.state == CON_STATE_CLIENT
+        && (WiFi.getMode() & WIFI_MODE_AP) && (current_ms - g_trial.finished_ms) >= CON_TRIAL_AP_LINGER_MS) {
+        DLOG_I("Closing AP after reconfiguration");
+        WiFi.softAPdisconnect(true);
+        WiFi.mode(WIFI_STA);
+    }
+}
+
 /*
     main
 */
@@ -128,16 +246,18 @@ void con_init()
 {
     set_led_state(LED_STATE_INIT);
 
-    String mac_addr = String(WiFi.macAddress());
-    mac_addr.replace(":", "");
-    g_con.host_id = DEVICE_PREFIX + mac_addr;
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    g_con.host_id.set(DEVICE_PREFIX);
+    g_con.host_id.printf("%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    g_con.mdns_name.set(g_con.host_id.c_str()).append(".local");
 
     #ifdef CONFIG_RESET_PIN
         pinMode(CONFIG_RESET_PIN, INPUT);
     #endif
 
     if(!LOCALFS.begin(FORMAT_FS_IF_FAILED)) {
-        ESP_LOGE(TAG, "Can't access to FS");
+        DLOG_E("Can't access to FS");
     }
 
     if(con_config_init()) {
@@ -159,9 +279,13 @@ void con_reconnect_handle()
 {
     static unsigned long prev_ms = 0;
     unsigned long current_ms = millis();
+
+    if(g_trial.state == CON_TRIAL_CONNECTING) {
+        return;
+    }
   
     if((current_ms - prev_ms) >= WIFI_RECONNECT_INTERVAL_MS ) {
-        ESP_LOGW(TAG, "Reconnecting to WiFi");
+        DLOG_W("Reconnecting to WiFi");
     
         set_led_state(LED_STATE_NONE);    
         WiFi.disconnect();   
@@ -174,6 +298,8 @@ void con_reconnect_handle()
 
 void con_handle()
 {
+    con_trial_handle();
+
     #ifdef CONFIG_RESET_PIN
         if(digitalRead(CONFIG_RESET_PIN) == HIGH) {
             con_reset();
@@ -185,60 +311,141 @@ void con_handle()
     web
 */
 
-String get_mdns_name() 
+const char *get_mdns_name() 
 {
-    return g_con.host_id + ".local";
+    return g_con.mdns_name.c_str();
 }
 
-String get_availible_nets_json()
+void print_json_string(Print &out, const char *s)
+{
+    out.write('"');
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\') {
+            out.write('\\');
+        }
+        if((unsigned char) *s >= 0x20) {
+            out.write(*s);
+        }
+    }
+    out.write('"');
+}
+
+void print_ap_json(Print &out, const wifi_ap_record_t *ap)
+{
+    out.printf("{\"rssi\":%d, \"ssid\":", ap->rssi);
+    print_json_string(out, (const char *) ap->ssid);
+    out.printf(", \"bssid\":\"%02X:%02X:%02X:%02X:%02X:%02X\"",
+        ap->bssid[0], ap->bssid[1], ap->bssid[2], ap->bssid[3], ap->bssid[4], ap->bssid[5]);
+    out.printf(", \"channel\":%d, \"secure\":%d}", ap->primary, ap->authmode);
+}
+
+void print_availible_nets_json(Print &out)
 {
-    String json = "";
     int n = WiFi.scanComplete();
 
     if(n == -2) {
         WiFi.scanNetworks(true);
-        json = "{ \"result\": \"await\", \"explain\": \"start_scan\" }";
+        out.print("{ \"result\": \"await\", \"explain\": \"start_scan\" }");
     } else if(n == -1) {
-        json = "{ \"result\": \"await\", \"explain\": \"still_scan\" }";
+        out.print("{ \"result\": \"await\", \"explain\": \"still_scan\" }");
     } else if(n) {
-        json = "{ \"result\": \"ok\", \"list\": [";   
+        bool first = true;
+
+        out.print("{ \"result\": \"ok\", \"list\": [");
         for(unsigned int i = 0; i < n; ++i) {
-            if(i) json += ", ";
-      
-            json += "{";
-            json += "\"rssi\":" + String(WiFi.RSSI(i));
-            json += ", \"ssid\":\"" + WiFi.SSID(i) + "\"";
-            json += ", \"bssid\":\"" + WiFi.BSSIDstr(i) + "\"";
-            json += ", \"channel\":" + String(WiFi.channel(i));
-            json += ", \"secure\":" + String(WiFi.encryptionType(i));
-            json += "}";
+            wifi_ap_record_t *ap = (wifi_ap_record_t *) WiFi.getScanInfoByIndex(i);
+            if(!ap) {
+                continue;
+            }
+            if(!first) out.print(", ");
+            first = false;
+
+            print_ap_json(out, ap);
         }
         WiFi.scanDelete();
-        json += "], ";
+        out.print("], ");
 
         if(WiFi.scanComplete() == -1) {
-            json += "\"scan_state\": \"working\"";   
+            out.print("\"scan_state\": \"working\"");
         } else {
-            json += "\"scan_state\": \"done\"";   
+            out.print("\"scan_state\": \"done\"");
         }
-        json += "}";
+        out.print("}");
     }
+}
+
+const char *con_config_parse(Stream &in, fstr<WIFI_SSID_SIZE> *ssid, fstr<WIFI_KEY_SIZE> *key)
+{
+    if(!in.available()) {
+        return "SSID";
+    }
+    con_read_line(in, ssid->data(), WIFI_SSID_SIZE);
+    ssid->sync();
+    ssid->trim();
+
+    if(!in.available()) {
+        return "key";
+    }
+    con_read_line(in, key->data(), WIFI_KEY_SIZE);
+    key->sync();
+    key->trim();
+
+    return NULL;
+}
 
-    return json;
+void con_config_write(Print &out, const char *ssid, const char *key)
+{
+    out.println(ssid);
+    out.println(key);
 }
 
-bool save_config(String ssid, String key)
+bool save_config(const char *ssid, const char *key)
 {
     File f = LOCALFS.open(CONFIG_FILE, "w", true);
 
     if(!f) {
-        ESP_LOGW(TAG, "Can't write to config - file not open");    
+        DLOG_W("Can't write to config - file not open");    
         return false;
     }
     
-    f.println(ssid);
-    f.println(key);
+    con_config_write(f, ssid, key);
     f.close();
 
     return true;
 }
+
+bool con_try_config(const char *ssid, const char *key)
+{
+    if(g_trial.state == CON_TRIAL_CONNECTING) {
+        return false;
+    }
+
+    g_trial.ssid.set(ssid);
+    g_trial.key.set(key);
+    g_trial.prev_state = g_con.state;
+    g_trial.reason = "";
+    g_trial.started_ms = millis();
+    g_trial.reconfig_ms = 0;
+    g_trial.measuring = true;
+    g_trial.gap_start_ms = 0;
+    g_trial.audio_gap_ms = 0;
+    g_trial.start = true;
+    g_trial.state = CON_TRIAL_CONNECTING;
+
+    DLOG_I("Trying WiFi %s", ssid);
+    return true;
+}
+
+void print_con_status_json(Print &out)
+{
+    unsigned long elapsed_ms = (g_trial.state == CON_TRIAL_CONNECTING) 
+        ? millis() - g_trial.started_ms
+        : g_trial.reconfig_ms;
+
+    out.printf("{ \"result\": \"ok\", \"state\": \"%s\", \"ssid\": ", con_trial_names[g_trial.state]);
+    print_json_string(out, g_trial.ssid.c_str());
+    out.printf(", \"reason\": \"%s\", \"elapsed_ms\": %lu, \"audio_gap_ms\": %u, \"measuring\": %s",
+        g_trial.reason, elapsed_ms, g_trial.audio_gap_ms, g_trial.measuring ? "true" : "false");
+    out.printf(", \"connected\": %s, \"ip\": \"%s\" }",
+        con_state() == CON_STATE_CLIENT ? "true" : "false", WiFi.localIP().toString().c_str());
+}
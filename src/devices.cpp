@@ -1,21 +1,38 @@
 #include <Arduino.h>
 
-#include <VS1053.h>
-#include <ESP32_VS1053_Stream.h>
-
-#include "si47xx.h"
+#include "txm.h"
 
 #include "config.h"
+#include "dlog.h"
+#include "mem.h"
 #include "con.h"
 #include "devices.h"
+#include "audio.h"
+#include "sched.h"
+#include "agc.h"
+#include "http.h"
+#include "tls.h"
+#include "power.h"
+#include "bench.h"
+#include "plugin.h"
 
 
 CRGB led[1];
-ESP32_VS1053_Stream stream;
-Si47xx mpx;
 
-String stream_url = "http://nashe1.hostingradio.ru/nashe-256";
-String station_ps = "HAIIIE";
+// one entry per transmitter, units on a TCA9548A give their mux channel
+static const txm_config fm_transmitters[] = {
+    { &i2c0, SI47XX_I2C_ADDR, SI47XX_PIN_RESET, -1, FM_FREQ, FM_POWER },
+};
+
+fstr<STREAM_URL_SIZE> stream_url("http://nashe1.hostingradio.ru/nashe-256");
+fstr<STATION_PS_SIZE> station_ps("HAIIIE");
+
+// set from the web task, started from devices_handle()
+static fstr<STREAM_URL_SIZE> play_url;
+static volatile bool play_pending = false;
+
+static boot_step boot_steps[BOOT_STEPS];
+static unsigned int boot_count = 0;
 
 /*
     inteface
@@ -23,7 +40,101 @@ String station_ps = "HAIIIE";
 
 void devices_web_init(AsyncWebServer *server)
 {
+    server->on("/fm", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        txm_print_json(*response);
+        request->send(response);
+    });
+
+    server->on("/audio", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if(request->hasParam("play") && !play_pending) {
+            play_url.set(request->getParam("play")->value().c_str());
+            play_pending = true;
+        }
+
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        audio_print_json(*response);
+        request->send(response);
+    });
+
+    server->on("/net", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        response->print("{ \"result\": \"ok\", \"dns\": ");
+        http_print_dns_json(*response);
+        response->print(", \"tls\": ");
+        tls_print_json(*response);
+        response->print(" }");
+        request->send(response);
+    });
+
+    server->on("/boot", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        response->print("{ \"result\": \"ok\", \"steps\": [");
+        for(unsigned int i = 0; i < boot_count; i++) {
+            response->printf("%s { \"name\": \"%s\", \"ms\": %u }", i ? "," : "", boot_steps[i].name, boot_steps[i].ms);
+        }
+        response->print(" ], \"plugins\": ");
+        plugin_print_json(*response);
+        response->print(" }");
+        request->send(response);
+    });
+
+    server->on("/schedule", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        sched_print_json(*response);
+        request->send(response);
+    });
+
+    server->on("/agc", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if(request->hasParam("enable")) {
+            agc_enable(request->getParam("enable")->value() == "1");
+        }
+        if(request->hasParam("target")) {
+            agc_set_target(request->getParam("target")->value().toInt());
+        }
+
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        agc_print_json(*response);
+        request->send(response);
+    });
+
+    server->on("/power", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if(request->hasParam("enable")) {
+            power_enable(request->getParam("enable")->value() == "1");
+        }
+
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        power_print_json(*response);
+        request->send(response);
+    });
 
+#ifdef BENCH_ENABLE
+    server->on("/bench", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if(request->hasParam("run")) {
+            bench_request();
+        }
+
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        bench_print_json(*response);
+        request->send(response);
+    });
+#endif
+
+    server->on("/fm_trace", HTTP_GET, [](AsyncWebServerRequest *request) {
+        Si47xx *chip = txm_chip(request->hasParam("unit") ? request->getParam("unit")->value().toInt() : 0);
+
+        if(!chip) {
+            request->send(404, "text/plain", "No such unit");
+            return;
+        }
+        if(request->hasParam("enable")) {
+            chip->bus().trace(request->getParam("enable")->value() == "1");
+        }
+
+        AsyncResponseStream *response = request->beginResponseStream("text/plain");
+        chip->bus().print_trace(*response);
+        request->send(response);
+    });
 }
 
 /*
@@ -39,35 +150,90 @@ void devices_init_before()
 
 void devices_init_after()
 {
-    // player
-    SPI.begin();
-    stream.startDecoder(VS1053_CS, VS1053_DCS, VS1053_DREQ);
-    stream.setVolume(VS1053_VOLUME);
-    delay(1000);
-
-    // transmitter
-    if(mpx.begin()) {
-        mpx.tune_fm(FM_FREQ);
-        mpx.set_tx_power(120);
-        mpx.begin_rds();
-        mpx.set_rds_station(station_ps.c_str());
-    } else {
-        ESP_LOGE(TAG, "Can't start FM transmitter");
+    devices_boot_mark("setup");
+
+    // https, before the first stream is opened
+    tls_init();
+    devices_boot_mark("tls");
+
+    // player, marks "plugins" on its own and returns with DREQ up
+    audio_init();
+    devices_boot_mark("audio");
+
+    // transmitters, brought up from devices_handle()
+    txm_init(fm_transmitters, sizeof(fm_transmitters) / sizeof(fm_transmitters[0]), station_ps.c_str());
+    devices_boot_mark("fm");
+
+    // clock and modem sleep follow the pipeline load
+    power_init();
+
+    // loudness, the schedule moves the volume ceiling
+    agc_init(VS1053_VOLUME);
+
+    // programme
+    sched_init(stream_url.c_str(), station_ps.c_str(), VS1053_VOLUME);
+    devices_boot_mark("ready");
+}
+
+void devices_boot_mark(const char *name)
+{
+    if(boot_count < BOOT_STEPS) {
+        boot_steps[boot_count].name = name;
+        boot_steps[boot_count].ms = millis();
+        boot_count++;
     }
 }
 
 void devices_handle()
 {
-    if(!stream.isRunning()) {
+    static unsigned long prev_ms = 0;
+    unsigned long current_ms = millis();
+
+    if(play_pending) {
+        DLOG_I("Playing %s", play_url.c_str());
+        audio_play(play_url.c_str());
+        play_pending = false;
+        prev_ms = current_ms;
+    }
+
+    if(!audio_active() && (current_ms - prev_ms) >= STREAM_RETRY_MS) {
+        const char *url = sched_url();
+
         if(con_state() == CON_STATE_CLIENT) {
-            ESP_LOGI(TAG, "Starting stream %s", stream_url.c_str());
-            stream.connecttohost(stream_url.c_str());
+            DLOG_I("Starting stream %s", url);
+            audio_play(url);
         } else {
-            ESP_LOGW(TAG, "Can't start %s - not connected to AP", stream_url.c_str());
+            DLOG_W("Can't start %s - not connected to AP", url);
         }
-    } else {
-        stream.loop();
-    };
+        prev_ms = current_ms;
+    }
+
+    txm_handle();
+    audio_handle();
+    agc_handle();
+    sched_handle();
+    power_handle();
+#ifdef BENCH_ENABLE
+    bench_handle();
+#endif
+}
+
+/*
+    scheduler
+*/
+
+void set_station_ps(const char *ps)
+{
+    if(station_ps == ps) {
+        return;
+    }
+
+    station_ps.set(ps);
+
+    // pad so a shorter name overwrites the whole PS
+    fstr<STATION_PS_SIZE> padded;
+    padded.printf("%-8s", station_ps.c_str());
+    txm_set_rds_station(padded.c_str());
 }
 
 /*
@@ -81,19 +247,3 @@ void set_led_state(CRGB color)
   FastLED.show();
   delay(50);
 }
-
-/*
-    player functions
-*/
-
-void audio_showstation(const char* info) {
-    ESP_LOGW(TAG, "Station - %s", info);
-}
-
-void audio_showstreamtitle(const char* info) {
-    ESP_LOGI(TAG, "Stream Title - %s", info);
-}
-
-void audio_eof_stream(const char* info) {
-    ESP_LOGW(TAG, "EOF - %s", info);
-}
@@ -0,0 +1,245 @@
+#include <Arduino.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_ota_ops.h>
+
+#include <atomic>
+
+#include "config.h"
+#include "dlog.h"
+
+#define DLOG_MAGIC 0x474f4c44 // "DLOG"
+#define DLOG_MASK (DLOG_RING_SIZE - 1)
+
+static_assert((DLOG_RING_SIZE & DLOG_MASK) == 0, "DLOG_RING_SIZE must be a power of two");
+
+/*
+    The ring sits in .noinit so it survives a panic reboot and can be
+    dumped as a crash log. Format and tag pointers are only meaningful
+    for the same image, so the ring is tagged with the ELF hash.
+*/
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t image;
+    std::atomic<uint32_t> head;
+    dlog_entry ring[DLOG_RING_SIZE];
+} dlog_state;
+
+static __NOINIT_ATTR dlog_state g_dlog;
+
+static const char dlog_levels[] = "?EWID";
+
+static uint32_t dlog_image_id()
+{
+    const esp_app_desc_t *desc = esp_ota_get_app_description();
+    uint32_t id;
+
+    memcpy(&id, desc->app_elf_sha256, sizeof(id));
+    return id;
+}
+
+static bool dlog_is_crash(esp_reset_reason_t reason)
+{
+    return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT
+        || reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT;
+}
+
+/*
+    main
+*/
+
+void dlog_init()
+{
+    uint32_t image = dlog_image_id();
+
+    if(g_dlog.magic == DLOG_MAGIC && g_dlog.image == image) {
+        if(dlog_is_crash(esp_reset_reason())) {
+            Serial.println("--- log before crash ---");
+            dlog_print(Serial);
+            Serial.println("--- end of log ---");
+        }
+    } else {
+        memset((void *) &g_dlog, 0, sizeof(g_dlog));
+        g_dlog.image = image;
+        g_dlog.magic = DLOG_MAGIC;
+    }
+}
+
+void dlog_handle()
+{
+    if(Serial.available() && Serial.read() == DLOG_SERIAL_KEY) {
+        dlog_print(Serial);
+    }
+}
+
+/*
+    call sites
+*/
+
+bool dlog_admit(dlog_site *site)
+{
+    uint32_t now = millis();
+
+    if(now - site->window_ms >= DLOG_RATE_MS || site->window_ms == 0) {
+        site->window_ms = now ? now : 1;
+        site->count = 0;
+    }
+
+    if(site->count < DLOG_RATE_BURST) {
+        site->count++;
+        return true;
+    }
+
+    if(site->suppressed < UINT16_MAX) {
+        site->suppressed++;
+    }
+    return false;
+}
+
+dlog_entry *dlog_begin(dlog_site *site, uint8_t level, const char *tag, const char *fmt, uint32_t *seq)
+{
+    uint32_t idx = g_dlog.head.fetch_add(1, std::memory_order_relaxed);
+    dlog_entry *e = &g_dlog.ring[idx & DLOG_MASK];
+
+    e->seq = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    e->ts_ms = millis();
+    e->tag = tag;
+    e->fmt = fmt;
+    e->level = level;
+    e->str_used = 0;
+    e->suppressed = site->suppressed;
+    site->suppressed = 0;
+
+    *seq = idx + 1;
+    return e;
+}
+
+void dlog_commit(dlog_entry *e, uint32_t seq)
+{
+    std::atomic_thread_fence(std::memory_order_release);
+    e->seq = seq;
+}
+
+uint32_t dlog_arg(dlog_entry *e, const char *s)
+{
+    uint32_t offset = e->str_used;
+
+    if(!s) {
+        s = "(null)";
+    }
+
+    while(*s && e->str_used < DLOG_STR_SIZE - 1) {
+        e->str[e->str_used++] = *s++;
+    }
+    if(e->str_used < DLOG_STR_SIZE) {
+        e->str[e->str_used++] = 0;
+    }
+
+    return offset;
+}
+
+/*
+    readers
+*/
+
+size_t dlog_format(const dlog_entry *e, char *out, size_t len)
+{
+    const char *f = e->fmt;
+    unsigned int arg = 0;
+    size_t n = snprintf(out, len, "[%lu] %c %s: ", (unsigned long) e->ts_ms,
+        dlog_levels[e->level < sizeof(dlog_levels) - 1 ? e->level : 0], e->tag);
+
+    n = min(n, len - 1);
+
+    while(*f && n + 1 < len) {
+        if(*f != '%') {
+            out[n++] = *f++;
+            continue;
+        }
+
+        if(f[1] == '%') {
+            out[n++] = '%';
+            f += 2;
+            continue;
+        }
+
+        // copy flags, width and precision, drop length modifiers
+        char spec[16];
+        unsigned int s = 0;
+
+        spec[s++] = *f++;
+        while(*f && strchr("-+ #0123456789.*hlzjt", *f)) {
+            if(!strchr("hlzjt", *f) && s < sizeof(spec) - 2) {
+                spec[s++] = *f;
+            }
+            f++;
+        }
+        if(!*f) {
+            break;
+        }
+
+        char conv = *f++;
+        spec[s++] = conv;
+        spec[s] = 0;
+
+        uint32_t v = (arg < DLOG_MAX_ARGS) ? e->args[arg] : 0;
+        arg++;
+
+        int w;
+        if(conv == 's') {
+            w = snprintf(out + n, len - n, spec, (v < DLOG_STR_SIZE) ? e->str + v : "");
+        } else if(strchr("fFeEgGaA", conv)) {
+            float fv;
+            memcpy(&fv, &v, sizeof(fv));
+            w = snprintf(out + n, len - n, spec, (double) fv);
+        } else if(strchr("di", conv)) {
+            w = snprintf(out + n, len - n, spec, (int) v);
+        } else {
+            w = snprintf(out + n, len - n, spec, (unsigned int) v);
+        }
+
+        if(w > 0) {
+            n = min(n + w, len - 1);
+        }
+    }
+
+    if(e->suppressed && n + 1 < len) {
+        int w = snprintf(out + n, len - n, " (%u suppressed)", e->suppressed);
+        if(w > 0) {
+            n = min(n + w, len - 1);
+        }
+    }
+
+    out[n] = 0;
+    return n;
+}
+
+void dlog_print(Print &out)
+{
+    uint32_t head = g_dlog.head.load(std::memory_order_acquire);
+    uint32_t seq = (head > DLOG_RING_SIZE) ? head - DLOG_RING_SIZE : 0;
+    char line[DLOG_LINE_SIZE];
+
+    for(; seq != head; seq++) {
+        const dlog_entry *slot = &g_dlog.ring[seq & DLOG_MASK];
+        dlog_entry e;
+
+        if(slot->seq != seq + 1) {
+            continue;
+        }
+        memcpy(&e, (const void *) slot, sizeof(e));
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // overwritten while copying
+        if(slot->seq != seq + 1) {
+            continue;
+        }
+
+        dlog_format(&e, line, sizeof(line));
+        out.println(line);
+    }
+}
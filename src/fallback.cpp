@@ -0,0 +1,369 @@
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "mem.h"
+#include "fallback.h"
+
+#define FALLBACK_STAGES 2
+#define FALLBACK_DAY_MS (24 * 3600 * 1000UL)
+
+#define FALLBACK_CMD_OPEN 0x10
+#define FALLBACK_CMD_ABORT 0x11
+
+static const char *fallback_files[] = { FALLBACK_FILE, FALLBACK_CACHE_FILE };
+#define FALLBACK_FILES (sizeof(fallback_files) / sizeof(fallback_files[0]))
+
+static bool g_present[FALLBACK_FILES];
+
+static audio_ring g_ring;
+static File g_file;
+static bool g_playing = false;
+static unsigned int g_item = 0;
+static unsigned long g_started_ms = 0;
+
+// capture, double buffered so the sink never waits for the flash; the
+// loop fills the stages, the writer task owns the file
+static uint8_t *g_stage[FALLBACK_STAGES];
+static uint32_t g_stage_fill = 0;
+static unsigned int g_stage_cur = 0;
+static volatile bool g_stage_full[FALLBACK_STAGES];
+
+static TaskHandle_t g_writer = NULL;
+static QueueHandle_t g_cmd = NULL;       // stage index or FALLBACK_CMD_*
+static File g_tmp;                       // writer task only
+static uint32_t g_captured = 0;          // writer task only
+static volatile bool g_write_open = false;
+static volatile bool g_write_done = false;
+static volatile bool g_write_failed = false;
+static volatile bool g_write_abort = false;  // queued blocks are dropped
+
+static bool g_capturing = false;
+static unsigned long g_capture_ms = 0;  // last finished capture
+static bool g_captured_once = false;
+static unsigned long g_budget_ms = 0;
+
+static fallback_stats g_stats;
+
+static bool fallback_open(unsigned int from)
+{
+    for(unsigned int i = 0; i < FALLBACK_FILES; i++) {
+        unsigned int k = (from + i) % FALLBACK_FILES;
+
+        if(!g_present[k]) {
+            continue;
+        }
+        g_file = LOCALFS.open(fallback_files[k], "r", false);
+        if(g_file) {
+            g_item = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    writer task
+*/
+
+// the block of stage i goes to the file, the capture is closed once complete
+static void fallback_write_block(unsigned int i)
+{
+    unsigned long start_ms = millis();
+    size_t n = g_tmp.write(g_stage[i], FALLBACK_BLOCK_SIZE);
+    uint32_t took_ms = millis() - start_ms;
+
+    if(n != FALLBACK_BLOCK_SIZE) {
+        DLOG_W("Short write to %s", FALLBACK_CACHE_TMP);
+        g_write_failed = true;
+        return;
+    }
+
+    g_captured += n;
+    g_stats.written_bytes += n;
+    g_stats.budget_used += n;
+    if(took_ms > g_stats.write_max_ms) {
+        g_stats.write_max_ms = took_ms;
+    }
+
+    if(g_captured >= FALLBACK_CACHE_SIZE) {
+        g_tmp.close();
+        g_write_open = false;
+        LOCALFS.remove(FALLBACK_CACHE_FILE);
+        LOCALFS.rename(FALLBACK_CACHE_TMP, FALLBACK_CACHE_FILE);
+        DLOG_I("Recent audio cache refreshed, %u bytes", g_captured);
+        g_write_done = true;
+    }
+}
+
+static void fallback_writer(void *)
+{
+    uint8_t cmd;
+
+    for(;;) {
+        if(xQueueReceive(g_cmd, &cmd, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        if(cmd == FALLBACK_CMD_OPEN) {
+            g_captured = 0;
+            g_tmp = LOCALFS.open(FALLBACK_CACHE_TMP, "w", true);
+            g_write_open = (bool) g_tmp;
+            if(!g_write_open) {
+                DLOG_W("Can't open %s", FALLBACK_CACHE_TMP);
+                g_write_failed = true;
+            }
+        } else if(cmd == FALLBACK_CMD_ABORT) {
+            g_write_abort = false;
+            if(g_write_open) {
+                g_tmp.close();
+                g_write_open = false;
+            }
+            LOCALFS.remove(FALLBACK_CACHE_TMP);
+        } else {
+            if(g_write_open && !g_write_failed && !g_write_abort) {
+                fallback_write_block(cmd);
+                // leave the flash to everyone else for a while
+                vTaskDelay(pdMS_TO_TICKS(FALLBACK_WRITE_GAP_MS));
+            }
+            g_stage_full[cmd] = false;
+        }
+    }
+}
+
+/*
+    capture, loop side
+*/
+
+static void fallback_capture_abort()
+{
+    uint8_t cmd = FALLBACK_CMD_ABORT;
+
+    g_write_abort = true;
+    xQueueSend(g_cmd, &cmd, portMAX_DELAY);
+    g_capturing = false;
+    g_stats.aborted++;
+}
+
+// the writer is idle - nothing queued, no stage waiting, no file open
+static bool fallback_writer_idle()
+{
+    for(unsigned int i = 0; i < FALLBACK_STAGES; i++) {
+        if(g_stage_full[i]) {
+            return false;
+        }
+    }
+    return g_writer && !uxQueueMessagesWaiting(g_cmd) && !g_write_open;
+}
+
+static void fallback_capture_start()
+{
+    uint8_t cmd = FALLBACK_CMD_OPEN;
+
+    g_stage_fill = 0;
+    g_stage_cur = 0;
+    g_write_done = g_write_failed = false;
+    xQueueSend(g_cmd, &cmd, portMAX_DELAY);
+    g_capturing = true;
+    DLOG_I("Capturing recent audio to flash");
+}
+
+static void fallback_capture_check()
+{
+    if(g_write_failed) {
+        g_write_failed = false;
+        fallback_capture_abort();
+    } else if(g_write_done) {
+        g_write_done = false;
+        g_capturing = false;
+        g_captured_once = true;
+        g_capture_ms = millis();
+        g_present[1] = true;
+        g_stats.refreshes++;
+    }
+}
+
+/*
+    audio
+*/
+
+void fallback_init()
+{
+    ring_init(&g_ring, (uint8_t *) mem_bulk_alloc(FALLBACK_RING_SIZE), FALLBACK_RING_SIZE);
+    for(unsigned int i = 0; i < FALLBACK_STAGES; i++) {
+        g_stage[i] = (uint8_t *) mem_bulk_alloc(FALLBACK_BLOCK_SIZE);
+        g_stage_full[i] = false;
+    }
+
+    g_cmd = xQueueCreate(FALLBACK_STAGES + 2, sizeof(uint8_t));
+    if(!g_cmd || xTaskCreatePinnedToCore(fallback_writer, "fallback", FALLBACK_TASK_STACK, NULL,
+        FALLBACK_TASK_PRIO, &g_writer, FALLBACK_TASK_CORE) != pdPASS) {
+        DLOG_E("No fallback writer task, recent audio is not cached");
+        g_writer = NULL;
+    }
+
+    for(unsigned int i = 0; i < FALLBACK_FILES; i++) {
+        g_present[i] = LOCALFS.exists(fallback_files[i]);
+    }
+    // a capture cut short by a reset
+    LOCALFS.remove(FALLBACK_CACHE_TMP);
+
+    g_budget_ms = millis();
+    DLOG_I("Fallback audio - id %s, cache %s", g_present[0] ? "yes" : "no", g_present[1] ? "yes" : "no");
+}
+
+void fallback_handle(unsigned long live_steady_ms)
+{
+    unsigned long current_ms = millis();
+
+    if((current_ms - g_budget_ms) >= FALLBACK_DAY_MS) {
+        g_budget_ms = current_ms;
+        g_stats.budget_used = 0;
+    }
+
+    // playback, the ring is kept full from flash
+    if(g_playing) {
+        uint8_t *p;
+        uint32_t span = ring_write_span(&g_ring, &p);
+
+        if(span) {
+            uint32_t start_us = micros();
+            int n = g_file.read(p, min(span, (uint32_t) FALLBACK_READ_CHUNK));
+
+            if(n > 0) {
+                ring_commit(&g_ring, n);
+                g_stats.read_bytes += n;
+                g_stats.read_us += micros() - start_us;
+            } else {
+                // next item of the loop
+                g_file.close();
+                if(!fallback_open(g_item + 1)) {
+                    DLOG_W("Fallback audio gone");
+                    g_playing = false;
+                }
+            }
+        }
+        return;
+    }
+
+    // capture
+    if(g_capturing) {
+        fallback_capture_check();
+    }
+    if(g_capturing) {
+        if(!live_steady_ms) {
+            // a gap in the live audio would end up in the cache
+            fallback_capture_abort();
+        }
+    } else if(live_steady_ms >= FALLBACK_STEADY_MS && g_stage[FALLBACK_STAGES - 1] && fallback_writer_idle()
+        && (!g_captured_once || (current_ms - g_capture_ms) >= FALLBACK_REFRESH_MS)
+        && g_stats.budget_used + FALLBACK_CACHE_SIZE <= FALLBACK_DAILY_BUDGET) {
+        fallback_capture_start();
+    }
+}
+
+bool fallback_available()
+{
+    return g_ring.size && (g_present[0] || g_present[1]);
+}
+
+void fallback_start()
+{
+    if(g_playing || !fallback_available()) {
+        return;
+    }
+    if(g_capturing) {
+        fallback_capture_abort();
+    }
+
+    ring_reset(&g_ring);
+    if(!fallback_open(0)) {
+        DLOG_W("Can't open fallback audio");
+        return;
+    }
+
+    g_playing = true;
+    g_started_ms = millis();
+    g_stats.starts++;
+    DLOG_W("Playing fallback audio");
+}
+
+void fallback_stop()
+{
+    if(!g_playing) {
+        return;
+    }
+
+    g_file.close();
+    g_playing = false;
+    g_stats.fed_ms += millis() - g_started_ms;
+    DLOG_I("Fallback audio stopped after %u ms", millis() - g_started_ms);
+}
+
+bool fallback_playing()
+{
+    return g_playing;
+}
+
+audio_ring *fallback_ring()
+{
+    return &g_ring;
+}
+
+void fallback_fed(uint32_t bytes)
+{
+    g_stats.fed_bytes += bytes;
+}
+
+void fallback_capture(const uint8_t *data, uint32_t len, bool mp3)
+{
+    if(g_capturing && !mp3) {
+        // only MP3 is played back from flash, and a cut to another codec would be in the middle
+        fallback_capture_abort();
+        return;
+    }
+
+    while(g_capturing && len) {
+        if(g_stage_full[g_stage_cur]) {
+            // flash fell behind, don't leave a hole in the cache
+            fallback_capture_abort();
+            return;
+        }
+
+        uint32_t n = min(len, (uint32_t) (FALLBACK_BLOCK_SIZE - g_stage_fill));
+        memcpy(g_stage[g_stage_cur] + g_stage_fill, data, n);
+        g_stage_fill += n;
+        data += n;
+        len -= n;
+
+        if(g_stage_fill == FALLBACK_BLOCK_SIZE) {
+            uint8_t cmd = g_stage_cur;
+
+            g_stage_full[g_stage_cur] = true;
+            xQueueSend(g_cmd, &cmd, portMAX_DELAY);
+            g_stage_cur = (g_stage_cur + 1) % FALLBACK_STAGES;
+            g_stage_fill = 0;
+        }
+    }
+}
+
+/*
+    web
+*/
+
+void fallback_print_json(Print &out)
+{
+    uint32_t fed_ms = g_stats.fed_ms + (g_playing ? millis() - g_started_ms : 0);
+
+    out.printf("{ \"playing\": %s, \"id\": %s, \"cache\": %s, \"starts\": %u",
+        g_playing ? "true" : "false", g_present[0] ? "true" : "false", g_present[1] ? "true" : "false", g_stats.starts);
+    // bytes per ms, i.e. kB/s
+    out.printf(", \"read_kb_s\": %u, \"sink_kb_s\": %u",
+        g_stats.read_us ? (unsigned int) ((uint64_t) g_stats.read_bytes * 1000 / g_stats.read_us) : 0,
+        fed_ms ? g_stats.fed_bytes / fed_ms : 0);
+    out.printf(", \"capturing\": %s, \"refreshes\": %u, \"aborted\": %u, \"written\": %u, \"write_max_ms\": %u, \"budget_used\": %u }",
+        g_capturing ? "true" : "false", g_stats.refreshes, g_stats.aborted, g_stats.written_bytes,
+        g_stats.write_max_ms, g_stats.budget_used);
+}
@@ -0,0 +1,496 @@
+#include <Arduino.h>
+
+#include "frame.h"
+
+#define FRAME_MORE -1 // header not complete yet
+#define FRAME_BAD 0
+
+#define FRAME_OGG_HEADER 27
+#define FRAME_ADTS_HEADER 7
+
+typedef struct
+{
+    uint8_t codec;
+    uint32_t sig;
+    uint32_t samples;
+    uint32_t sample_rate;
+    int64_t granule;
+} frame_info;
+
+static const char *frame_codec_names[] = { "unknown", "mp3", "aac", "ogg", "raw" };
+
+// what frame_header() reads, parameters after ';' are ignored
+static const char *frame_types[] = {
+    "audio/mpeg", "audio/mp3", "audio/mpeg3", "audio/x-mpeg", "audio/aac", "audio/aacp", "audio/x-aac",
+    "audio/ogg", "application/ogg", "audio/vorbis", "audio/opus",
+};
+
+// kbit/s, [V1 L1, V1 L2, V1 L3, V2 L1, V2 L2/L3][index]
+static const uint16_t mp3_bitrates[5][15] = {
+    { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+    { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+    { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+};
+
+// [V2.5, -, V2, V1][index]
+static const uint32_t mp3_sample_rates[4][3] = {
+    { 11025, 12000, 8000 },
+    { 0, 0, 0 },
+    { 22050, 24000, 16000 },
+    { 44100, 48000, 32000 },
+};
+
+static const uint32_t adts_sample_rates[13] = {
+    96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+};
+
+static inline uint8_t frame_at(const audio_ring *r, uint32_t pos)
+{
+    return r->buf[pos & (r->size - 1)];
+}
+
+static inline uint32_t frame_be32(const audio_ring *r, uint32_t pos)
+{
+    return ((uint32_t) frame_at(r, pos) << 24) | ((uint32_t) frame_at(r, pos + 1) << 16)
+        | ((uint32_t) frame_at(r, pos + 2) << 8) | frame_at(r, pos + 3);
+}
+
+static inline uint32_t frame_le32(const audio_ring *r, uint32_t pos)
+{
+    return frame_at(r, pos) | ((uint32_t) frame_at(r, pos + 1) << 8)
+        | ((uint32_t) frame_at(r, pos + 2) << 16) | ((uint32_t) frame_at(r, pos + 3) << 24);
+}
+
+/*
+    headers - the frame length, FRAME_BAD or FRAME_MORE
+*/
+
+static int frame_mp3(uint32_t h, frame_info *fi)
+{
+    unsigned int version = (h >> 19) & 3;
+    unsigned int layer = (h >> 17) & 3;
+    unsigned int br_index = (h >> 12) & 15;
+    unsigned int sr_index = (h >> 10) & 3;
+    unsigned int pad = (h >> 9) & 1;
+
+    if(version == 1 || layer == 0 || br_index == 0 || br_index == 15 || sr_index == 3 || (h & 3) == 2) {
+        return FRAME_BAD;
+    }
+
+    bool v1 = (version == 3);
+    unsigned int table = v1 ? 3 - layer : (layer == 3 ? 3 : 4);
+    uint32_t bitrate = mp3_bitrates[table][br_index] * 1000;
+    uint32_t sample_rate = mp3_sample_rates[version][sr_index];
+    int len;
+
+    if(layer == 3) {
+        len = (12 * bitrate / sample_rate + pad) * 4;
+        fi->samples = 384;
+    } else if(layer == 2 || v1) {
+        len = 144 * bitrate / sample_rate + pad;
+        fi->samples = 1152;
+    } else {
+        len = 72 * bitrate / sample_rate + pad;
+        fi->samples = 576;
+    }
+
+    fi->codec = FRAME_CODEC_MP3;
+    fi->sig = h & 0xFFFE0C00;
+    fi->sample_rate = sample_rate;
+    return len;
+}
+
+static int frame_adts(const audio_ring *r, uint32_t pos, uint32_t avail, uint32_t h, frame_info *fi)
+{
+    if(avail < FRAME_ADTS_HEADER) {
+        return FRAME_MORE;
+    }
+
+    unsigned int sr_index = (h >> 10) & 15;
+    int len = ((h & 3) << 11) | (frame_at(r, pos + 4) << 3) | (frame_at(r, pos + 5) >> 5);
+    int min_len = (h & 0x10000) ? FRAME_ADTS_HEADER : FRAME_ADTS_HEADER + 2;
+
+    if(sr_index >= 13 || len < min_len) {
+        return FRAME_BAD;
+    }
+
+    fi->codec = FRAME_CODEC_AAC;
+    fi->sig = h & 0xFFFEFDC0;
+    fi->samples = 1024 * ((frame_at(r, pos + 6) & 3) + 1);
+    fi->sample_rate = adts_sample_rates[sr_index];
+    return len;
+}
+
+static int frame_ogg(const audio_ring *r, uint32_t pos, uint32_t avail, frame_info *fi)
+{
+    if(avail < FRAME_OGG_HEADER) {
+        return FRAME_MORE;
+    }
+    if(frame_at(r, pos + 4) != 0 || frame_at(r, pos + 5) > 7) {
+        return FRAME_BAD;
+    }
+
+    unsigned int segs = frame_at(r, pos + 26);
+    if(avail < FRAME_OGG_HEADER + segs) {
+        return FRAME_MORE;
+    }
+
+    int len = FRAME_OGG_HEADER + segs;
+    for(unsigned int i = 0; i < segs; i++) {
+        len += frame_at(r, pos + FRAME_OGG_HEADER + i);
+    }
+
+    // chained streams change the serial, the page layout stays
+    fi->codec = FRAME_CODEC_OGG;
+    fi->sig = 0;
+    fi->samples = 0;
+    fi->sample_rate = 0;
+    fi->granule = (int64_t) (((uint64_t) frame_le32(r, pos + 10) << 32) | frame_le32(r, pos + 6));
+    return len;
+}
+
+static int frame_header(const audio_ring *r, uint32_t pos, frame_info *fi)
+{
+    int32_t avail = r->head - pos; // negative - the lookahead ran past the head
+
+    if(avail < 4) {
+        return FRAME_MORE;
+    }
+
+    uint32_t h = frame_be32(r, pos);
+    int len;
+
+    if(h == 0x4F676753) { // OggS
+        len = frame_ogg(r, pos, (uint32_t) avail, fi);
+    } else if((h & 0xFFF60000) == 0xFFF00000) { // 12 bit sync, layer 00
+        len = frame_adts(r, pos, (uint32_t) avail, h, fi);
+    } else if((h & 0xFFE00000) == 0xFFE00000) {
+        len = frame_mp3(h, fi);
+    } else {
+        return FRAME_BAD;
+    }
+
+    // a frame and the lookahead for sync must fit the ring with room to spare
+    return (len > (int) (r->size / 4)) ? FRAME_BAD : len;
+}
+
+// FRAME_SYNC_FRAMES consistent headers in a row at f->scan
+static int frame_hunt(frame_parser *f, const audio_ring *r)
+{
+    uint32_t pos = f->scan;
+    frame_info first;
+
+    for(unsigned int i = 0; i < FRAME_SYNC_FRAMES; i++) {
+        frame_info fi;
+        int len = frame_header(r, pos, &fi);
+
+        if(len <= 0) {
+            return len;
+        }
+        if(!i) {
+            first = fi;
+        } else if(fi.codec != first.codec || fi.sig != first.sig) {
+            return FRAME_BAD;
+        }
+        pos += len;
+    }
+
+    if(first.codec != f->codec) {
+        f->stats.sample_rate = 0;
+    }
+    f->codec = first.codec;
+    f->sig = first.sig;
+    return 1;
+}
+
+/*
+    accounting
+*/
+
+static bool frame_add_run(frame_parser *f, uint32_t len)
+{
+    if(f->run_count) {
+        frame_run *last = &f->runs[(f->run_first + f->run_count - 1) % FRAME_RUNS];
+        if(last->start + last->len == f->scan) {
+            last->len += len;
+            return true;
+        }
+    }
+    if(f->run_count == FRAME_RUNS) {
+        return false;
+    }
+
+    frame_run *run = &f->runs[(f->run_first + f->run_count) % FRAME_RUNS];
+    run->start = f->scan;
+    run->len = len;
+    f->run_count++;
+    return true;
+}
+
+static void frame_ogg_rate(frame_parser *f, const audio_ring *r, frame_info *fi)
+{
+    // the first page of a logical stream carries the codec's id header
+    if(frame_at(r, f->scan + 5) & 2) {
+        uint32_t p = f->scan + FRAME_OGG_HEADER + frame_at(r, f->scan + 26);
+
+        if(frame_be32(r, p) == 0x01766F72 && frame_be32(r, p + 3) == 0x72626973) { // \x01vorbis
+            fi->sample_rate = frame_le32(r, p + 12);
+        } else if(frame_be32(r, p) == 0x4F707573 && frame_be32(r, p + 4) == 0x48656164) { // OpusHead
+            fi->sample_rate = 48000;
+        }
+        f->granule = -1;
+    }
+
+    if(fi->granule >= 0) {
+        // a jump past the window is a seek or a new stream, not audio
+        if(f->granule >= 0 && fi->granule > f->granule
+            && fi->granule - f->granule <= (int64_t) f->stats.sample_rate * FRAME_RATE_WINDOW_S) {
+            fi->samples = fi->granule - f->granule;
+        }
+        f->granule = fi->granule;
+    }
+}
+
+static void frame_rate(frame_parser *f, const audio_ring *r, frame_info *fi, uint32_t len)
+{
+    if(fi->codec == FRAME_CODEC_OGG) {
+        frame_ogg_rate(f, r, fi);
+    }
+    if(fi->sample_rate) {
+        f->stats.sample_rate = fi->sample_rate;
+    }
+    if(!f->stats.sample_rate) {
+        return;
+    }
+
+    f->rate_bytes += len;
+    f->rate_samples += fi->samples;
+    if(f->rate_samples >= (uint64_t) f->stats.sample_rate * FRAME_RATE_WINDOW_S) {
+        f->stats.bitrate = (uint64_t) f->rate_bytes * 8 * f->stats.sample_rate / f->rate_samples;
+        f->rate_bytes = 0;
+        f->rate_samples = 0;
+    }
+}
+
+/*
+    ICY metadata is removed in place from the span just read, so the
+    ring only ever holds audio.
+*/
+
+size_t frame_icy_strip(frame_parser *f, uint8_t *data, size_t len)
+{
+    size_t r = 0;
+    size_t w = 0;
+
+    if(f->icy_interval <= 0) {
+        return len;
+    }
+
+    while(r < len) {
+        if(f->icy_audio_left > 0) {
+            size_t n = min(len - r, (size_t) f->icy_audio_left);
+            if(w != r) {
+                memmove(data + w, data + r, n);
+            }
+            w += n;
+            r += n;
+            f->icy_audio_left -= n;
+        } else if(f->icy_meta_left < 0) {
+            f->icy_meta_left = data[r++] * 16;
+            f->meta.clear();
+            if(f->icy_meta_left == 0) {
+                f->icy_audio_left = f->icy_interval;
+                f->icy_meta_left = -1;
+            }
+        } else {
+            size_t n = min(len - r, (size_t) f->icy_meta_left);
+            for(size_t i = 0; i < n; i++) {
+                if(data[r + i]) {
+                    f->meta.append((char) data[r + i]);
+                }
+            }
+            r += n;
+            f->icy_meta_left -= n;
+            if(f->icy_meta_left == 0) {
+                f->meta_ready = true;
+                f->icy_audio_left = f->icy_interval;
+                f->icy_meta_left = -1;
+            }
+        }
+    }
+
+    return w;
+}
+
+/*
+    source side
+*/
+
+void frame_reset(frame_parser *f, uint32_t pos, int icy_interval)
+{
+    *f = frame_parser();
+
+    f->icy_interval = icy_interval;
+    f->icy_audio_left = icy_interval;
+    f->icy_meta_left = -1;
+    f->scan = pos;
+    f->feed_end = pos;
+    f->granule = -1;
+}
+
+void frame_passthrough(frame_parser *f)
+{
+    f->passthrough = true;
+    f->codec = FRAME_CODEC_RAW;
+    f->locked = false;
+}
+
+bool frame_parses(const char *content_type)
+{
+    size_t len = strcspn(content_type, "; \t");
+
+    for(unsigned int i = 0; i < sizeof(frame_types) / sizeof(frame_types[0]); i++) {
+        if(len == strlen(frame_types[i]) && !strncasecmp(content_type, frame_types[i], len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool frame_lost(const frame_parser *f)
+{
+    return !f->passthrough && !f->stats.syncs && f->stats.dropped >= FRAME_HUNT_LIMIT;
+}
+
+void frame_scan(frame_parser *f, audio_ring *r)
+{
+    if(f->passthrough) {
+        uint32_t n = r->head - f->scan;
+
+        if(n && frame_add_run(f, n)) {
+            f->stats.bytes += n;
+            f->scan += n;
+        }
+        return;
+    }
+
+    for(;;) {
+        if(!f->locked) {
+            int st = frame_hunt(f, r);
+
+            if(st == FRAME_MORE) {
+                break;
+            }
+            if(st == FRAME_BAD) {
+                f->scan++;
+                f->stats.dropped++;
+                continue;
+            }
+            f->locked = true;
+            f->stats.syncs++;
+            f->rate_bytes = 0;
+            f->rate_samples = 0;
+            f->granule = -1;
+        }
+
+        frame_info fi;
+        int len = frame_header(r, f->scan, &fi);
+
+        if(len == FRAME_MORE) {
+            break;
+        }
+        if(len == FRAME_BAD || fi.codec != f->codec || fi.sig != f->sig) {
+            f->locked = false;
+            f->stats.losses++;
+            continue;
+        }
+        if((uint32_t) len > r->head - f->scan || !frame_add_run(f, len)) {
+            break;
+        }
+
+        frame_rate(f, r, &fi, len);
+        f->stats.frames++;
+        f->stats.bytes += len;
+        f->scan += len;
+    }
+
+    if(!f->run_count && f->scan != r->tail) {
+        ring_consume(r, f->scan - r->tail);
+    }
+}
+
+/*
+    sink side
+*/
+
+uint32_t frame_span(frame_parser *f, audio_ring *r, uint8_t **p)
+{
+    while(f->run_count) {
+        frame_run *run = &f->runs[f->run_first];
+        uint32_t end = run->start + run->len;
+
+        if((int32_t) (r->tail - end) >= 0) {
+            f->run_first = (f->run_first + 1) % FRAME_RUNS;
+            f->run_count--;
+            continue;
+        }
+        if((int32_t) (run->start - r->tail) > 0) {
+            ring_consume(r, run->start - r->tail);
+        }
+        if(f->passthrough) {
+            return ring_read_span_at(r, r->tail, end, p);
+        }
+
+        // at a frame start, its header is still in the ring
+        if((int32_t) (f->feed_end - r->tail) <= 0) {
+            frame_info fi;
+            int len = frame_header(r, r->tail, &fi);
+
+            f->feed_end = (len > 0 && (int32_t) (end - r->tail - len) >= 0) ? r->tail + len : end;
+        }
+        return ring_read_span_at(r, r->tail, f->feed_end, p);
+    }
+
+    if(f->scan != r->tail) {
+        ring_consume(r, f->scan - r->tail);
+    }
+    return 0;
+}
+
+uint32_t frame_available(const frame_parser *f, const audio_ring *r)
+{
+    uint32_t n = 0;
+
+    for(unsigned int i = 0; i < f->run_count; i++) {
+        const frame_run *run = &f->runs[(f->run_first + i) % FRAME_RUNS];
+        uint32_t end = run->start + run->len;
+        uint32_t start = ((int32_t) (r->tail - run->start) > 0) ? r->tail : run->start;
+
+        if((int32_t) (end - start) > 0) {
+            n += end - start;
+        }
+    }
+    return n;
+}
+
+uint32_t frame_partial(const frame_parser *f, const audio_ring *r)
+{
+    int32_t left = f->feed_end - r->tail;
+
+    return (!f->passthrough && left > 0) ? left : 0;
+}
+
+/*
+    web
+*/
+
+void frame_print_json(Print &out, const frame_parser *f)
+{
+    out.printf("{ \"codec\": \"%s\", \"locked\": %s, \"frames\": %u, \"bytes\": %u, \"dropped\": %u",
+        frame_codec_names[f->codec], f->locked ? "true" : "false", f->stats.frames, f->stats.bytes,
+        f->stats.dropped);
+    out.printf(", \"syncs\": %u, \"losses\": %u, \"sample_rate\": %u, \"bitrate\": %u }",
+        f->stats.syncs, f->stats.losses, f->stats.sample_rate, f->stats.bitrate);
+}
\ No newline at end of file
@@ -0,0 +1,522 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "mem.h"
+#include "hls.h"
+
+#define HLS_SEQ_NONE 0xFFFFFFFF
+
+static bool hls_line_is(const char *line, const char *tag, const char **value)
+{
+    size_t n = strlen(tag);
+
+    if(strncmp(line, tag, n) != 0) {
+        return false;
+    }
+    *value = line + n;
+    return true;
+}
+
+// ref relative to base, as RFC 3986 for the cases playlists use
+static void hls_resolve(const char *base, const char *ref, fstr<HTTP_URL_SIZE> *out)
+{
+    if(strncmp(ref, "http://", 7) == 0 || strncmp(ref, "https://", 8) == 0) {
+        out->set(ref);
+        return;
+    }
+
+    out->clear();
+    if(ref[0] == '/') {
+        // scheme://host[:port]
+        const char *host = strstr(base, "://");
+        const char *end = host ? strchr(host + 3, '/') : NULL;
+        size_t n = end ? (size_t) (end - base) : strlen(base);
+
+        for(size_t i = 0; i < n; i++) {
+            out->append(base[i]);
+        }
+    } else {
+        const char *query = strchr(base, '?');
+        const char *slash = NULL;
+
+        for(const char *p = base; *p && p != query; p++) {
+            if(*p == '/') {
+                slash = p;
+            }
+        }
+        for(const char *p = base; slash && p <= slash; p++) {
+            out->append(*p);
+        }
+    }
+    out->append(ref);
+}
+
+/*
+    playlists
+*/
+
+static bool hls_list_open(hls_session *h, const char *url)
+{
+    h->list_len = 0;
+    h->list_started_ms = millis();
+    h->list_busy = http_open(&h->list, url);
+    return h->list_busy;
+}
+
+static bool hls_parse_master(hls_session *h)
+{
+    fstr<HTTP_URL_SIZE> best;
+    uint32_t best_bw = 0;
+    bool best_fits = false;
+    uint32_t bw = 0;
+    bool variant = false;
+    char *save;
+
+    for(char *line = strtok_r(h->list_buf, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+        const char *v;
+
+        if(hls_line_is(line, "#EXT-X-STREAM-INF:", &v)) {
+            const char *b = strstr(v, "BANDWIDTH=");
+            bw = b ? strtoul(b + 10, NULL, 10) : 0;
+            variant = true;
+        } else if(variant && line[0] != '#') {
+            bool fits = bw <= HLS_MAX_BANDWIDTH;
+
+            // the best that fits, or the smallest if none does
+            if(!best.length() || (fits && (!best_fits || bw > best_bw)) || (!fits && !best_fits && bw < best_bw)) {
+                best.set(line);
+                best_bw = bw;
+                best_fits = fits;
+            }
+            variant = false;
+        }
+    }
+
+    if(!best.length()) {
+        return false;
+    }
+
+    hls_resolve(h->list.url.c_str(), best.c_str(), &h->media_url);
+    h->stats.bandwidth = best_bw;
+    DLOG_I("HLS variant %u bps - %s", best_bw, h->media_url.c_str());
+
+    http_close(&h->list);
+    return hls_list_open(h, h->media_url.c_str());
+}
+
+static void hls_parse_media(hls_session *h)
+{
+    uint32_t seq = 0;
+    uint32_t count = 0;
+    bool segment = false;
+    char *save;
+
+    // count segments first, the live edge depends on it
+    for(uint32_t i = 0; i < h->list_len; i++) {
+        if(h->list_buf[i] == '#' && strncmp(h->list_buf + i, "#EXTINF:", 8) == 0) {
+            count++;
+        }
+    }
+
+    for(char *line = strtok_r(h->list_buf, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+        const char *v;
+
+        if(hls_line_is(line, "#EXT-X-TARGETDURATION:", &v)) {
+            h->target_s = max(1, atoi(v));
+        } else if(hls_line_is(line, "#EXT-X-MEDIA-SEQUENCE:", &v)) {
+            seq = strtoul(v, NULL, 10);
+        } else if(strcmp(line, "#EXT-X-ENDLIST") == 0) {
+            h->endlist = true;
+        } else if(hls_line_is(line, "#EXTINF:", &v)) {
+            segment = true;
+        } else if(segment && line[0] != '#') {
+            segment = false;
+
+            if(h->next_seq == HLS_SEQ_NONE) {
+                uint32_t end = seq + count;
+                // live streams start a few segments back from the end
+                h->next_seq = (h->endlist || count <= HLS_LIVE_EDGE) ? seq : end - HLS_LIVE_EDGE;
+                h->play_seq = h->next_seq;
+            }
+
+            if(seq >= h->next_seq && h->queued < HLS_SEGMENTS) {
+                if(seq > h->next_seq) {
+                    DLOG_W("HLS skipped %u segment(s)", seq - h->next_seq);
+                    h->stats.skipped += seq - h->next_seq;
+                }
+                hls_segment *s = &h->queue[h->queued++];
+                s->seq = seq;
+                hls_resolve(h->list.url.c_str(), line, &s->url);
+                h->next_seq = seq + 1;
+            }
+            seq++;
+        }
+    }
+
+    bool changed = (seq != h->last_seq);
+    h->last_seq = seq;
+
+    // reload on target duration from the start of the last load, half that if nothing new
+    h->reload_ms = h->list_started_ms + h->target_s * (changed ? 1000 : 500);
+    h->stats.reloads++;
+
+    if(!h->stats.playlist_ms) {
+        h->stats.playlist_ms = millis() - h->stats.opened_ms;
+    }
+}
+
+static void hls_list_poll(hls_session *h)
+{
+    unsigned int st = http_poll(&h->list);
+
+    for(; st == HTTP_STATE_BODY; st = h->list.state) {
+        int n = http_read(&h->list, (uint8_t *) h->list_buf + h->list_len, HLS_PLAYLIST_SIZE - 1 - h->list_len);
+
+        if(n == 0) {
+            return;
+        }
+        if(n < 0) {
+            st = h->list.state; // done - HTTP/1.0 end of body, failed - stalled
+            break;
+        }
+        h->list_len += n;
+        if(h->list_len >= HLS_PLAYLIST_SIZE - 1) {
+            DLOG_W("HLS playlist truncated at %u bytes", h->list_len);
+            break;
+        }
+    }
+
+    if(st == HTTP_STATE_FAILED) {
+        http_close(&h->list);
+        h->list_busy = false;
+        if(!h->started) {
+            h->state = HLS_STATE_FAILED;
+        } else {
+            h->reload_ms = millis() + h->target_s * 500;
+        }
+        return;
+    }
+
+    if(st != HTTP_STATE_BODY && st != HTTP_STATE_DONE) {
+        return;
+    }
+
+    h->list_buf[h->list_len] = 0;
+    h->list_busy = false;
+
+    if(strstr(h->list_buf, "#EXT-X-STREAM-INF:")) {
+        if(!hls_parse_master(h)) {
+            DLOG_W("HLS master playlist without variants");
+            h->state = HLS_STATE_FAILED;
+        }
+        return;
+    }
+
+    http_close(&h->list);
+    hls_parse_media(h);
+
+    // without a segment to start from there is nothing to reload for either
+    if(!h->started && h->play_seq == HLS_SEQ_NONE) {
+        DLOG_W("HLS media playlist without segments - %s", h->media_url.c_str());
+        h->state = HLS_STATE_FAILED;
+    }
+}
+
+/*
+    segments
+*/
+
+// http_open() only queues the connect, DNS, TCP and TLS run on the connector task
+static void hls_fetch_start(hls_session *h)
+{
+    for(unsigned int i = 0; i < HLS_FETCHES && h->queued; i++) {
+        hls_fetch *f = &h->fetch[i];
+
+        if(f->busy) {
+            continue;
+        }
+
+        f->seq = h->queue[0].seq;
+        f->kind = HLS_KIND_UNKNOWN;
+        f->started_ms = millis();
+        ring_reset(&f->stage);
+        f->busy = true;
+
+        if(!http_open(&f->http, h->queue[0].url.c_str())) {
+            f->http.state = HTTP_STATE_FAILED;
+        }
+
+        h->queued--;
+        memmove(&h->queue[0], &h->queue[1], sizeof(hls_segment) * h->queued);
+    }
+}
+
+static void hls_fetch_done(hls_session *h, hls_fetch *f, bool ok)
+{
+    if(ok) {
+        h->stats.segments++;
+        h->failed_run = 0;
+    } else {
+        DLOG_W("HLS segment %u failed", f->seq);
+        h->stats.failed++;
+        // a live list keeps handing out new ones, don't chase them for good
+        if(++h->failed_run >= HLS_FAIL_SEGMENTS) {
+            DLOG_E("HLS %u segments failed in a row", h->failed_run);
+            h->state = HLS_STATE_FAILED;
+        }
+    }
+
+    http_close(&f->http);
+    f->busy = false;
+    h->ts.carry_len = 0;
+    h->play_seq = f->seq + 1;
+}
+
+static uint8_t hls_kind(uint8_t first)
+{
+    return (first == TS_SYNC) ? HLS_KIND_TS : HLS_KIND_RAW;
+}
+
+// the segment that is next in order goes into the ring
+static void hls_fetch_head(hls_session *h, hls_fetch *f, audio_ring *ring)
+{
+    // staged bytes first
+    while(ring_used(&f->stage) && ring_free(ring) >= TS_PACKET) {
+        uint8_t *p;
+        uint32_t n = ring_read_span(&f->stage, &p);
+
+        if(f->kind == HLS_KIND_UNKNOWN) {
+            f->kind = hls_kind(p[0]);
+        }
+        n = (f->kind == HLS_KIND_TS) ? ts_copy(&h->ts, p, n, ring) : ring_push(ring, p, n);
+        ring_consume(&f->stage, n);
+        if(!n) {
+            return;
+        }
+    }
+    if(ring_used(&f->stage)) {
+        return;
+    }
+
+    // then straight from the socket, demuxed where it lands
+    if(f->http.state == HTTP_STATE_BODY) {
+        uint8_t *p;
+        uint32_t span = ring_write_span(ring, &p);
+
+        // a partial packet is finished through the carry first
+        if(h->ts.carry_len && f->kind == HLS_KIND_TS) {
+            uint8_t tmp[TS_PACKET];
+
+            if(ring_free(ring) < TS_PACKET) {
+                return;
+            }
+            int n = http_read(&f->http, tmp, TS_PACKET - h->ts.carry_len);
+
+            if(n > 0) {
+                h->stats.bytes_in += n;
+                ts_copy(&h->ts, tmp, n, ring);
+            }
+            return;
+        }
+
+        if(span >= TS_PACKET) {
+            int n = http_read(&f->http, p, min(span, (uint32_t) HLS_READ_CHUNK));
+
+            if(n > 0) {
+                h->stats.bytes_in += n;
+                if(f->kind == HLS_KIND_UNKNOWN) {
+                    f->kind = hls_kind(p[0]);
+                }
+                ring_commit(ring, (f->kind == HLS_KIND_TS) ? ts_inplace(&h->ts, p, n) : n);
+            }
+        }
+    }
+
+    if(f->http.state == HTTP_STATE_DONE) {
+        hls_fetch_done(h, f, true);
+    } else if(f->http.state == HTTP_STATE_FAILED) {
+        hls_fetch_done(h, f, false);
+    }
+}
+
+// segments further ahead fill their stage while the head plays
+static void hls_fetch_ahead(hls_session *h, hls_fetch *f)
+{
+    if(f->http.state != HTTP_STATE_BODY) {
+        return;
+    }
+
+    uint8_t *p;
+    uint32_t span = ring_write_span(&f->stage, &p);
+
+    if(span) {
+        int n = http_read(&f->http, p, min(span, (uint32_t) HLS_READ_CHUNK));
+        if(n > 0) {
+            h->stats.bytes_in += n;
+            ring_commit(&f->stage, n);
+        }
+    }
+}
+
+static void hls_account(hls_session *h)
+{
+    uint32_t now_us = micros();
+    uint32_t dt = now_us - h->tick_us;
+    unsigned int active = 0;
+
+    h->tick_us = now_us;
+    for(unsigned int i = 0; i < HLS_FETCHES; i++) {
+        if(h->fetch[i].busy) {
+            active++;
+        }
+    }
+
+    if(active >= 1) h->stats.busy_us += dt;
+    if(active >= 2) h->stats.overlap_us += dt;
+}
+
+/*
+    iface
+*/
+
+void hls_init(hls_session *h)
+{
+    uint32_t size = mem_has_psram() ? HLS_STAGE_SIZE : HLS_STAGE_SIZE_SMALL;
+
+    h->list_buf = (char *) mem_bulk_alloc(HLS_PLAYLIST_SIZE);
+    for(unsigned int i = 0; i < HLS_FETCHES; i++) {
+        ring_init(&h->fetch[i].stage, (uint8_t *) mem_bulk_alloc(size), size);
+        h->fetch[i].busy = false;
+    }
+    h->state = HLS_STATE_IDLE;
+}
+
+// .m3u8 only, a plain .m3u is usually an Icecast listen.m3u pointing at a stream
+bool hls_is_playlist(const char *url)
+{
+    const char *q = strchr(url, '?');
+    size_t n = q ? (size_t) (q - url) : strlen(url);
+
+    return n >= 5 && strncasecmp(url + n - 5, ".m3u8", 5) == 0;
+}
+
+bool hls_open(hls_session *h, const char *url)
+{
+    hls_close(h);
+
+    if(!h->list_buf) {
+        DLOG_E("No buffer for HLS playlist");
+        h->state = HLS_STATE_FAILED;
+        return false;
+    }
+
+    memset(&h->stats, 0, sizeof(h->stats));
+    h->stats.opened_ms = millis();
+    h->tick_us = micros();
+
+    h->media_url.set(url);
+    h->target_s = 10;
+    h->endlist = false;
+    h->last_seq = HLS_SEQ_NONE;
+    h->queued = 0;
+    h->next_seq = HLS_SEQ_NONE;
+    h->play_seq = HLS_SEQ_NONE;
+    h->started = false;
+    h->failed_run = 0;
+    ts_reset(&h->ts);
+
+    if(!hls_list_open(h, url)) {
+        h->state = HLS_STATE_FAILED;
+        return false;
+    }
+    h->state = HLS_STATE_LOADING;
+    return true;
+}
+
+unsigned int hls_poll(hls_session *h, audio_ring *ring)
+{
+    if(h->state != HLS_STATE_LOADING && h->state != HLS_STATE_PLAYING) {
+        return h->state;
+    }
+
+    hls_account(h);
+
+    if(h->list_busy) {
+        hls_list_poll(h);
+    } else if(!h->endlist && h->play_seq != HLS_SEQ_NONE && (long) (millis() - h->reload_ms) >= 0) {
+        hls_list_open(h, h->media_url.c_str());
+    }
+
+    hls_fetch_start(h);
+
+    // the lowest sequence in flight plays, anything before it failed or dropped out
+    hls_fetch *head = NULL;
+    for(unsigned int i = 0; i < HLS_FETCHES; i++) {
+        hls_fetch *f = &h->fetch[i];
+
+        if(!f->busy) {
+            continue;
+        }
+        http_poll(&f->http);
+        if(!head || f->seq < head->seq) {
+            head = f;
+        }
+    }
+
+    if(head) {
+        if(head->seq != h->play_seq) {
+            h->ts.carry_len = 0;
+            h->play_seq = head->seq;
+        }
+
+        uint32_t before = ring_used(ring);
+        hls_fetch_head(h, head, ring);
+        if(ring_used(ring) > before && h->state == HLS_STATE_LOADING) {
+            h->started = true;
+            h->state = HLS_STATE_PLAYING;
+            h->stats.first_byte_ms = millis() - h->stats.opened_ms;
+        }
+    }
+
+    for(unsigned int i = 0; i < HLS_FETCHES; i++) {
+        hls_fetch *f = &h->fetch[i];
+        if(f->busy && f != head) {
+            hls_fetch_ahead(h, f);
+        }
+    }
+
+    // VOD runs out
+    if(h->endlist && !h->list_busy && !h->queued) {
+        bool busy = false;
+        for(unsigned int i = 0; i < HLS_FETCHES; i++) {
+            busy |= h->fetch[i].busy;
+        }
+        if(!busy) {
+            h->state = h->started ? HLS_STATE_DONE : HLS_STATE_FAILED;
+        }
+    }
+
+    return h->state;
+}
+
+void hls_close(hls_session *h)
+{
+    http_close(&h->list);
+    h->list_busy = false;
+    for(unsigned int i = 0; i < HLS_FETCHES; i++) {
+        http_close(&h->fetch[i].http);
+        h->fetch[i].busy = false;
+    }
+    h->state = HLS_STATE_IDLE;
+}
+
+void hls_print_json(Print &out, const hls_session *h)
+{
+    out.printf("{ \"bandwidth\": %u, \"target_s\": %u, \"live\": %s, \"seq\": %u, \"queued\": %u",
+        h->stats.bandwidth, h->target_s, h->endlist ? "false" : "true", h->play_seq, h->queued);
+    out.printf(", \"playlist_ms\": %u, \"first_byte_ms\": %u, \"segments\": %u, \"failed\": %u, \"skipped\": %u, \"reloads\": %u",
+        h->stats.playlist_ms, h->stats.first_byte_ms, h->stats.segments, h->stats.failed, h->stats.skipped, h->stats.reloads);
+    out.printf(", \"bytes_in\": %u, \"overlap_pct\": %u }",
+        h->stats.bytes_in, h->stats.busy_us ? (unsigned int) (h->stats.overlap_us * 100 / h->stats.busy_us) : 0);
+}
@@ -0,0 +1,420 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "http.h"
+
+typedef struct
+{
+    fstr<HTTP_HOST_SIZE> host;
+    IPAddress ip;
+    unsigned long resolved_ms;
+    bool valid;
+} http_dns_entry;
+
+static http_dns_entry g_dns[HTTP_DNS_CACHE];
+static unsigned int g_dns_next = 0;
+static http_dns_stats g_dns_stats;
+
+static QueueHandle_t g_connect_q = NULL;
+static portMUX_TYPE g_connect_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static http_dns_entry *http_dns_find(const char *host)
+{
+    for(unsigned int i = 0; i < HTTP_DNS_CACHE; i++) {
+        http_dns_entry *e = &g_dns[i];
+
+        if(e->valid && e->host == host) {
+            if(millis() - e->resolved_ms < HTTP_DNS_TTL_MS) {
+                return e;
+            }
+            e->valid = false;
+        }
+    }
+    return NULL;
+}
+
+static bool http_resolve(const char *host, IPAddress &ip, bool *cached)
+{
+    *cached = false;
+    if(ip.fromString(host)) {
+        return true;
+    }
+
+    http_dns_entry *e = http_dns_find(host);
+    if(e) {
+        g_dns_stats.hits++;
+        ip = e->ip;
+        *cached = true;
+        return true;
+    }
+
+    g_dns_stats.misses++;
+    if(!WiFi.hostByName(host, ip)) {
+        g_dns_stats.failures++;
+        return false;
+    }
+
+    e = &g_dns[g_dns_next++ % HTTP_DNS_CACHE];
+    e->host.set(host);
+    e->ip = ip;
+    e->resolved_ms = millis();
+    e->valid = true;
+
+    return true;
+}
+
+static void http_dns_forget(const char *host)
+{
+    http_dns_entry *e = http_dns_find(host);
+
+    if(e) {
+        e->valid = false;
+    }
+}
+
+static bool http_connect(http_conn *c)
+{
+    http_url u;
+    IPAddress ip;
+    unsigned long step_ms;
+
+    if(!http_parse_url(c->url.c_str(), &u)) {
+        DLOG_W("Bad URL %s", c->url.c_str());
+        return false;
+    }
+
+    c->timing.dns_ms = c->timing.tcp_ms = c->timing.tls_ms = c->timing.first_byte_ms = -1;
+    c->timing.tls_heap = 0;
+    c->timing.tls_resumed = false;
+
+    step_ms = millis();
+    if(!http_resolve(u.host.c_str(), ip, &c->timing.dns_cached)) {
+        DLOG_W("Can't resolve %s", u.host.c_str());
+        return false;
+    }
+    c->timing.dns_ms = millis() - step_ms;
+
+    step_ms = millis();
+    c->client = &c->tcp;
+    if(!c->tcp.connect(ip, u.port, HTTP_CONNECT_TIMEOUT_MS)) {
+        DLOG_W("Can't connect to %s:%d", u.host.c_str(), u.port);
+        http_dns_forget(u.host.c_str());
+        return false;
+    }
+    c->timing.tcp_ms = millis() - step_ms;
+
+    if(u.tls) {
+        step_ms = millis();
+        c->client = &c->tls;
+        if(!c->tls.begin(&c->tcp, u.host.c_str(), u.port)) {
+            return false;
+        }
+        c->timing.tls_ms = millis() - step_ms;
+        c->timing.tls_heap = c->tls.heap_peak();
+        c->timing.tls_resumed = c->tls.resumed();
+    }
+
+    c->client->printf("GET %s HTTP/1.0\r\nHost: %s\r\nUser-Agent: " HTTP_USER_AGENT "\r\n",
+        u.path.c_str(), u.host.c_str());
+    if(c->icy) {
+        c->client->print("Icy-MetaData: 1\r\n");
+    }
+    c->client->print("Connection: close\r\n\r\n");
+
+    // state is left to the connector, the loop may be looking
+    c->status = 0;
+    c->content_length = -1;
+    c->metaint = 0;
+    c->content_type.clear();
+    c->location.clear();
+    c->name.clear();
+    c->line.clear();
+    c->opened_ms = millis();
+    c->body_bytes = 0;
+    c->idle = false;
+
+    return true;
+}
+
+static bool http_header_is(const char *line, const char *name, const char **value)
+{
+    size_t n = strlen(name);
+
+    if(strncasecmp(line, name, n) != 0 || line[n] != ':') {
+        return false;
+    }
+
+    line += n + 1;
+    while(*line == ' ' || *line == '\t') line++;
+    *value = line;
+
+    return true;
+}
+
+static void http_header(http_conn *c)
+{
+    const char *line = c->line.c_str();
+    const char *v;
+
+    if(!c->status) {
+        // "HTTP/1.1 200 OK" or Shoutcast "ICY 200 OK"
+        const char *sp = strchr(line, ' ');
+        c->status = sp ? atoi(sp + 1) : -1;
+        return;
+    }
+
+    if(http_header_is(line, "content-type", &v)) {
+        c->content_type.set(v);
+    } else if(http_header_is(line, "content-length", &v)) {
+        c->content_length = atoi(v);
+    } else if(http_header_is(line, "icy-metaint", &v)) {
+        c->metaint = atoi(v);
+    } else if(http_header_is(line, "icy-name", &v)) {
+        c->name.set(v);
+    } else if(http_header_is(line, "location", &v)) {
+        c->location.set(v);
+    }
+}
+
+/*
+    connector task
+*/
+
+static void http_connector(void *)
+{
+    http_conn *c;
+
+    for(;;) {
+        if(xQueueReceive(g_connect_q, &c, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        bool ok = !c->cancel && http_connect(c);
+
+        portENTER_CRITICAL(&g_connect_mux);
+        bool cancel = c->cancel;
+        if(!cancel) {
+            c->state = ok ? HTTP_STATE_HEADERS : HTTP_STATE_FAILED;
+            c->connecting = false;
+        }
+        portEXIT_CRITICAL(&g_connect_mux);
+
+        if(cancel) {
+            if(c->client) {
+                c->client->stop();
+            }
+            c->client = NULL;
+            c->state = HTTP_STATE_IDLE;
+            c->cancel = false;
+            portENTER_CRITICAL(&g_connect_mux);
+            c->connecting = false;
+            portEXIT_CRITICAL(&g_connect_mux);
+        }
+    }
+}
+
+// hands the connection to the connector, c->url is set
+static void http_queue(http_conn *c)
+{
+    c->state = HTTP_STATE_CONNECTING;
+    c->connecting = true;
+    if(!g_connect_q || xQueueSend(g_connect_q, &c, 0) != pdTRUE) {
+        DLOG_W("Connect queue full, %s dropped", c->url.c_str());
+        c->connecting = false;
+        c->state = HTTP_STATE_FAILED;
+    }
+}
+
+static void http_redirect(http_conn *c)
+{
+    fstr<HTTP_URL_SIZE> target;
+
+    if(c->location.c_str()[0] == '/') {
+        http_url u;
+        http_parse_url(c->url.c_str(), &u);
+        target.printf("%s://%s:%d%s", u.tls ? "https" : "http", u.host.c_str(), u.port, c->location.c_str());
+    } else {
+        target.set(c->location.c_str());
+    }
+
+    DLOG_I("Redirect %d to %s", c->status, target.c_str());
+
+    c->client->stop();
+    c->redirects++;
+    c->url.set(target.c_str());
+    http_queue(c);
+}
+
+/*
+    iface
+*/
+
+void http_init()
+{
+    g_connect_q = xQueueCreate(HTTP_CONNECT_QUEUE, sizeof(http_conn *));
+    if(!g_connect_q || xTaskCreatePinnedToCore(http_connector, "http", HTTP_CONNECT_STACK, NULL,
+        HTTP_CONNECT_PRIO, NULL, HTTP_CONNECT_CORE) != pdPASS) {
+        DLOG_E("No HTTP connector task");
+        g_connect_q = NULL;
+    }
+}
+
+static void http_start(http_conn *c, const char *url, bool icy)
+{
+    c->url.set(url);
+    c->icy = icy;
+    c->redirects = 0;
+
+    http_queue(c);
+}
+
+bool http_open(http_conn *c, const char *url, bool icy)
+{
+    http_close(c);
+
+    // a connect closed while running still owns the sockets, rare - play/stop
+    // in quick succession; it goes out once the connector has dropped that
+    if(c->connecting) {
+        c->reopen_url.set(url);
+        c->reopen_icy = icy;
+        c->reopen = true;
+        return true;
+    }
+
+    http_start(c, url, icy);
+    return c->state != HTTP_STATE_FAILED;
+}
+
+unsigned int http_poll(http_conn *c)
+{
+    if(c->reopen) {
+        if(c->connecting) {
+            return HTTP_STATE_CONNECTING;
+        }
+        c->reopen = false;
+        http_start(c, c->reopen_url.c_str(), c->reopen_icy);
+    }
+
+    if(c->connecting || c->state != HTTP_STATE_HEADERS) {
+        return c->connecting ? HTTP_STATE_CONNECTING : c->state;
+    }
+
+    while(c->client->available()) {
+        int ch = c->client->read();
+
+        if(ch < 0) {
+            break;
+        }
+        if(c->timing.first_byte_ms < 0) {
+            c->timing.first_byte_ms = millis() - c->opened_ms;
+        }
+        if(ch == '\r') {
+            continue;
+        }
+        if(ch != '\n') {
+            c->line.append((char) ch);
+            continue;
+        }
+
+        if(c->line.length()) {
+            http_header(c);
+            c->line.clear();
+            continue;
+        }
+
+        // end of headers
+        if(c->status >= 300 && c->status < 400 && c->location.length() && c->redirects < HTTP_MAX_REDIRECTS) {
+            http_redirect(c);
+        } else if(c->status == 200) {
+            c->state = HTTP_STATE_BODY;
+        } else {
+            DLOG_W("HTTP %d from %s", c->status, c->url.c_str());
+            c->state = HTTP_STATE_FAILED;
+        }
+        return c->state;
+    }
+
+    if(!c->client->connected() || millis() - c->opened_ms >= HTTP_HEADER_TIMEOUT_MS) {
+        DLOG_W("No answer from %s", c->url.c_str());
+        c->state = HTTP_STATE_FAILED;
+    }
+
+    return c->state;
+}
+
+int http_read(http_conn *c, uint8_t *buf, size_t len)
+{
+    if(c->connecting || c->state != HTTP_STATE_BODY) {
+        return -1;
+    }
+
+    int avail = c->client->available();
+    if(avail > 0) {
+        int n = c->client->read(buf, min((size_t) avail, len));
+        if(n > 0) {
+            c->body_bytes += n;
+            c->idle = false;
+        }
+        return n;
+    }
+
+    if(!c->client->connected()) {
+        c->state = HTTP_STATE_DONE;
+        return -1;
+    }
+
+    // only time spent asking counts, a caller with a full buffer isn't stalled
+    if(!c->idle) {
+        c->idle = true;
+        c->idle_ms = millis();
+    } else if(millis() - c->idle_ms >= HTTP_STALL_TIMEOUT_MS) {
+        DLOG_W("No data from %s for %u ms", c->url.c_str(), HTTP_STALL_TIMEOUT_MS);
+        c->state = HTTP_STATE_FAILED;
+        return -1;
+    }
+    return 0;
+}
+
+void http_close(http_conn *c)
+{
+    c->reopen = false;
+
+    portENTER_CRITICAL(&g_connect_mux);
+    bool connecting = c->connecting;
+    if(connecting) {
+        c->cancel = true;
+    }
+    portEXIT_CRITICAL(&g_connect_mux);
+
+    if(connecting) {
+        return;
+    }
+    if(c->client) {
+        c->client->stop();
+    }
+    c->client = NULL;
+    c->state = HTTP_STATE_IDLE;
+}
+
+void http_print_timing_json(Print &out, const http_conn *c)
+{
+    out.printf("{ \"dns_ms\": %d, \"dns_cached\": %s, \"tcp_ms\": %d, \"tls_ms\": %d, \"tls_resumed\": %s, \"tls_heap\": %u, \"first_byte_ms\": %d }",
+        c->timing.dns_ms, c->timing.dns_cached ? "true" : "false", c->timing.tcp_ms, c->timing.tls_ms,
+        c->timing.tls_resumed ? "true" : "false", c->timing.tls_heap, c->timing.first_byte_ms);
+}
+
+void http_print_dns_json(Print &out)
+{
+    unsigned int entries = 0;
+
+    for(unsigned int i = 0; i < HTTP_DNS_CACHE; i++) {
+        entries += g_dns[i].valid && millis() - g_dns[i].resolved_ms < HTTP_DNS_TTL_MS;
+    }
+
+    out.printf("{ \"entries\": %u, \"hits\": %u, \"misses\": %u, \"failures\": %u }",
+        entries, g_dns_stats.hits, g_dns_stats.misses, g_dns_stats.failures);
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include <Arduino.h>
+
+#include "http_url.h"
+
+bool http_parse_url(const char *url, http_url *u)
+{
+    const char *p;
+
+    if(strncmp(url, "http://", 7) == 0) {
+        u->tls = false;
+        u->port = 80;
+        p = url + 7;
+    } else if(strncmp(url, "https://", 8) == 0) {
+        u->tls = true;
+        u->port = 443;
+        p = url + 8;
+    } else {
+        return false;
+    }
+
+    const char *slash = strchr(p, '/');
+    const char *end = slash ? slash : p + strlen(p);
+    const char *colon = (const char *) memchr(p, ':', end - p);
+
+    u->host.clear();
+    for(const char *h = p; h < (colon ? colon : end); h++) {
+        u->host.append(*h);
+    }
+    if(colon) {
+        u->port = atoi(colon + 1);
+    }
+    u->path.set(slash ? slash : "/");
+
+    return u->host.length() > 0 && u->port > 0;
+}
\ No newline at end of file
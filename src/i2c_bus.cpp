@@ -0,0 +1,150 @@
+#include <Wire.h>
+
+#include "i2c_bus.h"
+#include "mem.h"
+
+// Wire error codes
+#define I2C_RESULT_SHORT_READ 4
+#define I2C_RESULT_TIMEOUT 5
+
+I2cBus i2c0(Wire);
+
+bool I2cBus::begin(uint32_t clock) {
+  if(!_begun) {
+    _begun = _wire.begin();
+  }
+  _wire.setClock(clock);
+  _wire.setTimeOut(I2C_BUS_TIMEOUT_MS);
+
+  return _begun;
+}
+
+bool I2cBus::_account(uint8_t op, uint8_t addr, uint8_t result, uint32_t start_us,
+  const uint8_t *tx, size_t tx_len, const uint8_t *rx, size_t rx_len) {
+  uint32_t dur_us = micros() - start_us;
+
+  stats.transactions++;
+  stats.bus_us += dur_us;
+  stats.bytes += tx_len + rx_len;
+  if(result == I2C_RESULT_TIMEOUT) {
+    stats.timeouts++;
+  } else if(result) {
+    stats.errors++;
+  }
+
+  if(_tracing && _trace) {
+    i2c_trace_entry *t = &_trace[_trace_head++ % I2C_TRACE_SIZE];
+    size_t n = 0;
+
+    t->ts_us = start_us;
+    t->dur_us = (dur_us > UINT16_MAX) ? UINT16_MAX : dur_us;
+    t->op = op;
+    t->addr = addr;
+    t->result = result;
+    t->tx_len = tx_len;
+    t->rx_len = rx_len;
+    for(size_t i = 0; i < tx_len && n < I2C_TRACE_DATA; i++) t->data[n++] = tx[i];
+    for(size_t i = 0; i < rx_len && n < I2C_TRACE_DATA; i++) t->data[n++] = rx[i];
+  }
+
+  return result == 0;
+}
+
+bool I2cBus::write(uint8_t addr, const uint8_t *tx, size_t tx_len) {
+  uint32_t start_us = micros();
+
+  _wire.beginTransmission(addr);
+  _wire.write(tx, tx_len);
+  uint8_t result = _wire.endTransmission();
+
+  return _account(I2C_OP_WRITE, addr, result, start_us, tx, tx_len, NULL, 0);
+}
+
+bool I2cBus::read(uint8_t addr, uint8_t *rx, size_t rx_len) {
+  uint32_t start_us = micros();
+  uint8_t result = 0;
+
+  size_t got = _wire.requestFrom((uint16_t) addr, rx_len, true);
+  if(got == rx_len) {
+    _wire.readBytes(rx, rx_len);
+  } else {
+    result = got ? I2C_RESULT_SHORT_READ : I2C_RESULT_TIMEOUT;
+    while(_wire.available()) _wire.read();
+  }
+
+  return _account(I2C_OP_READ, addr, result, start_us, NULL, 0, rx, got == rx_len ? rx_len : 0);
+}
+
+bool I2cBus::write_read(uint8_t addr, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len) {
+  uint32_t start_us = micros();
+
+  _wire.beginTransmission(addr);
+  _wire.write(tx, tx_len);
+  uint8_t result = _wire.endTransmission(false);
+
+  size_t got = 0;
+  if(!result) {
+    got = _wire.requestFrom((uint16_t) addr, rx_len, true);
+    if(got == rx_len) {
+      _wire.readBytes(rx, rx_len);
+    } else {
+      result = got ? I2C_RESULT_SHORT_READ : I2C_RESULT_TIMEOUT;
+      while(_wire.available()) _wire.read();
+    }
+  }
+
+  return _account(I2C_OP_WRITE_READ, addr, result, start_us, tx, tx_len, rx, got == rx_len ? rx_len : 0);
+}
+
+bool I2cBus::select_mux(uint8_t channel, uint8_t mux_addr) {
+  if(channel == _mux_channel) {
+    return true;
+  }
+
+  uint8_t mask = 1 << (channel & 7);
+  if(!write(mux_addr, &mask, 1)) {
+    _mux_channel = I2C_MUX_NONE;
+    return false;
+  }
+  _mux_channel = channel;
+  stats.mux_switches++;
+  return true;
+}
+
+void I2cBus::trace(bool on) {
+  if(on && !_trace) {
+    _trace = (i2c_trace_entry *) mem_bulk_alloc(sizeof(i2c_trace_entry) * I2C_TRACE_SIZE);
+  }
+  _trace_head = 0;
+  _tracing = on && _trace;
+}
+
+void I2cBus::print_trace(Print &out) {
+  static const char *ops[] = { "?", "W", "R", "WR" };
+  uint32_t head = _trace_head;
+  uint32_t i = (head > I2C_TRACE_SIZE) ? head - I2C_TRACE_SIZE : 0;
+
+  if(!_trace) {
+    return;
+  }
+
+  for(; i < head; i++) {
+    const i2c_trace_entry *t = &_trace[i % I2C_TRACE_SIZE];
+    size_t n = 0;
+
+    out.printf("%u %u %s %02x %u ", t->ts_us, t->dur_us, ops[t->op & 3], t->addr, t->result);
+    for(size_t k = 0; k < t->tx_len; k++) {
+      if(n < I2C_TRACE_DATA) out.printf("%02x", t->data[n++]);
+    }
+    out.print(" / ");
+    for(size_t k = 0; k < t->rx_len; k++) {
+      if(n < I2C_TRACE_DATA) out.printf("%02x", t->data[n++]);
+    }
+    out.print("\n");
+  }
+}
+
+void I2cBus::print_stats_json(Print &out) {
+  out.printf("{ \"transactions\": %u, \"errors\": %u, \"timeouts\": %u, \"bytes\": %u, \"bus_us\": %u, \"mux_switches\": %u, \"trace\": %s }",
+    stats.transactions, stats.errors, stats.timeouts, stats.bytes, stats.bus_us, stats.mux_switches, _tracing ? "true" : "false");
+}
@@ -1,6 +1,8 @@
 #include <Arduino.h>
 
 #include "config.h"
+#include "dlog.h"
+#include "mem.h"
 #include "con.h"
 #include "web.h"
 #include "devices.h"
@@ -9,6 +11,8 @@
 void setup()
 {
     Serial.begin(DEBUG_SERIAL_SPEED);
+    dlog_init();
+    mem_init();
 
     devices_init_before();
 
@@ -21,6 +25,8 @@ void setup()
 void loop()
 {  
     devices_handle();
+    dlog_handle();
+    mem_handle();
 
     con_handle();
     if(con_state() == CON_STATE_UNDEFINED) {
@@ -0,0 +1,175 @@
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "mem.h"
+
+#define MEM_ALIGN 8
+
+static_assert(MEM_POOL_BLOCKS <= 32, "MEM_POOL_BLOCKS must fit in the free mask");
+
+static uint8_t mem_static[MEM_ARENA_SIZE] __attribute__((aligned(MEM_ALIGN)));
+
+static mem_arena g_arena = { mem_static, MEM_ARENA_SIZE, 0 };
+static mem_arena g_bulk = { NULL, 0, 0 };
+static mem_pool g_pool;
+
+static portMUX_TYPE mem_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static size_t g_largest_min = SIZE_MAX;
+static bool g_bulk_psram = false;
+
+static void *mem_arena_alloc(mem_arena *a, size_t size)
+{
+    void *p = NULL;
+
+    size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
+
+    portENTER_CRITICAL(&mem_mux);
+    if(a->base && a->used + size <= a->size) {
+        p = a->base + a->used;
+        a->used += size;
+    }
+    portEXIT_CRITICAL(&mem_mux);
+
+    return p;
+}
+
+static void mem_sample()
+{
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    if(largest < g_largest_min) {
+        g_largest_min = largest;
+    }
+}
+
+/*
+    main
+*/
+
+void mem_init()
+{
+    g_bulk.base = (uint8_t *) heap_caps_malloc(MEM_BULK_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if(g_bulk.base) {
+        g_bulk.size = MEM_BULK_SIZE;
+        g_bulk_psram = true;
+    } else {
+        g_bulk.base = (uint8_t *) heap_caps_malloc(MEM_BULK_FALLBACK, MALLOC_CAP_8BIT);
+        g_bulk.size = g_bulk.base ? MEM_BULK_FALLBACK : 0;
+        DLOG_W("No PSRAM - bulk arena is %u bytes of internal RAM", g_bulk.size);
+    }
+
+    g_pool.block_size = MEM_POOL_BLOCK_SIZE;
+    g_pool.blocks = MEM_POOL_BLOCKS;
+    g_pool.base = (uint8_t *) mem_alloc(MEM_POOL_BLOCK_SIZE * MEM_POOL_BLOCKS);
+    g_pool.free_mask = g_pool.base ? (uint32_t) ((1ULL << MEM_POOL_BLOCKS) - 1) : 0;
+
+    mem_sample();
+}
+
+void mem_handle()
+{
+    static unsigned long prev_ms = 0;
+    unsigned long current_ms = millis();
+
+    if((current_ms - prev_ms) >= MEM_SAMPLE_MS) {
+        mem_sample();
+        prev_ms = current_ms;
+    }
+}
+
+/*
+    arenas
+*/
+
+void *mem_alloc(size_t size)
+{
+    void *p = mem_arena_alloc(&g_arena, size);
+
+    if(!p) {
+        DLOG_E("Static arena exhausted - %u bytes requested", size);
+    }
+    return p;
+}
+
+void *mem_bulk_alloc(size_t size)
+{
+    void *p = mem_arena_alloc(&g_bulk, size);
+
+    if(!p) {
+        DLOG_E("Bulk arena exhausted - %u bytes requested", size);
+    }
+    return p;
+}
+
+bool mem_has_psram()
+{
+    return g_bulk_psram;
+}
+
+/*
+    pool
+*/
+
+void *mem_pool_alloc()
+{
+    void *p = NULL;
+
+    portENTER_CRITICAL(&mem_mux);
+    if(g_pool.free_mask) {
+        unsigned int i = __builtin_ctz(g_pool.free_mask);
+
+        g_pool.free_mask &= ~(1UL << i);
+        g_pool.used++;
+        if(g_pool.used > g_pool.peak) {
+            g_pool.peak = g_pool.used;
+        }
+        p = g_pool.base + i * g_pool.block_size;
+    } else {
+        g_pool.failed++;
+    }
+    portEXIT_CRITICAL(&mem_mux);
+
+    return p;
+}
+
+void mem_pool_free(void *p)
+{
+    if(!p) {
+        return;
+    }
+
+    unsigned int i = ((uint8_t *) p - g_pool.base) / g_pool.block_size;
+
+    portENTER_CRITICAL(&mem_mux);
+    if(i < g_pool.blocks && !(g_pool.free_mask & (1UL << i))) {
+        g_pool.free_mask |= (1UL << i);
+        g_pool.used--;
+    }
+    portEXIT_CRITICAL(&mem_mux);
+}
+
+/*
+    web
+*/
+
+void mem_print_json(Print &out)
+{
+    mem_sample();
+
+    out.printf("{ \"result\": \"ok\", \"heap\": { \"free\": %u, \"min_free\": %u, \"largest\": %u, \"largest_min\": %u }",
+        heap_caps_get_free_size(MALLOC_CAP_8BIT),
+        heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+        heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+        g_largest_min);
+    out.printf(", \"psram\": { \"present\": %s, \"free\": %u }",
+        g_bulk_psram ? "true" : "false",
+        heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    out.printf(", \"arena\": { \"size\": %u, \"used\": %u }", g_arena.size, g_arena.used);
+    out.printf(", \"bulk\": { \"size\": %u, \"used\": %u }", g_bulk.size, g_bulk.used);
+    out.printf(", \"pool\": { \"blocks\": %u, \"block_size\": %u, \"used\": %u, \"peak\": %u, \"failed\": %u } }",
+        g_pool.blocks, g_pool.block_size, g_pool.used, g_pool.peak, g_pool.failed);
+}
@@ -0,0 +1,346 @@
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "plugin.h"
+
+#define SCI_WRITE 0x02
+#define SCI_READ 0x03
+
+#define SCI_CLOCKF 0x03
+#define SCI_WRAM 0x06
+#define SCI_WRAMADDR 0x07
+
+#define PLUGIN_NONE 0xFFFFFFFF
+
+typedef struct
+{
+    File file;
+    uint16_t buf[PLUGIN_CHUNK];
+    uint32_t len;
+    uint32_t pos;
+    uint32_t offset; // words taken from the file
+} plugin_reader;
+
+static uint8_t g_cs;
+static uint8_t g_dreq;
+static plugin_stats g_stats;
+static plugin_reader g_reader;
+
+/*
+    SCI
+*/
+
+static bool plugin_dreq()
+{
+    uint32_t start_us = micros();
+
+    while(!digitalRead(g_dreq)) {
+        if(micros() - start_us >= PLUGIN_DREQ_TIMEOUT_US) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// words to one register in a single SCI operation, value repeated when words is NULL
+static bool plugin_sci_write(uint8_t addr, const uint16_t *words, uint16_t value, uint32_t n, uint32_t hz)
+{
+    bool ok = plugin_dreq();
+
+    SPI.beginTransaction(SPISettings(hz, MSBFIRST, SPI_MODE0));
+    digitalWrite(g_cs, LOW);
+    SPI.write(SCI_WRITE);
+    SPI.write(addr);
+    for(uint32_t i = 0; i < n && ok; i++) {
+        // DREQ drops after every word until the write is taken
+        if(i) {
+            ok = plugin_dreq();
+        }
+        SPI.write16(words ? words[i] : value);
+    }
+    digitalWrite(g_cs, HIGH);
+    SPI.endTransaction();
+
+    return ok;
+}
+
+static bool plugin_sci_read(uint8_t addr, uint16_t *value)
+{
+    if(!plugin_dreq()) {
+        return false;
+    }
+
+    SPI.beginTransaction(SPISettings(PLUGIN_SCI_READ_HZ, MSBFIRST, SPI_MODE0));
+    digitalWrite(g_cs, LOW);
+    SPI.write(SCI_READ);
+    SPI.write(addr);
+    *value = SPI.transfer16(0xFFFF);
+    digitalWrite(g_cs, HIGH);
+    SPI.endTransaction();
+
+    return true;
+}
+
+/*
+    images
+*/
+
+static void plugin_seek(plugin_reader *r, uint32_t offset)
+{
+    r->file.seek(offset * 2);
+    r->len = 0;
+    r->pos = 0;
+    r->offset = offset;
+}
+
+// words buffered at the read position, refilled when empty
+static uint32_t plugin_peek(plugin_reader *r, const uint16_t **p)
+{
+    if(r->pos == r->len) {
+        r->len = r->file.read((uint8_t *) r->buf, sizeof(r->buf)) / 2;
+        r->pos = 0;
+    }
+    *p = r->buf + r->pos;
+    return r->len - r->pos;
+}
+
+static void plugin_skip(plugin_reader *r, uint32_t n)
+{
+    r->pos += n;
+    r->offset += n;
+}
+
+static bool plugin_word(plugin_reader *r, uint16_t *w)
+{
+    const uint16_t *p;
+
+    if(!plugin_peek(r, &p)) {
+        return false;
+    }
+    *w = *p;
+    plugin_skip(r, 1);
+    return true;
+}
+
+// the image from record offset from to to, WRAM is read back instead of written
+static bool plugin_verify(plugin_reader *r, plugin_file *pf, uint32_t from, uint32_t to)
+{
+    uint32_t start_us = micros();
+    uint32_t resume = r->offset;
+    uint16_t addr, n, w, v;
+    bool io = false;
+    bool ok = true;
+
+    plugin_seek(r, from);
+    while(ok && r->offset < to && plugin_word(r, &addr) && plugin_word(r, &n)) {
+        uint32_t count = n & 0x7FFF;
+
+        if(n & 0x8000) {
+            ok = plugin_word(r, &w);
+        }
+        for(uint32_t i = 0; ok && i < count; i++) {
+            if(!(n & 0x8000)) {
+                ok = plugin_word(r, &w);
+            }
+            if(!ok) {
+                break;
+            }
+            if(addr == SCI_WRAMADDR) {
+                io = w >= PLUGIN_WRAM_IO;
+                ok = io || plugin_sci_write(addr, &w, 0, 1, PLUGIN_SCI_WRITE_HZ);
+            } else if(addr == SCI_WRAM && !io) {
+                ok = plugin_sci_read(SCI_WRAM, &v);
+                pf->verified++;
+                if(ok && v != w) {
+                    pf->mismatches++;
+                }
+            }
+        }
+    }
+    plugin_seek(r, resume);
+
+    pf->verify_us += micros() - start_us;
+    return ok && !pf->mismatches;
+}
+
+// the address a WRAMADDR record sets, without taking it from the reader
+static bool plugin_wram_io(plugin_reader *r)
+{
+    const uint16_t *p;
+
+    return plugin_peek(r, &p) && *p >= PLUGIN_WRAM_IO;
+}
+
+static bool plugin_upload(plugin_reader *r, plugin_file *pf)
+{
+    uint32_t start_us = micros();
+    uint32_t verify_from = PLUGIN_NONE; // RAM written since, not read back yet
+    uint16_t addr, n, w;
+    bool io = false;                    // WRAM writes go to I/O space
+    bool ok = true;
+
+    while(ok && plugin_word(r, &addr)) {
+        uint32_t record = r->offset - 1;
+
+        if(!plugin_word(r, &n)) {
+            ok = false;
+            break;
+        }
+        if(addr == SCI_WRAMADDR) {
+            io = plugin_wram_io(r);
+        }
+
+        // registers and I/O space may start what was loaded, RAM is checked first
+        bool ram = (addr == SCI_WRAM || addr == SCI_WRAMADDR) && !io;
+        if(!ram && verify_from != PLUGIN_NONE) {
+            ok = plugin_verify(r, pf, verify_from, record);
+            verify_from = PLUGIN_NONE;
+            if(!ok) {
+                break;
+            }
+        } else if(ram && addr == SCI_WRAMADDR && verify_from == PLUGIN_NONE) {
+            verify_from = record;
+        }
+        if(addr == SCI_WRAM && io) {
+            pf->io += n & 0x7FFF;
+        }
+
+        if(n & 0x8000) {
+            ok = plugin_word(r, &w) && plugin_sci_write(addr, NULL, w, n & 0x7FFF, PLUGIN_SCI_WRITE_HZ);
+            pf->written += n & 0x7FFF;
+            continue;
+        }
+
+        // straight from the read buffer, one SCI operation per buffered slice
+        while(ok && n) {
+            const uint16_t *p;
+            uint32_t k = min((uint32_t) n, plugin_peek(r, &p));
+
+            ok = k && plugin_sci_write(addr, p, 0, k, PLUGIN_SCI_WRITE_HZ);
+            plugin_skip(r, k);
+            pf->written += k;
+            n -= k;
+        }
+    }
+
+    if(ok && verify_from != PLUGIN_NONE) {
+        ok = plugin_verify(r, pf, verify_from, r->offset);
+    }
+
+    pf->load_us = micros() - start_us - pf->verify_us;
+    return ok;
+}
+
+static void plugin_list()
+{
+    File dir = LOCALFS.open(PLUGIN_DIR);
+
+    g_stats.files = 0;
+    if(!dir || !dir.isDirectory()) {
+        return;
+    }
+
+    for(File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+        const char *name = f.name();
+        size_t len = strlen(name);
+
+        if(f.isDirectory() || len < strlen(PLUGIN_EXT) || strcmp(name + len - strlen(PLUGIN_EXT), PLUGIN_EXT)) {
+            continue;
+        }
+        if(g_stats.files == PLUGIN_FILES) {
+            DLOG_W("More than %u plugins, %s skipped", PLUGIN_FILES, name);
+            continue;
+        }
+
+        // kept sorted, patches usually have to go first
+        unsigned int i = g_stats.files++;
+        while(i && strcmp(g_stats.file[i - 1].name.c_str(), name) > 0) {
+            g_stats.file[i] = g_stats.file[i - 1];
+            i--;
+        }
+        // nothing from an earlier load, files after a failed one stay untouched
+        g_stats.file[i] = plugin_file();
+        g_stats.file[i].name.set(name);
+    }
+    dir.close();
+}
+
+/*
+    audio
+*/
+
+bool plugin_load(uint8_t cs, uint8_t dreq)
+{
+    unsigned long start_ms = millis();
+    bool ok = true;
+
+    g_cs = cs;
+    g_dreq = dreq;
+    plugin_list();
+    if(!g_stats.files) {
+        return true;
+    }
+
+    // a reset may have left the clock multiplier off, SCI limits follow CLKI
+    uint16_t clockf = PLUGIN_CLOCKF;
+    if(!plugin_sci_write(SCI_CLOCKF, &clockf, 0, 1, PLUGIN_SCI_SLOW_HZ)) {
+        DLOG_E("VS1053 not ready for plugins");
+        g_stats.failures++;
+        return false;
+    }
+
+    for(unsigned int i = 0; i < g_stats.files && ok; i++) {
+        plugin_file *pf = &g_stats.file[i];
+        fstr<PLUGIN_NAME_SIZE + sizeof(PLUGIN_DIR)> path;
+
+        path.printf(PLUGIN_DIR "/%s", pf->name.c_str());
+
+        g_reader.file = LOCALFS.open(path.c_str(), "r", false);
+        if(!g_reader.file) {
+            DLOG_E("Can't open %s", path.c_str());
+            ok = false;
+            break;
+        }
+        pf->words = g_reader.file.size() / 2;
+        plugin_seek(&g_reader, 0);
+
+        pf->ok = ok = plugin_upload(&g_reader, pf);
+        g_reader.file.close();
+
+        if(ok) {
+            DLOG_I("Plugin %s - %u words in %u us, %u read back in %u us", pf->name.c_str(), pf->written,
+                pf->load_us, pf->verified, pf->verify_us);
+        } else {
+            DLOG_E("Plugin %s failed after %u words, %u of %u read back differ", pf->name.c_str(),
+                pf->written, pf->mismatches, pf->verified);
+        }
+    }
+
+    g_stats.loads++;
+    if(!ok) {
+        g_stats.failures++;
+    }
+    g_stats.last_ms = millis() - start_ms;
+    return ok;
+}
+
+/*
+    web
+*/
+
+void plugin_print_json(Print &out)
+{
+    out.printf("{ \"loads\": %u, \"failures\": %u, \"last_ms\": %u, \"files\": [",
+        g_stats.loads, g_stats.failures, g_stats.last_ms);
+    for(unsigned int i = 0; i < g_stats.files; i++) {
+        const plugin_file *pf = &g_stats.file[i];
+
+        out.printf("%s { \"name\": \"%s\", \"ok\": %s, \"words\": %u, \"written\": %u, \"verified\": %u"
+            ", \"io\": %u, \"mismatches\": %u, \"load_us\": %u, \"verify_us\": %u }", i ? "," : "",
+            pf->name.c_str(), pf->ok ? "true" : "false", pf->words, pf->written, pf->verified, pf->io,
+            pf->mismatches, pf->load_us, pf->verify_us);
+    }
+    out.print(" ] }");
+}
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include <Arduino.h>
+#include <esp_wifi.h>
+#include <esp_idf_version.h>
+#ifdef CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+
+#include "config.h"
+#include "dlog.h"
+#include "con.h"
+#include "audio.h"
+#include "power.h"
+
+#define POWER_PS_UNSET -1
+
+static const wifi_ps_type_t power_ps[POWER_LEVELS] = { WIFI_PS_MAX_MODEM, WIFI_PS_MIN_MODEM, WIFI_PS_NONE };
+static const char *power_level_names[] = { "low", "mid", "high" };
+static const char *power_reason_names[] = { "hold", "safety", "fill", "load", "relax" };
+
+static bool g_enabled = true;
+static volatile int8_t g_enable_req = -1; // from web, applied in the loop
+static bool g_held = false;
+static power_policy g_policy;
+static int g_ps = POWER_PS_UNSET;
+
+static audio_load g_prev;
+static unsigned long g_sample_ms = 0;
+static unsigned long g_state_ms = 0; // current level since
+
+static power_input g_last;            // last full sample, for the log
+static power_decision g_log[POWER_LOG_SIZE];
+static uint32_t g_log_head = 0;
+static power_stats g_stats;
+
+#ifdef CONFIG_PM_ENABLE
+#if ESP_IDF_VERSION_MAJOR >= 5
+typedef esp_pm_config_t power_pm_config;
+#else
+typedef esp_pm_config_esp32s3_t power_pm_config;
+#endif
+
+static esp_pm_lock_handle_t g_lock = NULL;
+static bool g_locked = false;
+#endif
+
+static void power_set_clock(uint8_t level)
+{
+#ifdef CONFIG_PM_ENABLE
+    power_pm_config pm = {};
+
+    pm.max_freq_mhz = power_level_mhz(level);
+    pm.min_freq_mhz = POWER_LOW_MHZ;
+    pm.light_sleep_enable = false;
+    esp_pm_configure(&pm);
+
+    // DFS would drop the clock between loop passes while refilling
+    bool lock = (level == POWER_HIGH);
+    if(g_lock && lock != g_locked) {
+        lock ? esp_pm_lock_acquire(g_lock) : esp_pm_lock_release(g_lock);
+        g_locked = lock;
+    }
+#else
+    setCpuFrequencyMhz(power_level_mhz(level));
+#endif
+}
+
+static void power_set_ps(wifi_ps_type_t ps)
+{
+    if(g_ps == ps) {
+        return;
+    }
+    if(esp_wifi_set_ps(ps) == ESP_OK) {
+        g_ps = ps;
+    }
+}
+
+static void power_set_ps_for_level()
+{
+    // modem sleep is for stations only, AP and the Wi-Fi trial keep the radio up
+    if(!g_enabled) {
+        power_set_ps(WIFI_PS_MIN_MODEM);
+    } else {
+        power_set_ps(con_state() == CON_STATE_CLIENT ? power_ps[g_policy.level] : WIFI_PS_NONE);
+    }
+}
+
+static void power_account(uint8_t level, unsigned long current_ms)
+{
+    g_stats.state_ms[level] += current_ms - g_state_ms;
+    g_state_ms = current_ms;
+}
+
+static void power_log(uint8_t from, uint8_t reason, const power_input *in, unsigned long current_ms)
+{
+    power_decision *d = &g_log[g_log_head++ % POWER_LOG_SIZE];
+
+    d->ms = current_ms;
+    d->from = from;
+    d->to = g_policy.level;
+    d->reason = reason;
+    d->duty_pct = in->duty_pct;
+    d->margin_pct = in->margin_pct;
+    d->kbps = in->kbps;
+}
+
+static void power_step(const power_input *in, unsigned long current_ms)
+{
+    uint8_t from = g_policy.level;
+    uint8_t reason = power_decide(&g_policy, in);
+
+    if(g_policy.level == from) {
+        return;
+    }
+
+    power_account(from, current_ms);
+    g_stats.changes++;
+    if(reason == POWER_REASON_SAFETY) {
+        g_stats.safety++;
+    }
+    power_log(from, reason, in, current_ms);
+
+    power_set_clock(g_policy.level);
+    power_set_ps_for_level();
+
+    DLOG_I("Power %s -> %s (%s), duty %u%%, buffer %u%%, %u kbps", power_level_names[from],
+        power_level_names[g_policy.level], power_reason_names[reason], in->duty_pct, in->margin_pct, in->kbps);
+}
+
+/*
+    devices
+*/
+
+void power_init()
+{
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "power", &g_lock);
+#endif
+    power_policy_init(&g_policy, POWER_HIGH);
+    power_set_clock(POWER_HIGH);
+
+    audio_get_load(&g_prev);
+    g_sample_ms = g_state_ms = millis();
+}
+
+static void power_apply_enable(bool on)
+{
+    if(on == g_enabled) {
+        return;
+    }
+
+    unsigned long current_ms = millis();
+
+    power_account(g_policy.level, current_ms);
+
+    // off is the firmware default - full clock, Arduino's min modem sleep
+    g_enabled = on;
+    power_policy_init(&g_policy, POWER_HIGH);
+    power_set_clock(POWER_HIGH);
+    power_set_ps_for_level();
+
+    audio_get_load(&g_prev);
+    g_sample_ms = current_ms;
+
+    DLOG_I("Power governor %s", on ? "on" : "off");
+}
+
+void power_handle()
+{
+    unsigned long current_ms = millis();
+    audio_load load;
+    power_input in = {};
+
+    if(g_enable_req >= 0) {
+        power_apply_enable(g_enable_req);
+        g_enable_req = -1;
+    }
+    if(!g_enabled || g_held) {
+        return;
+    }
+
+    audio_get_load(&load);
+    in.margin_pct = load.margin_pct;
+    in.playing = load.playing;
+    in.filling = load.filling;
+
+    uint32_t elapsed_ms = current_ms - g_sample_ms;
+    if(elapsed_ms < POWER_SAMPLE_MS) {
+        // a draining buffer doesn't wait for the next sample
+        if(g_policy.level != POWER_HIGH && power_unsafe(&in)) {
+            in.duty_pct = g_last.duty_pct;
+            in.kbps = g_last.kbps;
+            power_step(&in, current_ms);
+        }
+        return;
+    }
+
+    uint32_t busy_us = (load.net_us - g_prev.net_us) + (load.sink_us - g_prev.sink_us);
+    in.duty_pct = min((uint32_t) 100, busy_us / 10 / elapsed_ms);
+    in.kbps = (load.bytes_out - g_prev.bytes_out) * 8 / elapsed_ms;
+
+    g_prev = load;
+    g_last = in;
+    g_sample_ms = current_ms;
+    g_stats.samples++;
+
+    power_step(&in, current_ms);
+    // the link may have come up or gone to AP since the last change
+    power_set_ps_for_level();
+}
+
+// web handlers run on the network task, the policy state is the loop's
+void power_enable(bool on)
+{
+    g_enable_req = on;
+}
+
+/*
+    bench
+*/
+
+void power_hold(bool on)
+{
+    unsigned long current_ms = millis();
+
+    if(on == g_held) {
+        return;
+    }
+    g_held = on;
+    if(!g_enabled) {
+        return;
+    }
+
+    if(on) {
+        uint8_t from = g_policy.level;
+
+        power_account(from, current_ms);
+        power_policy_init(&g_policy, POWER_HIGH);
+        power_set_clock(POWER_HIGH);
+        power_set_ps_for_level();
+        if(from != POWER_HIGH) {
+            DLOG_I("Power %s -> %s (held)", power_level_names[from], power_level_names[POWER_HIGH]);
+        }
+    } else {
+        // the held interval is not a load sample
+        audio_get_load(&g_prev);
+        g_sample_ms = current_ms;
+    }
+}
+
+/*
+    web
+*/
+
+void power_print_json(Print &out)
+{
+    unsigned long current_ms = millis();
+
+    out.printf("{ \"result\": \"ok\", \"enabled\": %s, \"held\": %s, \"level\": \"%s\", \"mhz\": %u, \"wifi_ps\": %d",
+        g_enabled ? "true" : "false", g_held ? "true" : "false", power_level_names[g_policy.level],
+        getCpuFrequencyMhz(), g_ps);
+    out.printf(", \"samples\": %u, \"changes\": %u, \"safety\": %u, \"state_ms\": {",
+        g_stats.samples, g_stats.changes, g_stats.safety);
+    for(unsigned int i = 0; i < POWER_LEVELS; i++) {
+        uint32_t ms = g_stats.state_ms[i] + (i == g_policy.level ? current_ms - g_state_ms : 0);
+        out.printf("%s \"%s\": %u", i ? "," : "", power_level_names[i], ms);
+    }
+
+    out.print(" }, \"decisions\": [");
+    uint32_t n = min(g_log_head, (uint32_t) POWER_LOG_SIZE);
+    for(uint32_t i = 0; i < n; i++) {
+        const power_decision *d = &g_log[(g_log_head - n + i) % POWER_LOG_SIZE];
+        out.printf("%s { \"ms\": %u, \"from\": \"%s\", \"to\": \"%s\", \"reason\": \"%s\", \"duty\": %u, \"margin\": %u, \"kbps\": %u }",
+            i ? "," : "", d->ms, power_level_names[d->from], power_level_names[d->to],
+            power_reason_names[d->reason], d->duty_pct, d->margin_pct, d->kbps);
+    }
+    out.print(" ] }");
+}
\ No newline at end of file
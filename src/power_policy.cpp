@@ -0,0 +1,62 @@
+#include "power_policy.h"
+
+static const uint16_t power_mhz[POWER_LEVELS] = { POWER_LOW_MHZ, POWER_MID_MHZ, POWER_HIGH_MHZ };
+
+void power_policy_init(power_policy *p, uint8_t level)
+{
+    p->level = level;
+    p->relax = 0;
+}
+
+bool power_unsafe(const power_input *in)
+{
+    return in->playing && in->margin_pct < POWER_MARGIN_SAFE_PCT;
+}
+
+uint8_t power_decide(power_policy *p, const power_input *in)
+{
+    // connects, TLS handshakes and prebuffering go at full speed
+    if(in->filling || power_unsafe(in)) {
+        uint8_t reason = in->filling ? POWER_REASON_FILL : POWER_REASON_SAFETY;
+
+        p->relax = 0;
+        if(p->level == POWER_HIGH) {
+            return POWER_REASON_HOLD;
+        }
+        p->level = POWER_HIGH;
+        return reason;
+    }
+
+    if(in->duty_pct > POWER_DUTY_UP_PCT && p->level < POWER_HIGH) {
+        p->relax = 0;
+        p->level++;
+        return POWER_REASON_LOAD;
+    }
+
+    if(p->level == POWER_LOW) {
+        return POWER_REASON_HOLD;
+    }
+
+    uint8_t lower = p->level - 1;
+    uint32_t projected = (uint32_t) in->duty_pct * power_mhz[p->level] / power_mhz[lower];
+    bool room = projected < POWER_DUTY_DOWN_PCT
+        && (!in->playing || in->margin_pct >= POWER_MARGIN_DOWN_PCT)
+        && (lower != POWER_LOW || in->kbps <= POWER_LOW_KBPS_MAX);
+
+    if(!room) {
+        p->relax = 0;
+        return POWER_REASON_HOLD;
+    }
+    if(++p->relax < POWER_DOWN_HOLD) {
+        return POWER_REASON_HOLD;
+    }
+
+    p->relax = 0;
+    p->level = lower;
+    return POWER_REASON_RELAX;
+}
+
+uint16_t power_level_mhz(uint8_t level)
+{
+    return power_mhz[level < POWER_LEVELS ? level : POWER_HIGH];
+}
\ No newline at end of file
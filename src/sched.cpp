@@ -0,0 +1,222 @@
+#include <Arduino.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "devices.h"
+#include "audio.h"
+#include "agc.h"
+#include "sched.h"
+
+#define SCHED_LINE_SIZE (STREAM_URL_SIZE + 64)
+#define SCHED_NONE -2 // nothing decided yet
+#define SCHED_DEFAULT -1
+
+static sched_entry g_entries[SCHED_MAX_ENTRIES];
+static unsigned int g_count = 0;
+static sched_entry g_default;
+static fstr<SCHED_TZ_SIZE> g_tz(SCHED_TZ);
+
+static int g_current = SCHED_NONE;
+static int g_next = SCHED_NONE;
+static int64_t g_boundary_ms = 0;
+
+static sched_stats g_stats;
+
+static int64_t sched_now_ms()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static int sched_at(time_t t)
+{
+    struct tm lt;
+
+    localtime_r(&t, &lt);
+    uint16_t m = lt.tm_hour * 60 + lt.tm_min;
+
+    for(unsigned int i = 0; i < g_count; i++) {
+        const sched_entry *e = &g_entries[i];
+
+        if(e->start_min <= e->end_min
+            ? (m >= e->start_min && m < e->end_min)
+            : (m >= e->start_min || m < e->end_min)) {
+            return i;
+        }
+    }
+    return SCHED_DEFAULT;
+}
+
+static const sched_entry *sched_program(int idx)
+{
+    return (idx >= 0) ? &g_entries[idx] : &g_default;
+}
+
+static void sched_apply(int idx)
+{
+    const sched_entry *p = sched_program(idx);
+
+    DLOG_I("Programme %s - %s", p->ps.c_str(), p->url.c_str());
+    set_station_ps(p->ps.c_str());
+    agc_set_ceiling(p->volume);
+    g_current = idx;
+}
+
+static bool sched_parse(const char *line, sched_entry *e)
+{
+    unsigned int sh, sm, eh, em, volume;
+    char ps[STATION_PS_SIZE];
+    char url[STREAM_URL_SIZE];
+
+    if(sscanf(line, "%u:%u %u:%u %u %8s %255s", &sh, &sm, &eh, &em, &volume, ps, url) != 7) {
+        return false;
+    }
+    // 24:00 is the only end past 23:59
+    if(sh > 23 || sm > 59 || eh > 24 || em > 59 || (eh == 24 && em) || volume > 100) {
+        return false;
+    }
+
+    e->start_min = sh * 60 + sm;
+    e->end_min = eh * 60 + em;
+    e->volume = volume;
+    e->ps.set(ps);
+    e->url.set(url);
+
+    return true;
+}
+
+static void sched_load()
+{
+    File f = LOCALFS.open(SCHED_FILE, "r", false);
+    char line[SCHED_LINE_SIZE];
+
+    if(!f) {
+        DLOG_I("Schedule file not found");
+        return;
+    }
+
+    while(f.available() && g_count < SCHED_MAX_ENTRIES) {
+        size_t n = f.readBytesUntil('\n', line, sizeof(line) - 1);
+        line[n] = 0;
+
+        if(n && line[n - 1] == '\r') {
+            line[--n] = 0;
+        }
+        if(!n || line[0] == '#') {
+            continue;
+        }
+
+        if(strncmp(line, "TZ ", 3) == 0) {
+            g_tz.set(line + 3);
+            g_tz.trim();
+        } else if(sched_parse(line, &g_entries[g_count])) {
+            g_count++;
+        } else {
+            DLOG_W("Bad schedule line - %s", line);
+        }
+    }
+    f.close();
+
+    DLOG_I("Schedule has %u entries, TZ %s", g_count, g_tz.c_str());
+}
+
+/*
+    devices
+*/
+
+void sched_init(const char *url, const char *ps, uint8_t volume)
+{
+    g_default.start_min = 0;
+    g_default.end_min = 0;
+    g_default.volume = volume;
+    g_default.ps.set(ps);
+    g_default.url.set(url);
+
+    sched_load();
+    configTzTime(g_tz.c_str(), SCHED_NTP_SERVER);
+}
+
+void sched_handle()
+{
+    static unsigned long prev_ms = 0;
+    unsigned long current_ms = millis();
+
+    if((current_ms - prev_ms) < SCHED_CHECK_MS || !g_count) {
+        return;
+    }
+    prev_ms = current_ms;
+
+    time_t now = time(NULL);
+    if(now < SCHED_TIME_VALID) {
+        return;
+    }
+
+    int idx = sched_at(now);
+
+    // first decision once the clock is synced
+    if(g_current == SCHED_NONE) {
+        if(idx != SCHED_DEFAULT) {
+            audio_play(sched_program(idx)->url.c_str());
+        }
+        sched_apply(idx);
+        return;
+    }
+
+    if(idx == g_current) {
+        int soon = sched_at(now + SCHED_PREWARM_S);
+
+        if(soon != g_current && soon != g_next) {
+            // schedule ranges change on minute starts
+            g_boundary_ms = (int64_t) ((now + SCHED_PREWARM_S) / 60 * 60) * 1000;
+            g_next = soon;
+            audio_prepare(sched_program(soon)->url.c_str());
+        }
+        return;
+    }
+
+    int64_t now_ms = sched_now_ms();
+
+    if(idx == g_next && audio_prepared()) {
+        audio_switch();
+        g_stats.last_prewarmed = true;
+    } else if(idx == g_next && now_ms - g_boundary_ms < SCHED_SWITCH_GRACE_MS) {
+        // keep playing the old source until the new one has prebuffered
+        return;
+    } else {
+        if(idx != g_next) {
+            g_boundary_ms = (int64_t) (now / 60 * 60) * 1000;
+        }
+        audio_play(sched_program(idx)->url.c_str());
+        g_stats.last_prewarmed = false;
+    }
+
+    g_stats.switches++;
+    g_stats.last_late_ms = now_ms - g_boundary_ms;
+    g_next = SCHED_NONE;
+    sched_apply(idx);
+
+    DLOG_I("Switched %d ms after boundary%s", g_stats.last_late_ms, g_stats.last_prewarmed ? "" : " (cold)");
+}
+
+const char *sched_url()
+{
+    return sched_program(g_current >= 0 ? g_current : SCHED_DEFAULT)->url.c_str();
+}
+
+/*
+    web
+*/
+
+void sched_print_json(Print &out)
+{
+    time_t now = time(NULL);
+
+    out.printf("{ \"result\": \"ok\", \"synced\": %s, \"time\": %ld, \"entries\": %u, \"current\": %d, \"next\": %d",
+        now >= SCHED_TIME_VALID ? "true" : "false", (long) now, g_count, g_current, g_next);
+    out.printf(", \"switches\": %u, \"last_late_ms\": %d, \"last_prewarmed\": %s }",
+        g_stats.switches, g_stats.last_late_ms, g_stats.last_prewarmed ? "true" : "false");
+}
@@ -23,29 +23,13 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <Wire.h>
 
 #include "si47xx.h"
+#include "si47xx_cmd.h"
+#include "dlog.h"
 
 #define TAG "si47xx"
 
 constexpr unsigned int SI4710_STATUS_CTS PROGMEM = 0x80;
 
-constexpr unsigned int CMD_POWER_UP PROGMEM = 0x01;
-constexpr unsigned int CMD_GET_REV PROGMEM = 0x10;
-constexpr unsigned int CMD_POWER_DOWN PROGMEM = 0x11;
-constexpr unsigned int CMD_SET_PROPERTY PROGMEM = 0x12;
-constexpr unsigned int CMD_GET_PROPERTY PROGMEM = 0x13;
-constexpr unsigned int CMD_GET_INT_STATUS PROGMEM = 0x14;
-constexpr unsigned int CMD_PATCH_ARGS PROGMEM = 0x15;
-constexpr unsigned int CMD_PATCH_DATA PROGMEM = 0x16;
-constexpr unsigned int CMD_TX_TUNE_FREQ PROGMEM = 0x30;
-constexpr unsigned int CMD_TX_TUNE_POWER PROGMEM = 0x31;
-constexpr unsigned int CMD_TX_TUNE_MEASURE PROGMEM = 0x32;
-constexpr unsigned int CMD_TX_TUNE_STATUS PROGMEM = 0x33;
-constexpr unsigned int CMD_TX_ASQ_STATUS PROGMEM = 0x34;
-constexpr unsigned int CMD_TX_RDS_BUFF PROGMEM = 0x35;
-constexpr unsigned int CMD_TX_RDS_PS PROGMEM = 0x36;
-constexpr unsigned int CMD_GPO_CTL PROGMEM = 0x80;
-constexpr unsigned int CMD_GPO_SET PROGMEM = 0x81;
-
 constexpr unsigned int PROP_GPO_IEN PROGMEM = 0x0001;
 constexpr unsigned int PROP_DIGITAL_INPUT_FORMAT PROGMEM = 0x0101;
 constexpr unsigned int PROP_DIGITAL_INPUT_SAMPLE_RATE PROGMEM = 0x0103;
@@ -80,77 +64,225 @@ constexpr unsigned int PROP_TX_RDS_PS_AF PROGMEM = 0x2C06;
 constexpr unsigned int PROP_TX_RDS_FIFO_SIZE PROGMEM = 0x2C07;
 
 
-void _request_bytes(uint8_t num_bytes) {
-  uint8_t res = Wire.requestFrom(SI47XX_I2C_ADDR, num_bytes);
-  // ESP_LOGI(TAG, "Request %d bytes with result %d", num_bytes, res);
-  if(res == num_bytes) 
+// Default property sets, applied by begin() and begin_rds()
+static const uint16_t si47xx_props[][2] = {
+  { PROP_TX_PREEMPHASIS, 1 },        // 75µS pre-emph (USA std)
+  { PROP_TX_ACOMP_ENABLE, 0x0003 },  // Turn on limiter and Audio Dynamic Range Control
+};
+
+static const uint16_t si47xx_rds_props[][2] = {
+  { PROP_TX_AUDIO_DEVIATION, 6625 },  // 66.25KHz (default is 68.25)
+  { PROP_TX_RDS_DEVIATION, 200 },     // 2KHz (default)
+  { PROP_TX_RDS_INTERRUPT_SOURCE, 0x0001 }, // RDS IRQ
+  { PROP_TX_RDS_PI, 0 },              // programID
+  { PROP_TX_RDS_PS_MIX, 0x03 },       // 50% mix (default)
+  { PROP_TX_RDS_PS_MISC, 0x1AC8 },    // RDSD0 & RDSMS (default)
+  { PROP_TX_RDS_PS_REPEAT_COUNT, 3 }, // 3 repeats (default)
+  { PROP_TX_RDS_MESSAGE_COUNT, 1 },
+  { PROP_TX_RDS_PS_AF, 0xE0E0 },      // no AF
+  { PROP_TX_RDS_FIFO_SIZE, 0 },
+  { PROP_TX_COMPONENT_ENABLE, 0x0007 }, // Enable RDS
+};
+
+#define SI47XX_PROPS (sizeof(si47xx_props) / sizeof(si47xx_props[0]))
+#define SI47XX_RDS_PROPS (sizeof(si47xx_rds_props) / sizeof(si47xx_rds_props[0]))
+
+// begin_async() steps
+#define STEP_RESET 0
+#define STEP_RESET_WAIT 1
+#define STEP_POWER_UP 2
+#define STEP_GET_REV 3
+#define STEP_PROPS 4
+#define STEP_TUNE 5
+#define STEP_TUNE_STC 6
+#define STEP_POWER 7
+#define STEP_POWER_STC 8
+#define STEP_RDS_PROPS 9
+#define STEP_RDS_PS 10
+#define STEP_DONE 11
+#define STEP_FAILED 12
+
+// done() operations
+#define OP_NONE 0
+#define OP_ASQ 1
+#define OP_PROPERTY 2
+
+/*
+  transport
+*/
+
+void Si47xx::_mark(void) {
+  _mark_us = micros();
+  _mark_bus_us = bus_us;
+}
+
+void Si47xx::_measure(uint32_t *us, uint32_t *bus) {
+  *us = micros() - _mark_us;
+  *bus = bus_us - _mark_bus_us;
+}
+
+void Si47xx::_select(void) {
+  if(_mux_channel >= 0) {
+    _bus->select_mux(_mux_channel);
+  }
+}
+
+void Si47xx::_reset(void) {
+  if(_reset_pin < 0)
     return;
 
-  int k = 0;
-  while((Wire.available() < num_bytes) && (k < (SI47XX_MAX_AWAIT / SI47XX_STEP_AWAIT))) {
-    // ESP_LOGI(TAG, "Wait for %d - availible %d", num_bytes, Wire.available());
-    delay(SI47XX_STEP_AWAIT);
-    k++;
+  pinMode(_reset_pin, OUTPUT);
+  digitalWrite(_reset_pin, HIGH);
+  delay(10);
+  digitalWrite(_reset_pin, LOW);
+  delay(10);
+  digitalWrite(_reset_pin, HIGH);
+  delay(SI47XX_POWER_UP_MS);
+}
+
+bool Si47xx::_issue(unsigned int len, unsigned int resp_len) {
+  uint32_t start_us = _bus->stats.bus_us;
+  bool ok;
+
+  _select();
+  commands++;
+
+  // Command, status and response in one transfer; most commands are CTS already
+  ok = _bus->write_read(_addr, _cmd_buff, min(len, SI47XX_BUF_SIZE), _resp_buff, min(resp_len + 1, SI47XX_RESP_SIZE));
+  bus_us += _bus->stats.bus_us - start_us;
+  if(!ok)
+    _resp_buff[0] = 0;
+  return ok;
+}
+
+// 1 - CTS with the response in _resp_buff, 0 - still busy
+int Si47xx::_poll(void) {
+  if(_resp_buff[0] & SI4710_STATUS_CTS)
+    return 1;
+
+  uint32_t start_us = _bus->stats.bus_us;
+
+  _select();
+  if(!_bus->read(_addr, _resp_buff, min(_pending_resp + 1, SI47XX_RESP_SIZE))) {
+    _resp_buff[0] = 0;
   }
+  bus_us += _bus->stats.bus_us - start_us;
+  return (_resp_buff[0] & SI4710_STATUS_CTS) ? 1 : 0;
 }
 
-void Si47xx::_send_command(unsigned int len, bool need_status) {
-  // ESP_LOGI(TAG, "Send cmd %x with common len %d", _cmd_buff[0], len);
-  
-  Wire.beginTransmission(SI47XX_I2C_ADDR);
-  for (uint8_t i = 0; i < min(len, SI47XX_BUF_SIZE); i++) {
-    Wire.write(_cmd_buff[i]);
+bool Si47xx::_send_command(unsigned int len, unsigned int resp_len) {
+  // let a started command finish first, the chip takes one at a time
+  if(_op != OP_NONE) {
+    uint8_t cmd[SI47XX_BUF_SIZE];
+
+    memcpy(cmd, _cmd_buff, sizeof(cmd));
+    while(!done())
+      delayMicroseconds(SI47XX_POLL_US);
+    memcpy(_cmd_buff, cmd, sizeof(cmd));
   }
-  Wire.endTransmission();
-  
-  if(need_status) {
-    // Wait for status CTS bit, indicating command is complete:
-    uint8_t status = 0;
-    int k = 0;
-
-    while (!(status & SI4710_STATUS_CTS) && (k < (SI47XX_MAX_AWAIT / SI47XX_STEP_AWAIT))) {
-      if(Wire.requestFrom(SI47XX_I2C_ADDR, 1) == 1) {
-        Wire.readBytes(&status, 1);
-        // ESP_LOGI(TAG, "[%d] Cmd status - %x", k, status); 
-      }
+
+  // DLOG_I("Send cmd %x with common len %d", _cmd_buff[0], len);
+  _pending_resp = resp_len;
+  _issue(len, resp_len);
+
+  // Wait for status CTS bit, indicating command is complete:
+  uint32_t start_us = micros();
+  uint32_t start_ms = millis();
+
+  while(!_poll()) {
+    if(millis() - start_ms >= SI47XX_MAX_AWAIT) {
+      DLOG_W("Command %x timed out", _cmd_buff[0]);
+      timeouts++;
+      return false;
+    }
+
+    if(micros() - start_us < SI47XX_FAST_AWAIT_US) {
+      delayMicroseconds(SI47XX_POLL_US);
+    } else {
       delay(SI47XX_STEP_AWAIT);
-      k++;
     }
+    // DLOG_I("Cmd status - %x", _resp_buff[0]);
   }
+
+  return true;
 }
 
 void Si47xx::_set_property(unsigned int property, unsigned int value) {
-  _cmd_buff[0] = CMD_SET_PROPERTY;
-  _cmd_buff[1] = 0;
-  _cmd_buff[2] = property >> 8;
-  _cmd_buff[3] = property & 0xFF;
-  _cmd_buff[4] = value >> 8;
-  _cmd_buff[5] = value & 0xFF;
-  
-  _send_command(6);
+  if(_send_command(encode_property(_cmd_buff, property, value)))
+    _cache_property(property, value);
+}
+
+void Si47xx::_cache_property(unsigned int property, unsigned int value) {
+  for (unsigned int i = 0; i < SI47XX_PROP_CACHE; i++) {
+    if(_prop_key[i] == property) {
+      _prop_val[i] = value;
+      return;
+    }
+  }
+  // only the control loop properties matter, so plain round-robin eviction
+  _prop_key[_prop_next] = property;
+  _prop_val[_prop_next] = value;
+  _prop_next = (_prop_next + 1) % SI47XX_PROP_CACHE;
+}
+
+bool Si47xx::has_property(unsigned int property, unsigned int value) {
+  for (unsigned int i = 0; i < SI47XX_PROP_CACHE; i++) {
+    if(_prop_key[i] == property)
+      return _prop_val[i] == value;
+  }
+  return false;
 }
 
 unsigned int Si47xx::_get_status(void) {
-  Wire.beginTransmission(SI47XX_I2C_ADDR);
-  Wire.write(CMD_GET_INT_STATUS);
-  Wire.endTransmission();
+  _cmd_buff[0] = CMD_GET_INT_STATUS;
+  _send_command(1);
 
-  _request_bytes(1);
-  return Wire.read();
+  return _resp_buff[0];
 }
 
+bool Si47xx::_wait_stc(void) {
+  uint32_t start_ms = millis();
 
-bool Si47xx::begin() {
-  pinMode(SI47XX_PIN_RESET, OUTPUT);
-  digitalWrite(SI47XX_PIN_RESET, HIGH);
-  delay(10);
-  digitalWrite(SI47XX_PIN_RESET, LOW);
-  delay(10);
-  digitalWrite(SI47XX_PIN_RESET, HIGH);
-  delay(100);
+  // Wait for Seek/Tune Complete (STC) bit to be set:
+  while ((_get_status() & 0x81) != 0x81) {
+    if(millis() - start_ms >= SI47XX_MAX_AWAIT) {
+      DLOG_W("STC wait timed out");
+      timeouts++;
+      return false;
+    }
+    delay(SI47XX_STEP_AWAIT);
+  }
+  return true;
+}
+
+bool Si47xx::_check_rev(void) {
+  uint8_t part_num =  _resp_buff[1];
+  uint8_t fw_major =  _resp_buff[2];
+  uint8_t fw_minor =  _resp_buff[3];
+  uint8_t patch_h =  _resp_buff[4];
+  uint8_t patch_l =  _resp_buff[5];
+  uint8_t cmp_major =  _resp_buff[6];
+  uint8_t cmp_minor =  _resp_buff[7];
+  uint8_t chip_rev =  _resp_buff[8];
+  
+  DLOG_I("Info: %02x PN %d, FW %d.%d, PATCH %d, CMP %d.%d, Chip REV %d", 
+    _addr, part_num, fw_major, fw_minor, (uint16_t) ((patch_h << 8) | patch_l), 
+    cmp_major, cmp_minor, chip_rev);
+  
+  if(part_num != SI47XX_CHIP_VERSION) {
+    DLOG_I("DETECTED WRONG CHIP VERSION: %d", part_num);
+    return false; // Wrong chip version detected, bail out
+  }
+  return true;
+}
 
-  Wire.begin();
-  delay(100);
+/*
+  blocking interface
+*/
+
+bool Si47xx::begin() {
+  _reset();
+  _bus->begin();
   
   _cmd_buff[0] = CMD_POWER_UP;
   // CTS interrupt disabled, GPO2 output disabled, boot normally, transmit mode:
@@ -161,157 +293,313 @@ bool Si47xx::begin() {
   // Check communications with Si47xx:
   _cmd_buff[0] = CMD_GET_REV;
   _cmd_buff[1] = 0;
-  _send_command(1);
-  _request_bytes(8);
-  
-  uint8_t part_num =  Wire.read();
-  uint8_t fw_major =  Wire.read();
-  uint8_t fw_minor =  Wire.read();
-  uint8_t patch_h =  Wire.read();
-  uint8_t patch_l =  Wire.read();
-  uint8_t cmp_major =  Wire.read();
-  uint8_t cmp_minor =  Wire.read();
-  uint8_t chip_rev =  Wire.read();
-  
-  ESP_LOGI(TAG, "Info: PN %d, FW %d.%d, PATCH %d, CMP %d.%d, Chip REV %d", 
-    part_num, fw_major, fw_minor, (uint16_t) (patch_h << 8 && patch_l), 
-    cmp_major, cmp_minor, chip_rev);
-  
-  if(part_num != SI47XX_CHIP_VERSION) {
-    ESP_LOGI(TAG, "DETECTED WRONG CHIP VERSION: %d", part_num);
-    return false; // Wrong chip version detected, bail out
+  if(!_send_command(1, 8)) {
+    DLOG_W("No answer from chip %02x", _addr);
+    return false;
   }
+  if(!_check_rev())
+    return false;
 
-  _set_property(PROP_TX_PREEMPHASIS, 1); // 75µS pre-emph (USA std)
-  _set_property(PROP_TX_ACOMP_ENABLE, 0x0003); // Turn on limiter and Audio Dynamic Range Control
+  for (unsigned int i = 0; i < SI47XX_PROPS; i++)
+    _set_property(si47xx_props[i][0], si47xx_props[i][1]);
 
   return true;
 }
 
 void Si47xx::tune_fm(unsigned int freq_kHz) {
-  freq_kHz /= 10; // Convert to 10kHz
-  
-  // Force freq to be a multiple of 50kHz:
-  if (freq_kHz % 5 != 0)
-    freq_kHz -= (freq_kHz % 5);
-
-  _cmd_buff[0] = CMD_TX_TUNE_FREQ;
-  _cmd_buff[1] = 0;
-  _cmd_buff[2] = freq_kHz >> 8;
-  _cmd_buff[3] = freq_kHz;
-  _send_command(4);
-
-  // Wait for Seek/Tune Complete (STC) bit to be set:
-  while ((_get_status() & 0x81) != 0x81)
-    yield();
+  _mark();
+  _send_command(encode_tune(_cmd_buff, CMD_TX_TUNE_FREQ, freq_kHz));
+  _wait_stc();
+  _measure(&tune_us, &tune_bus_us);
 }
 
 void Si47xx::set_tx_power(unsigned int pwr, unsigned int antcap) {
-  _cmd_buff[0] = CMD_TX_TUNE_POWER;
-  _cmd_buff[1] = 0;
-  _cmd_buff[2] = 0;
-  _cmd_buff[3] = pwr;
-  _cmd_buff[4] = antcap;
-  _send_command(5);
-
-  // Wait for Seek/Tune Complete (STC) bit to be set:
-  while ((_get_status() & 0x81) != 0x81)
-    yield();
+  _send_command(encode_power(_cmd_buff, pwr, antcap));
+  _wait_stc();
 }
 
 void Si47xx::read_asq_status(void) {
   _cmd_buff[0] = CMD_TX_ASQ_STATUS;
   _cmd_buff[1] = 0x1;
-  _send_command(2);
-
-  _request_bytes(5);
-  Wire.read();
-  CurrASQ = Wire.read();
-  Wire.read();
-  Wire.read();
-  CurrInLevel = (int8_t) Wire.read();
+  if(!_send_command(2, 4))
+    return;
+
+  CurrASQ = _resp_buff[1];
+  CurrInLevel = (int8_t) _resp_buff[4];
 }
 
 void Si47xx::read_tune_status(void) {
   _cmd_buff[0] = CMD_TX_TUNE_STATUS;
   _cmd_buff[1] = 0x1;
-  _send_command(2);
-
-  _request_bytes(8);
+  if(!_send_command(2, 7))
+    return;
 
-  Wire.read();
-  Wire.read();
-  CurrFreq = Wire.read();
+  CurrFreq = _resp_buff[2];
   CurrFreq <<= 8;
-  CurrFreq |= Wire.read();
-  Wire.read();
-  CurrdBuV = Wire.read();
-  CurrAntCap = Wire.read();
-  CurrNoiseLevel = Wire.read();
+  CurrFreq |= _resp_buff[3];
+  CurrdBuV = _resp_buff[5];
+  CurrAntCap = _resp_buff[6];
+  CurrNoiseLevel = _resp_buff[7];
 }
 
 void Si47xx::read_tune_measure(unsigned int freq_kHz) {
-  freq_kHz /= 10; // Convert to 10kHz
-  // Force freq to be a multiple of 50kHz:
-  if (freq_kHz % 5 != 0)
-    freq_kHz -= (freq_kHz % 5);
-
-  _cmd_buff[0] = CMD_TX_TUNE_MEASURE;
-  _cmd_buff[1] = 0;
-  _cmd_buff[2] = freq_kHz >> 8;
-  _cmd_buff[3] = freq_kHz;
-  _cmd_buff[4] = 0;
-  _send_command(5);
-
-  while (_get_status() != 0x81)
-    yield();
+  _send_command(encode_tune(_cmd_buff, CMD_TX_TUNE_MEASURE, freq_kHz));
+  _wait_stc();
 }
 
 void Si47xx::begin_rds(unsigned int programID) {
-  _set_property(PROP_TX_AUDIO_DEVIATION, 6625); // 66.25KHz (default is 68.25)
-  _set_property(PROP_TX_RDS_DEVIATION, 200);    // 2KHz (default)
-  _set_property(PROP_TX_RDS_INTERRUPT_SOURCE, 0x0001); // RDS IRQ
-  _set_property(PROP_TX_RDS_PI, programID);
-  _set_property(PROP_TX_RDS_PS_MIX, 0x03);       // 50% mix (default)
-  _set_property(PROP_TX_RDS_PS_MISC, 0x1AC8);    // RDSD0 & RDSMS (default)
-  _set_property(PROP_TX_RDS_PS_REPEAT_COUNT, 3); // 3 repeats (default)
-  _set_property(PROP_TX_RDS_MESSAGE_COUNT, 1);
-  _set_property(PROP_TX_RDS_PS_AF, 0xE0E0); // no AF
-  _set_property(PROP_TX_RDS_FIFO_SIZE, 0);
-  _set_property(PROP_TX_COMPONENT_ENABLE, 0x0007); // Enable RDS
+  for (unsigned int i = 0; i < SI47XX_RDS_PROPS; i++) {
+    unsigned int p = si47xx_rds_props[i][0];
+    _set_property(p, (p == PROP_TX_RDS_PI) ? programID : si47xx_rds_props[i][1]);
+  }
 }
 
 void Si47xx::set_rds_station(const char *s) {
   unsigned int slots = (strlen(s) + 3) / 4;
 
-  for (unsigned int i = 0; i < slots; i++) {
-    memset(_cmd_buff, ' ', 6);
-    memcpy(_cmd_buff + 2, s, min(4, (int)strlen(s)));
-    s += 4;
-    _cmd_buff[6] = 0;
-    _cmd_buff[0] = CMD_TX_RDS_PS;
-    _cmd_buff[1] = i; // slot number
-    _send_command(6);
-  }
+  _mark();
+  for (unsigned int i = 0; i < slots; i++, s += 4)
+    _send_command(encode_rds_ps(_cmd_buff, i, s));
+  _measure(&rds_us, &rds_bus_us);
 }
 
 void Si47xx::set_rds_buffer(const char *s) {
   unsigned int slots = (strlen(s) + 3) / 4;
 
-  for (unsigned int i = 0; i < slots; i++) {
-    memset(_cmd_buff, ' ', 8);
-    memcpy(_cmd_buff + 4, s, min(4, (int)strlen(s)));
-    s += 4;
-    _cmd_buff[8] = 0;
-    _cmd_buff[0] = CMD_TX_RDS_BUFF;
-    if (i == 0)
-      _cmd_buff[1] = 0x06;
-    else
-      _cmd_buff[1] = 0x04;
-
-    _cmd_buff[2] = 0x20;
-    _cmd_buff[3] = i;
-    _send_command(8);
-  }
+  for (unsigned int i = 0; i < slots; i++, s += 4)
+    _send_command(encode_rds_buffer(_cmd_buff, i, s));
   // _set_property(PROP_TX_COMPONENT_ENABLE, 0x0007); // stereo, pilot+rds
 }
+
+/*
+  non-blocking interface
+*/
+
+void Si47xx::begin_async(unsigned int freq_kHz, unsigned int pwr, unsigned int programID, const char *ps) {
+  _async_freq = freq_kHz;
+  _async_pwr = pwr;
+  _async_pi = programID;
+  for (unsigned int i = 0; i < SI47XX_PS_SIZE; i++)
+    _async_ps[i] = *ps ? *ps++ : ' ';
+
+  _step = STEP_RESET;
+  _sub = 0;
+  _pending = false;
+  _step_ms = millis();
+}
+
+unsigned int Si47xx::step(void) {
+  if(_step == STEP_DONE)
+    return SI47XX_DONE;
+  if(_step == STEP_FAILED)
+    return SI47XX_ERROR;
+
+  if(_pending) {
+    // most commands answer CTS with the issuing transfer, poll the rest once a ms
+    if(!(_resp_buff[0] & SI4710_STATUS_CTS) && millis() - _poll_ms < SI47XX_STEP_AWAIT)
+      return SI47XX_BUSY;
+    _poll_ms = millis();
+
+    if(!_poll()) {
+      if(millis() - _step_ms >= SI47XX_MAX_AWAIT) {
+        DLOG_W("Command %x on %02x timed out", _cmd_buff[0], _addr);
+        timeouts++;
+        _step = STEP_FAILED;
+        return SI47XX_ERROR;
+      }
+      return SI47XX_BUSY;
+    }
+    _pending = false;
+
+    // results of the finished command
+    switch(_step) {
+      case STEP_POWER_UP:
+        _step = STEP_GET_REV;
+        break;
+      case STEP_GET_REV:
+        _step = _check_rev() ? STEP_PROPS : STEP_FAILED;
+        break;
+      case STEP_PROPS:
+        if(++_sub >= SI47XX_PROPS) { _step = STEP_TUNE; _sub = 0; }
+        break;
+      case STEP_TUNE:
+        _step = STEP_TUNE_STC;
+        break;
+      case STEP_POWER:
+        _step = STEP_POWER_STC;
+        break;
+      case STEP_TUNE_STC:
+      case STEP_POWER_STC:
+        if((_resp_buff[0] & 0x81) == 0x81) {
+          if(_step == STEP_TUNE_STC)
+            _measure(&tune_us, &tune_bus_us);
+          _step = (_step == STEP_TUNE_STC) ? STEP_POWER : STEP_RDS_PROPS;
+        } else if(millis() - _step_ms >= SI47XX_MAX_AWAIT) {
+          DLOG_W("STC wait on %02x timed out", _addr);
+          timeouts++;
+          _step = STEP_FAILED;
+        }
+        break;
+      case STEP_RDS_PROPS:
+        if(++_sub >= SI47XX_RDS_PROPS) { _step = STEP_RDS_PS; _sub = 0; }
+        break;
+      case STEP_RDS_PS:
+        if(++_sub >= SI47XX_PS_SIZE / 4) {
+          _measure(&rds_us, &rds_bus_us);
+          _step = STEP_DONE;
+        }
+        break;
+    }
+    if(_step == STEP_DONE)
+      return SI47XX_DONE;
+    if(_step == STEP_FAILED)
+      return SI47XX_ERROR;
+    return SI47XX_BUSY;
+  }
+
+  unsigned int len = 0;
+  unsigned int resp_len = 0;
+
+  switch(_step) {
+    case STEP_RESET:
+      if(_reset_pin >= 0) {
+        pinMode(_reset_pin, OUTPUT);
+        digitalWrite(_reset_pin, LOW);
+      }
+      _step = STEP_RESET_WAIT;
+      _step_ms = millis();
+      return SI47XX_BUSY;
+
+    case STEP_RESET_WAIT:
+      // hold reset 10 ms, then let the chip come up
+      if(_sub == 0 && _reset_pin >= 0) {
+        if(millis() - _step_ms < 10)
+          return SI47XX_BUSY;
+        digitalWrite(_reset_pin, HIGH);
+        _step_ms = millis();
+        _sub = 1;
+        return SI47XX_BUSY;
+      }
+      if(_reset_pin >= 0 && millis() - _step_ms < SI47XX_POWER_UP_MS)
+        return SI47XX_BUSY;
+
+      _sub = 0;
+      _bus->begin();
+      _cmd_buff[0] = CMD_POWER_UP;
+      _cmd_buff[1] = 0x12; // Crystal osc enabled
+      _cmd_buff[2] = 0x50; // Analog input mode
+      len = 3;
+      _step = STEP_POWER_UP;
+      break;
+
+    case STEP_GET_REV:
+      _cmd_buff[0] = CMD_GET_REV;
+      _cmd_buff[1] = 0;
+      len = 1;
+      resp_len = 8;
+      break;
+
+    case STEP_PROPS:
+      len = encode_property(_cmd_buff, si47xx_props[_sub][0], si47xx_props[_sub][1]);
+      break;
+
+    case STEP_TUNE:
+      _mark();
+      len = encode_tune(_cmd_buff, CMD_TX_TUNE_FREQ, _async_freq);
+      break;
+
+    case STEP_POWER:
+      len = encode_power(_cmd_buff, _async_pwr, 0);
+      break;
+
+    case STEP_TUNE_STC:
+    case STEP_POWER_STC:
+      // don't hammer the bus while the chip is tuning
+      if(millis() - _poll_ms < SI47XX_STEP_AWAIT)
+        return SI47XX_BUSY;
+      _poll_ms = millis();
+      _cmd_buff[0] = CMD_GET_INT_STATUS;
+      len = 1;
+      break;
+
+    case STEP_RDS_PROPS: {
+      unsigned int p = si47xx_rds_props[_sub][0];
+      len = encode_property(_cmd_buff, p, (p == PROP_TX_RDS_PI) ? _async_pi : si47xx_rds_props[_sub][1]);
+      break;
+    }
+
+    case STEP_RDS_PS:
+      if(_sub == 0)
+        _mark();
+      len = encode_rds_ps(_cmd_buff, _sub, _async_ps + _sub * 4);
+      break;
+  }
+
+  _pending = true;
+  _pending_resp = resp_len;
+  // STC polls keep the tune command start for their timeout
+  if(_step != STEP_TUNE_STC && _step != STEP_POWER_STC)
+    _step_ms = millis();
+
+  _issue(len, resp_len);
+  return SI47XX_BUSY;
+}
+
+bool Si47xx::start_asq_status(void) {
+  if(_op != OP_NONE)
+    return false;
+
+  _cmd_buff[0] = CMD_TX_ASQ_STATUS;
+  _cmd_buff[1] = 0x1;
+  _op = OP_ASQ;
+  _pending_resp = 4;
+  _step_ms = _poll_ms = millis();
+  _issue(2, 4);
+  return true;
+}
+
+bool Si47xx::start_property(unsigned int property, unsigned int value) {
+  if(_op != OP_NONE)
+    return false;
+
+  if(has_property(property, value)) {
+    props_skipped++;
+    return false;
+  }
+
+  _op = OP_PROPERTY;
+  _pending_resp = 0;
+  _step_ms = _poll_ms = millis();
+  _issue(encode_property(_cmd_buff, property, value), 0);
+  // cached as sent, a timed out write spoils the entry so it goes out again
+  _cache_property(property, value);
+  return true;
+}
+
+bool Si47xx::done(void) {
+  if(_op == OP_NONE)
+    return true;
+
+  if(!(_resp_buff[0] & SI4710_STATUS_CTS) && millis() - _poll_ms < SI47XX_STEP_AWAIT)
+    return false;
+  _poll_ms = millis();
+
+  if(!_poll()) {
+    if(millis() - _step_ms < SI47XX_MAX_AWAIT)
+      return false;
+
+    DLOG_W("Command %x on %02x timed out", _cmd_buff[0], _addr);
+    timeouts++;
+    if(_op == OP_PROPERTY)
+      _cache_property((_cmd_buff[2] << 8) | _cmd_buff[3], ~((_cmd_buff[4] << 8) | _cmd_buff[5]));
+    _op = OP_NONE;
+    return true;
+  }
+
+  if(_op == OP_ASQ) {
+    CurrASQ = _resp_buff[1];
+    CurrInLevel = (int8_t) _resp_buff[4];
+  }
+  _op = OP_NONE;
+  return true;
+}
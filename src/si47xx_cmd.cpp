@@ -0,0 +1,59 @@
+/*
+  Si47xx command encoders, apart from the driver so they build without
+  a bus for the host bench, see test/bench/host.cpp.
+*/
+
+#include "si47xx.h"
+#include "si47xx_cmd.h"
+
+unsigned int Si47xx::encode_property(uint8_t *buf, unsigned int property, unsigned int value) {
+  buf[0] = CMD_SET_PROPERTY;
+  buf[1] = 0;
+  buf[2] = property >> 8;
+  buf[3] = property & 0xFF;
+  buf[4] = value >> 8;
+  buf[5] = value & 0xFF;
+  return 6;
+}
+
+unsigned int Si47xx::encode_tune(uint8_t *buf, unsigned int cmd, unsigned int freq_kHz) {
+  freq_kHz /= 10; // Convert to 10kHz
+
+  // Force freq to be a multiple of 50kHz:
+  if (freq_kHz % 5 != 0)
+    freq_kHz -= (freq_kHz % 5);
+
+  buf[0] = cmd;
+  buf[1] = 0;
+  buf[2] = freq_kHz >> 8;
+  buf[3] = freq_kHz;
+  buf[4] = 0; // antcap for TX_TUNE_MEASURE
+  return (cmd == CMD_TX_TUNE_MEASURE) ? 5 : 4;
+}
+
+unsigned int Si47xx::encode_power(uint8_t *buf, unsigned int pwr, unsigned int antcap) {
+  buf[0] = CMD_TX_TUNE_POWER;
+  buf[1] = 0;
+  buf[2] = 0;
+  buf[3] = pwr;
+  buf[4] = antcap;
+  return 5;
+}
+
+unsigned int Si47xx::encode_rds_ps(uint8_t *buf, unsigned int slot, const char *s) {
+  buf[0] = CMD_TX_RDS_PS;
+  buf[1] = slot;
+  for (unsigned int i = 0; i < 4; i++)
+    buf[2 + i] = *s ? *s++ : ' ';
+  return 6;
+}
+
+unsigned int Si47xx::encode_rds_buffer(uint8_t *buf, unsigned int slot, const char *s) {
+  buf[0] = CMD_TX_RDS_BUFF;
+  buf[1] = (slot == 0) ? 0x06 : 0x04;
+  buf[2] = 0x20;
+  buf[3] = slot;
+  for (unsigned int i = 0; i < 4; i++)
+    buf[4 + i] = *s ? *s++ : ' ';
+  return 8;
+}
@@ -0,0 +1,421 @@
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/error.h"
+
+#include "config.h"
+#include "dlog.h"
+#include "mem.h"
+#include "tls.h"
+
+typedef struct
+{
+    fstr<TLS_HOST_SIZE> host;
+    uint16_t port;
+    bool valid;
+    unsigned long used_ms;
+    mbedtls_ssl_session session;
+} tls_session;
+
+static mbedtls_entropy_context g_entropy;
+static mbedtls_ctr_drbg_context g_drbg;
+static mbedtls_x509_crt g_ca;
+static mbedtls_ssl_config g_conf;
+static bool g_ready = false;
+static unsigned int g_ca_count = 0;
+
+static tls_session g_sessions[TLS_SESSIONS];
+static tls_stats g_stats;
+
+static void tls_log_error(const char *what, const char *host, int ret)
+{
+    char buf[64];
+
+    mbedtls_strerror(ret, buf, sizeof(buf));
+    DLOG_W("TLS %s %s - -0x%04x %s", what, host, -ret, buf);
+}
+
+static tls_session *tls_session_find(const char *host, uint16_t port)
+{
+    for(unsigned int i = 0; i < TLS_SESSIONS; i++) {
+        tls_session *s = &g_sessions[i];
+        if(s->valid && s->port == port && s->host == host) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static tls_session *tls_session_slot(const char *host, uint16_t port)
+{
+    tls_session *s = tls_session_find(host, port);
+
+    if(s) {
+        return s;
+    }
+
+    s = &g_sessions[0];
+    for(unsigned int i = 0; i < TLS_SESSIONS; i++) {
+        if(!g_sessions[i].valid) {
+            s = &g_sessions[i];
+            break;
+        }
+        if(g_sessions[i].used_ms < s->used_ms) {
+            s = &g_sessions[i];
+        }
+    }
+    return s;
+}
+
+static void tls_account(tls_handshake_stats *h, uint32_t ms, uint32_t heap)
+{
+    h->count++;
+    h->last_ms = ms;
+    h->total_ms += ms;
+    h->last_heap = heap;
+    if(heap > h->max_heap) {
+        h->max_heap = heap;
+    }
+}
+
+/*
+    TlsClient
+*/
+
+void TlsClient::_sample_heap()
+{
+    uint32_t free = ESP.getFreeHeap();
+
+    if(free < _heap_min) {
+        _heap_min = free;
+    }
+}
+
+int TlsClient::_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    TlsClient *t = (TlsClient *) ctx;
+
+    t->_sample_heap();
+    size_t n = t->_tcp->write(buf, len);
+    return n ? (int) n : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+int TlsClient::_recv(void *ctx, unsigned char *buf, size_t len)
+{
+    TlsClient *t = (TlsClient *) ctx;
+
+    t->_sample_heap();
+    int avail = t->_tcp->available();
+    if(avail <= 0) {
+        return t->_tcp->connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_SSL_CONN_EOF;
+    }
+
+    int n = t->_tcp->read(buf, min(len, (size_t) avail));
+    return (n > 0) ? n : MBEDTLS_ERR_SSL_WANT_READ;
+}
+
+bool TlsClient::begin(WiFiClient *tcp, const char *host, uint16_t port)
+{
+    _free();
+    _tcp = tcp;
+
+    if(!g_ready) {
+        DLOG_W("No CA bundle in " TLS_CA_FILE ", can't verify %s", host);
+        return false;
+    }
+
+    _heap_before = _heap_min = ESP.getFreeHeap();
+
+    mbedtls_ssl_init(&_ssl);
+    _setup = true;
+
+    int ret = mbedtls_ssl_setup(&_ssl, &g_conf);
+    if(!ret) {
+        ret = mbedtls_ssl_set_hostname(&_ssl, host);
+    }
+    if(ret) {
+        tls_log_error("setup", host, ret);
+        g_stats.failed++;
+        return false;
+    }
+
+    tls_session *cached = tls_session_find(host, port);
+    if(cached && mbedtls_ssl_set_session(&_ssl, &cached->session) == 0) {
+        g_stats.offered++;
+    } else {
+        cached = NULL;
+    }
+
+    mbedtls_ssl_set_bio(&_ssl, this, _send, _recv, NULL);
+
+    unsigned long start_ms = millis();
+    while((ret = mbedtls_ssl_handshake(&_ssl)) != 0) {
+        if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            tls_log_error("handshake", host, ret);
+            g_stats.failed++;
+            if(cached) {
+                // don't offer it again, it may be what the server choked on
+                mbedtls_ssl_session_free(&cached->session);
+                cached->valid = false;
+            }
+            return false;
+        }
+        if(millis() - start_ms >= TLS_HANDSHAKE_TIMEOUT_MS) {
+            DLOG_W("TLS handshake timeout %s", host);
+            g_stats.failed++;
+            return false;
+        }
+        delay(1);
+    }
+    _sample_heap();
+
+    uint32_t ms = millis() - start_ms;
+    mbedtls_ssl_session now;
+    mbedtls_ssl_session_init(&now);
+    mbedtls_ssl_get_session(&_ssl, &now);
+
+    // only a resumed session keeps the master secret, IDs may be echoed with tickets either way
+    _resumed = cached && memcmp(now.master, cached->session.master, sizeof(now.master)) == 0;
+    tls_account(_resumed ? &g_stats.resumed : &g_stats.full, ms, heap_peak());
+
+    tls_session *s = tls_session_slot(host, port);
+    if(s->valid) {
+        mbedtls_ssl_session_free(&s->session);
+    }
+    s->host.set(host);
+    s->port = port;
+    s->session = now;
+    s->valid = true;
+    s->used_ms = millis();
+
+    DLOG_I("TLS %s %s %s in %u ms, %u bytes heap", _resumed ? "resumed" : "full handshake", host,
+        mbedtls_ssl_get_ciphersuite(&_ssl), ms, heap_peak());
+
+    _open = true;
+    return true;
+}
+
+int TlsClient::connect(const char *host, uint16_t port)
+{
+    if(!_own.connect(host, port, TLS_HANDSHAKE_TIMEOUT_MS)) {
+        return 0;
+    }
+    return begin(&_own, host, port);
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port)
+{
+    if(!_own.connect(ip, port, TLS_HANDSHAKE_TIMEOUT_MS)) {
+        return 0;
+    }
+    return begin(&_own, ip.toString().c_str(), port);
+}
+
+size_t TlsClient::write(uint8_t b)
+{
+    return write(&b, 1);
+}
+
+size_t TlsClient::write(const uint8_t *buf, size_t size)
+{
+    size_t done = 0;
+    unsigned long start_ms = millis();
+
+    while(_open && done < size) {
+        int ret = mbedtls_ssl_write(&_ssl, buf + done, size - done);
+
+        if(ret > 0) {
+            done += ret;
+        } else if((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+            || millis() - start_ms >= TLS_WRITE_TIMEOUT_MS) {
+            _open = false;
+        } else {
+            delay(1);
+        }
+    }
+    return done;
+}
+
+int TlsClient::available()
+{
+    if(!_open) {
+        return (_peek >= 0) ? 1 : 0;
+    }
+
+    // pulls in and decrypts the next record, if there is one
+    int ret = mbedtls_ssl_read(&_ssl, NULL, 0);
+    if(ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        _open = false;
+    }
+    return mbedtls_ssl_get_bytes_avail(&_ssl) + ((_peek >= 0) ? 1 : 0);
+}
+
+int TlsClient::read()
+{
+    uint8_t b;
+    return (read(&b, 1) == 1) ? b : -1;
+}
+
+int TlsClient::read(uint8_t *buf, size_t size)
+{
+    int n = 0;
+
+    if(!size) {
+        return 0;
+    }
+    if(_peek >= 0) {
+        buf[n++] = _peek;
+        _peek = -1;
+        if(size == 1 || !mbedtls_ssl_get_bytes_avail(&_ssl)) {
+            return n;
+        }
+    }
+    if(!_setup) {
+        return n ? n : -1;
+    }
+
+    int ret = mbedtls_ssl_read(&_ssl, buf + n, size - n);
+    if(ret > 0) {
+        return n + ret;
+    }
+    if(ret == 0 || (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)) {
+        // close notify or a broken record - either way the stream is over
+        _open = false;
+    }
+    return n ? n : -1;
+}
+
+int TlsClient::peek()
+{
+    if(_peek < 0 && available()) {
+        _peek = read();
+    }
+    return _peek;
+}
+
+uint8_t TlsClient::connected()
+{
+    if(_peek >= 0 || (_setup && mbedtls_ssl_get_bytes_avail(&_ssl))) {
+        return 1;
+    }
+    return _open && _tcp && _tcp->connected();
+}
+
+void TlsClient::_free()
+{
+    if(_setup) {
+        mbedtls_ssl_free(&_ssl);
+    }
+    _setup = false;
+    _open = false;
+    _resumed = false;
+    _peek = -1;
+}
+
+void TlsClient::stop()
+{
+    if(_open) {
+        mbedtls_ssl_close_notify(&_ssl);
+    }
+    _free();
+    if(_tcp) {
+        _tcp->stop();
+    }
+}
+
+/*
+    iface
+*/
+
+bool tls_init()
+{
+    File f = LOCALFS.open(TLS_CA_FILE, "r", false);
+
+    if(!f) {
+        DLOG_W("No " TLS_CA_FILE ", HTTPS disabled");
+        return false;
+    }
+
+    // PEM parsing wants the terminating zero
+    size_t size = f.size();
+    uint8_t *pem = (uint8_t *) malloc(size + 1);
+    if(!pem) {
+        DLOG_E("No memory for the CA bundle, %u bytes", size);
+        f.close();
+        return false;
+    }
+    f.read(pem, size);
+    pem[size] = 0;
+    f.close();
+
+    mbedtls_x509_crt_init(&g_ca);
+    int ret = mbedtls_x509_crt_parse(&g_ca, pem, size + 1);
+    free(pem);
+
+    if(ret < 0) {
+        tls_log_error("CA bundle", TLS_CA_FILE, ret);
+        return false;
+    }
+
+    g_ca_count = 0;
+    for(mbedtls_x509_crt *c = &g_ca; c && c->version; c = c->next) {
+        g_ca_count++;
+    }
+    if(ret > 0) {
+        DLOG_W("Skipped %d certificates in " TLS_CA_FILE, ret);
+    }
+
+    mbedtls_entropy_init(&g_entropy);
+    mbedtls_ctr_drbg_init(&g_drbg);
+    if((ret = mbedtls_ctr_drbg_seed(&g_drbg, mbedtls_entropy_func, &g_entropy, NULL, 0)) != 0) {
+        tls_log_error("seed", "", ret);
+        return false;
+    }
+
+    mbedtls_ssl_config_init(&g_conf);
+    if((ret = mbedtls_ssl_config_defaults(&g_conf, MBEDTLS_SSL_IS_CLIENT,
+        MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+        tls_log_error("config", "", ret);
+        return false;
+    }
+    mbedtls_ssl_conf_authmode(&g_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&g_conf, &g_ca, NULL);
+    mbedtls_ssl_conf_rng(&g_conf, mbedtls_ctr_drbg_random, &g_drbg);
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_conf_session_tickets(&g_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+    g_ready = true;
+    DLOG_I("TLS ready, %u CA certificates", g_ca_count);
+
+    return true;
+}
+
+bool tls_ready()
+{
+    return g_ready;
+}
+
+void tls_print_json(Print &out)
+{
+    const tls_handshake_stats *h[] = { &g_stats.full, &g_stats.resumed };
+    const char *names[] = { "full", "resumed" };
+    unsigned int sessions = 0;
+
+    for(unsigned int i = 0; i < TLS_SESSIONS; i++) {
+        sessions += g_sessions[i].valid;
+    }
+
+    out.printf("{ \"ready\": %s, \"ca\": %u, \"sessions\": %u, \"offered\": %u, \"failed\": %u",
+        g_ready ? "true" : "false", g_ca_count, sessions, g_stats.offered, g_stats.failed);
+    for(unsigned int i = 0; i < 2; i++) {
+        out.printf(", \"%s\": { \"count\": %u, \"last_ms\": %u, \"avg_ms\": %u, \"last_heap\": %u, \"max_heap\": %u }",
+            names[i], h[i]->count, h[i]->last_ms, h[i]->count ? h[i]->total_ms / h[i]->count : 0,
+            h[i]->last_heap, h[i]->max_heap);
+    }
+    out.print(" }");
+}
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "ts.h"
+
+void ts_reset(ts_demux *t)
+{
+    t->pmt_pid = TS_PID_NONE;
+    t->audio_pid = TS_PID_NONE;
+    t->carry_len = 0;
+}
+
+static void ts_psi(ts_demux *t, const uint8_t *p, int len, bool pmt)
+{
+    if(len < 1) {
+        return;
+    }
+
+    // pointer field, then the section
+    int off = 1 + p[0];
+    if(off + 3 > len) {
+        return;
+    }
+    const uint8_t *s = p + off;
+    int section_len = ((s[1] & 0x0F) << 8) | s[2];
+    int end = min(len - off, 3 + section_len - 4); // without CRC
+
+    if(!pmt) {
+        for(int i = 8; i + 4 <= end; i += 4) {
+            uint16_t program = (s[i] << 8) | s[i + 1];
+            if(program) {
+                t->pmt_pid = ((s[i + 2] & 0x1F) << 8) | s[i + 3];
+                return;
+            }
+        }
+        return;
+    }
+
+    if(end < 12) {
+        return;
+    }
+    int i = 12 + (((s[10] & 0x0F) << 8) | s[11]);
+    for(; i + 5 <= end; i += 5 + (((s[i + 3] & 0x0F) << 8) | s[i + 4])) {
+        uint8_t type = s[i];
+        uint16_t pid = ((s[i + 1] & 0x1F) << 8) | s[i + 2];
+
+        // ADTS AAC, MPEG-1/2 audio - what the VS1053 decodes
+        if(type == 0x0F || type == 0x03 || type == 0x04) {
+            if(t->audio_pid != pid) {
+                DLOG_I("HLS audio PID %u, type %02x", pid, type);
+            }
+            t->audio_pid = pid;
+            return;
+        }
+    }
+}
+
+// audio payload of one packet, 0 if the packet carries none
+static int ts_payload(ts_demux *t, const uint8_t *pkt, const uint8_t **payload)
+{
+    bool pusi = pkt[1] & 0x40;
+    uint16_t pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+    uint8_t afc = (pkt[3] >> 4) & 0x03;
+    int off = 4;
+
+    if(!(afc & 0x01)) {
+        return 0;
+    }
+    if(afc & 0x02) {
+        off += 1 + pkt[4];
+    }
+    if(off >= TS_PACKET) {
+        return 0;
+    }
+
+    const uint8_t *p = pkt + off;
+    int len = TS_PACKET - off;
+
+    if(pid == TS_PID_PAT && pusi) {
+        ts_psi(t, p, len, false);
+        return 0;
+    }
+    if(pid == t->pmt_pid && pusi) {
+        ts_psi(t, p, len, true);
+        return 0;
+    }
+    if(pid != t->audio_pid) {
+        return 0;
+    }
+
+    if(pusi) {
+        // PES header: start code, stream id, length, flags, header length
+        if(len < 9 || p[0] != 0 || p[1] != 0 || p[2] != 1) {
+            return 0;
+        }
+        int hdr = 9 + p[8];
+        if(hdr >= len) {
+            return 0;
+        }
+        p += hdr;
+        len -= hdr;
+    }
+
+    *payload = p;
+    return len;
+}
+
+// demux whole packets of data in place, a partial one is kept in carry
+uint32_t ts_inplace(ts_demux *t, uint8_t *data, uint32_t len)
+{
+    uint32_t r = 0;
+    uint32_t w = 0;
+
+    while(len - r >= TS_PACKET) {
+        if(data[r] != TS_SYNC) {
+            r++;
+            continue;
+        }
+
+        const uint8_t *p;
+        int n = ts_payload(t, data + r, &p);
+        if(n > 0) {
+            memmove(data + w, p, n);
+            w += n;
+        }
+        r += TS_PACKET;
+    }
+
+    t->carry_len = len - r;
+    memcpy(t->carry, data + r, t->carry_len);
+    return w;
+}
+
+// feed bytes through carry, payloads are copied to the ring
+uint32_t ts_copy(ts_demux *t, const uint8_t *data, uint32_t len, audio_ring *ring)
+{
+    uint32_t used = 0;
+
+    while(used < len && ring_free(ring) >= TS_PACKET) {
+        uint32_t n = min(len - used, (uint32_t) (TS_PACKET - t->carry_len));
+
+        memcpy(t->carry + t->carry_len, data + used, n);
+        t->carry_len += n;
+        used += n;
+
+        if(t->carry_len < TS_PACKET) {
+            break;
+        }
+        if(t->carry[0] != TS_SYNC) {
+            // resync on the next 0x47
+            uint8_t *sync = (uint8_t *) memchr(t->carry + 1, TS_SYNC, TS_PACKET - 1);
+            t->carry_len = sync ? TS_PACKET - (sync - t->carry) : 0;
+            memmove(t->carry, sync, t->carry_len);
+            continue;
+        }
+
+        const uint8_t *p;
+        int pn = ts_payload(t, t->carry, &p);
+        if(pn > 0) {
+            ring_push(ring, p, pn);
+        }
+        t->carry_len = 0;
+    }
+    return used;
+}
\ No newline at end of file
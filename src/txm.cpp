@@ -0,0 +1,145 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "txm.h"
+
+static txm_unit g_units[TXM_MAX];
+static unsigned int g_count = 0;
+static uint32_t g_started_ms = 0;
+static uint32_t g_all_ready_ms = 0;
+
+static const char *txm_state_names[] = { "idle", "init", "ready", "failed" };
+
+/*
+    devices
+*/
+
+void txm_init(const txm_config *cfg, unsigned int count, const char *ps)
+{
+    g_count = min(count, (unsigned int) TXM_MAX);
+    g_started_ms = millis();
+    g_all_ready_ms = 0;
+
+    for(unsigned int i = 0; i < g_count; i++) {
+        txm_unit *u = &g_units[i];
+
+        u->chip = Si47xx(cfg[i].bus, cfg[i].addr, cfg[i].reset_pin, cfg[i].mux_channel);
+        u->freq = cfg[i].freq;
+        u->state = TXM_STATE_INIT;
+        u->started_ms = g_started_ms;
+        u->init_ms = 0;
+        u->chip.begin_async(cfg[i].freq, cfg[i].power, TXM_PI, ps);
+    }
+
+    DLOG_I("Starting %u transmitter(s)", g_count);
+}
+
+void txm_handle()
+{
+    unsigned int pending = 0;
+
+    for(unsigned int i = 0; i < g_count; i++) {
+        txm_unit *u = &g_units[i];
+
+        if(u->state != TXM_STATE_INIT) {
+            continue;
+        }
+
+        unsigned int r = u->chip.step();
+        if(r == SI47XX_DONE) {
+            u->state = TXM_STATE_READY;
+            u->init_ms = millis() - u->started_ms;
+            DLOG_I("Transmitter %u (%02x) on %u kHz ready in %u ms", i, u->chip.addr(), u->freq, u->init_ms);
+            DLOG_I("Transmitter %u tune %u us (bus %u us), RDS PS %u us (bus %u us)", i, u->chip.tune_us,
+                u->chip.tune_bus_us, u->chip.rds_us, u->chip.rds_bus_us);
+        } else if(r == SI47XX_ERROR) {
+            u->state = TXM_STATE_FAILED;
+            DLOG_E("Can't start transmitter %u (%02x)", i, u->chip.addr());
+        } else {
+            pending++;
+        }
+    }
+
+    if(g_count && !pending && !g_all_ready_ms) {
+        g_all_ready_ms = millis() - g_started_ms;
+        DLOG_I("Transmitters up in %u ms", g_all_ready_ms);
+    }
+}
+
+unsigned int txm_count()
+{
+    return g_count;
+}
+
+bool txm_ready(unsigned int i)
+{
+    return i < g_count && g_units[i].state == TXM_STATE_READY;
+}
+
+bool txm_any_ready()
+{
+    for(unsigned int i = 0; i < g_count; i++) {
+        if(g_units[i].state == TXM_STATE_READY) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Si47xx *txm_chip(unsigned int i)
+{
+    return (i < g_count) ? &g_units[i].chip : NULL;
+}
+
+void txm_set_rds_station(const char *ps)
+{
+    for(unsigned int i = 0; i < g_count; i++) {
+        if(g_units[i].state == TXM_STATE_READY) {
+            g_units[i].chip.set_rds_station(ps);
+        }
+    }
+}
+
+/*
+    web
+*/
+
+void txm_print_json(Print &out)
+{
+    uint32_t elapsed_ms = millis() - g_started_ms;
+
+    out.printf("{ \"result\": \"ok\", \"all_ready_ms\": %u, \"units\": [", g_all_ready_ms);
+
+    for(unsigned int i = 0; i < g_count; i++) {
+        txm_unit *u = &g_units[i];
+
+        out.printf("%s{ \"addr\": %u, \"mux\": %d, \"state\": \"%s\", \"freq\": %u, \"init_ms\": %u, \"commands\": %u, \"timeouts\": %u",
+            i ? ", " : "", u->chip.addr(), u->chip.mux_channel(), txm_state_names[u->state],
+            u->freq, u->init_ms, u->chip.commands, u->chip.timeouts);
+        out.printf(", \"bus_us\": %u, \"tune_us\": %u, \"tune_bus_us\": %u, \"rds_us\": %u, \"rds_bus_us\": %u }",
+            u->chip.bus_us, u->chip.tune_us, u->chip.tune_bus_us, u->chip.rds_us, u->chip.rds_bus_us);
+    }
+    out.print("], \"buses\": [");
+
+    // each bus once, with its share of the time since start
+    bool first = true;
+    for(unsigned int i = 0; i < g_count; i++) {
+        I2cBus *bus = &g_units[i].chip.bus();
+        bool seen = false;
+
+        for(unsigned int k = 0; k < i && !seen; k++) {
+            seen = (&g_units[k].chip.bus() == bus);
+        }
+        if(seen) {
+            continue;
+        }
+
+        out.printf("%s{ \"occupancy_pct\": %u, \"stats\": ", first ? "" : ", ",
+            elapsed_ms ? (unsigned int) ((uint64_t) bus->stats.bus_us / 10 / elapsed_ms) : 0);
+        bus->print_stats_json(out);
+        out.print(" }");
+        first = false;
+    }
+    out.print("] }");
+}
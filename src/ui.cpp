@@ -0,0 +1,168 @@
+#include <Arduino.h>
+
+#include "config.h"
+#include "dlog.h"
+#include "ui.h"
+
+#define UI_LINE_SIZE 96
+#define UI_PATH_SIZE (sizeof(UI_DIR) + UI_NAME_SIZE + 4)
+
+static ui_file g_files[UI_MAX_FILES];
+static unsigned int g_count = 0;
+static ui_stats g_stats;
+
+static const char *ui_content_type(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+
+    if(!ext) {
+        return "application/octet-stream";
+    }
+    if(!strcmp(ext, ".html")) return "text/html";
+    if(!strcmp(ext, ".js")) return "application/javascript";
+    if(!strcmp(ext, ".css")) return "text/css";
+    if(!strcmp(ext, ".svg")) return "image/svg+xml";
+    if(!strcmp(ext, ".json")) return "application/json";
+    if(!strcmp(ext, ".ico")) return "image/x-icon";
+    return "application/octet-stream";
+}
+
+static const ui_file *ui_find(const char *name)
+{
+    for(unsigned int i = 0; i < g_count; i++) {
+        if(g_files[i].name == name) {
+            return &g_files[i];
+        }
+    }
+    return NULL;
+}
+
+static bool ui_accepts_gzip(AsyncWebServerRequest *request)
+{
+    if(!request->hasHeader("Accept-Encoding")) {
+        return false;
+    }
+
+    // q-values are not looked at, nobody sends gzip;q=0
+    const char *v = request->getHeader("Accept-Encoding")->value().c_str();
+    return strstr(v, "gzip") || strchr(v, '*');
+}
+
+static void ui_serve(AsyncWebServerRequest *request)
+{
+    const char *url = request->url().c_str() + strlen(UI_DIR);
+
+    // asset hrefs are relative to the directory
+    if(!*url) {
+        request->redirect(UI_DIR "/");
+        return;
+    }
+    while(*url == '/') {
+        url++;
+    }
+
+    const ui_file *f = ui_find(*url ? url : UI_ENTRY);
+    if(!f) {
+        request->send(404, "application/json", "{ \"result\": \"error\", \"explain\": \"file_not_found\" }");
+        return;
+    }
+
+    bool entry = (f->name == UI_ENTRY);
+    g_stats.requests++;
+
+    if(request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == f->etag.c_str()) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", f->etag.c_str());
+        response->addHeader("Cache-Control", entry ? UI_CACHE_ENTRY : UI_CACHE_IMMUTABLE);
+        request->send(response);
+        g_stats.not_modified++;
+        return;
+    }
+
+    // only the gzip copy is stored
+    if(!ui_accepts_gzip(request)) {
+        request->send(406, "application/json", "{ \"result\": \"error\", \"explain\": \"gzip_required\" }");
+        g_stats.not_acceptable++;
+        return;
+    }
+
+    // streamed from flash in TCP-sized chunks by the server task
+    fstr<UI_PATH_SIZE> path;
+    path.printf(UI_DIR "/%s.gz", f->name.c_str());
+
+    AsyncWebServerResponse *response = request->beginResponse(LOCALFS, path.c_str(), ui_content_type(f->name.c_str()));
+    response->addHeader("Content-Encoding", "gzip");
+    response->addHeader("Vary", "Accept-Encoding");
+    response->addHeader("ETag", f->etag.c_str());
+    response->addHeader("Cache-Control", entry ? UI_CACHE_ENTRY : UI_CACHE_IMMUTABLE);
+    request->send(response);
+
+    g_stats.bytes_sent += f->gz_size;
+    g_stats.bytes_raw += f->raw_size;
+}
+
+/*
+    web
+*/
+
+void ui_init()
+{
+    File f = LOCALFS.open(UI_MANIFEST, "r", false);
+    char line[UI_LINE_SIZE];
+
+    if(!f) {
+        DLOG_I("No web UI on the filesystem");
+        return;
+    }
+
+    while(f.available() && g_count < UI_MAX_FILES) {
+        size_t n = f.readBytesUntil('\n', line, sizeof(line) - 1);
+        char name[UI_NAME_SIZE];
+        char etag[UI_ETAG_SIZE - 2];
+        unsigned int raw_size, gz_size;
+
+        line[n] = 0;
+        if(!n || line[0] == '#') {
+            continue;
+        }
+        if(sscanf(line, "%31s %17s %u %u", name, etag, &raw_size, &gz_size) != 4) {
+            DLOG_W("Bad UI manifest line - %s", line);
+            continue;
+        }
+
+        ui_file *u = &g_files[g_count++];
+        u->name.set(name);
+        u->etag.printf("\"%s\"", etag);
+        u->raw_size = raw_size;
+        u->gz_size = gz_size;
+    }
+    f.close();
+
+    DLOG_I("Web UI has %u files", g_count);
+}
+
+void ui_web_init(AsyncWebServer *server)
+{
+    // also matches everything under /ui/
+    server->on(UI_DIR, HTTP_GET, ui_serve);
+
+    server->on("/ui_stats", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        ui_print_json(*response);
+        request->send(response);
+    });
+}
+
+void ui_print_json(Print &out)
+{
+    out.printf("{ \"result\": \"ok\", \"requests\": %u, \"not_modified\": %u, \"not_acceptable\": %u, \"bytes_sent\": %u, \"bytes_raw\": %u, \"files\": [",
+        g_stats.requests, g_stats.not_modified, g_stats.not_acceptable, g_stats.bytes_sent, g_stats.bytes_raw);
+
+    for(unsigned int i = 0; i < g_count; i++) {
+        const ui_file *f = &g_files[i];
+
+        out.printf("%s{ \"name\": \"%s\", \"raw_size\": %u, \"gz_size\": %u }",
+            i ? ", " : "", f->name.c_str(), f->raw_size, f->gz_size);
+    }
+    out.print("] }");
+}
@@ -8,21 +8,41 @@
 #include <ArduinoJson.h>
 
 #include "config.h"
+#include "dlog.h"
+#include "mem.h"
 #include "con.h"
 #include "web.h"
 #include "devices.h"
+#include "ui.h"
 
 #define ERROR_EXPLAIN(Explain) request->send(200, "application/json", "{ \"result\": \"error\", \"explain\": \"" Explain "\" }")
 
 
+/*
+    JSON replies live in pool blocks instead of the general heap
+*/
+
+struct pool_allocator {
+    void *allocate(size_t size) { 
+        return (size <= MEM_POOL_BLOCK_SIZE) ? mem_pool_alloc() : NULL; 
+    }
+    void deallocate(void *p) { 
+        mem_pool_free(p); 
+    }
+    void *reallocate(void *p, size_t size) { 
+        return (size <= MEM_POOL_BLOCK_SIZE) ? p : NULL; 
+    }
+};
+
+typedef BasicJsonDocument<pool_allocator> PoolJsonDocument;
+
+
 AsyncWebServer server(80);  
 
 void not_found(AsyncWebServerRequest *request) {
-    String method = request->methodToString();
-    String url = request->url();
     unsigned int body_size = request->contentLength();
 
-    ESP_LOGD(TAG, "Unknown request - %s %s (%d)", method.c_str(), url.c_str(), body_size);
+    DLOG_D("Unknown request - %s %s (%d)", request->methodToString(), request->url().c_str(), body_size);
     request->send(404, "application/json", "{ \"result\": \"error\", \"explain\": \"method_not_found\" }");
 }
 
@@ -32,9 +52,28 @@ void web_init()
         request->send(200, "application/json", "{ \"result\": \"ok\", \"state\": \"online\" }");
     });
 
+    server.on("/log", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("text/plain");
+        dlog_print(*response);
+        request->send(response);
+    });
+
+    server.on("/mem", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        mem_print_json(*response);
+        request->send(response);
+    });
+
     server.on("/wifi_list", HTTP_GET, [](AsyncWebServerRequest *request) {
-        String reply = get_availible_nets_json();    
-        request->send(200,  "application/json", reply);
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        print_availible_nets_json(*response);
+        request->send(response);
+    });
+
+    server.on("/wifi_status", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        print_con_status_json(*response);
+        request->send(response);
     });
 
     server.on("/wifi_reset", HTTP_GET, [](AsyncWebServerRequest *request) {
@@ -48,34 +87,36 @@ void web_init()
     });
 
     server.addHandler(new AsyncCallbackJsonWebHandler("/wifi_config", [](AsyncWebServerRequest *request, JsonVariant &income) {
+        PoolJsonDocument reply(JSON_MAX_SIZE);
+
+        // all pool blocks taken by concurrent requests
+        if(!reply.capacity()) {
+            request->send(503, "application/json", "{ \"result\": \"error\", \"explain\": \"busy\" }");
+            return;
+        }
+
         AsyncResponseStream *response = request->beginResponseStream("application/json");
-        DynamicJsonDocument reply(JSON_MAX_SIZE);
-        bool need_reboot = false;
 
-        if(income.containsKey("ssid") && income.containsKey("key") 
-            && income["ssid"].as<String>().length() > 0)
+        const char *ssid = income["ssid"];
+        const char *key = income["key"];
+
+        if(ssid && key && strlen(ssid) > 0)
         {
-            if(save_config(income["ssid"], income["key"])) {
+            // applied live, progress is at /wifi_status
+            if(con_try_config(ssid, key)) {
                 reply["result"] = "ok";
                 reply["hostname"] = get_mdns_name();
-                need_reboot = true;
+                reply["state"] = "connecting";
             } else {
                 reply["result"] = "error";
-                reply["explain"] = "config_write_error";
+                reply["explain"] = "config_in_progress";
             }
         } else {
             reply["result"] = "error";
             reply["explain"] = "params_error";
         }
         serializeJson(reply, *response);
-        
-        if(need_reboot) {
-            response->addHeader("Connection", "close");
-            request->send(response);
-            do_restart();
-        } else {
-            request->send(response);
-        }
+        request->send(response);
     }));
 
 
@@ -124,6 +165,8 @@ void web_init()
         } 
     });
 
+    ui_init();
+    ui_web_init(&server);
     devices_web_init(&server);
 
     server.onNotFound(not_found);
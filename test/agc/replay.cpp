@@ -0,0 +1,163 @@
+/*
+    Replays a recorded level trace through the loudness policy on the host:
+
+        g++ -Wall -Wextra -Iinclude src/agc_policy.cpp test/agc/replay.cpp -o test/bin/agc_replay
+        test/bin/agc_replay test/agc/steps.trace test/agc/quiet.trace test/agc/music.trace
+
+    A trace has one line per run of ASQ samples, AGC_SAMPLE_MS apart:
+
+        samples dbfs playing [settle writes]
+
+    dbfs is the programme level at full volume, the level ASQ reads is
+    that less AGC_VOLUME_STEP_DB10 per step the volume is below 100, as
+    with the VS1053 in front of the transmitter. The policy adjusts once
+    every AGC_ADJUST_MS as in agc_handle(). settle and writes cover the
+    lines since the last one that had them: settle is the most seconds in
+    the last volume or gain change may come, writes the most changes they
+    may take, and at their end the level has to be inside the deadband,
+    or the volume at a limit. Recorded traces come one sample per line
+    with the expectation on the last. A line "ceiling N" sets the
+    programme ceiling for what follows, the trace starts at 100 with the
+    volume there. Lines starting with # are comments. Exits non-zero on
+    a missed expectation.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "agc_policy.h"
+
+#define REPLAY_ADJUST_EVERY (AGC_ADJUST_MS / AGC_SAMPLE_MS)
+
+static int replay_measured(int dbfs, uint8_t volume)
+{
+    return dbfs - (100 - volume) * AGC_VOLUME_STEP_DB10 / 10;
+}
+
+static bool replay_settled(const agc_policy *p, uint8_t volume)
+{
+    int error = p->target - agc_policy_level(p);
+
+    if(error >= -AGC_DEADBAND_DB && error <= AGC_DEADBAND_DB) {
+        return true;
+    }
+    return (error > 0 && volume >= p->ceiling) || (error < 0 && volume <= AGC_VOLUME_MIN);
+}
+
+// returns the number of missed expectations, -1 if the trace can't be read
+static int replay(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+    unsigned int n = 0;
+    unsigned int total_writes = 0;
+    unsigned int span_start = 0;  // first sample the next expectation covers
+    unsigned int span_writes = 0;
+    unsigned int span_last = 0;   // sample of the last change
+    int missed = 0;
+    uint8_t volume = 100;
+    agc_policy p;
+
+    if(!f) {
+        fprintf(stderr, "%s: can't open\n", path);
+        return -1;
+    }
+
+    agc_policy_init(&p, AGC_TARGET_DBFS, 100);
+    printf("%s\n", path);
+
+    while(fgets(line, sizeof(line), f)) {
+        unsigned int samples, playing, ceiling;
+        int dbfs;
+        int settle_max = -1, writes_max = -1;
+
+        if(line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if(sscanf(line, "ceiling %u", &ceiling) == 1) {
+            p.ceiling = ceiling;
+            if(volume > ceiling) {
+                volume = ceiling;
+            }
+            continue;
+        }
+        if(sscanf(line, "%u %d %u %d %d", &samples, &dbfs, &playing, &settle_max, &writes_max) < 3) {
+            fprintf(stderr, "%s: bad line - %s", path, line);
+            fclose(f);
+            return -1;
+        }
+
+        unsigned int writes = 0;
+
+        for(unsigned int i = 1; i <= samples; i++) {
+            n++;
+            agc_policy_sample(&p, replay_measured(dbfs, volume));
+            if(n % REPLAY_ADJUST_EVERY) {
+                continue;
+            }
+
+            uint8_t from_volume = volume;
+            uint8_t from_gain = p.gain;
+
+            agc_decide(&p, &volume, playing);
+            if(volume != from_volume) {
+                writes++;
+            }
+            if(p.gain != from_gain) {
+                writes++;
+            }
+            if(volume != from_volume || p.gain != from_gain) {
+                span_last = n;
+            }
+        }
+        total_writes += writes;
+        span_writes += writes;
+
+        if(settle_max < 0 && writes_max < 0) {
+            if(samples > 1) {
+                printf("  %4u x %4d dBFS %s  level %4d  volume %3u  gain %2u  %2u writes\n",
+                    samples, dbfs, playing ? "play" : "idle", agc_policy_level(&p), volume, p.gain, writes);
+            }
+            continue;
+        }
+
+        bool settled = replay_settled(&p, volume);
+        unsigned int last_ms = (span_last > span_start) ? (span_last - span_start) * AGC_SAMPLE_MS : 0;
+
+        printf("  %4u x %4d dBFS %s  level %4d  volume %3u  gain %2u  %2u writes  settled %s at %u.%u s\n",
+            n - span_start, dbfs, playing ? "play" : "idle", agc_policy_level(&p), volume, p.gain,
+            span_writes, settled ? "yes" : "no ", last_ms / 1000, last_ms % 1000 / 100);
+
+        if(settle_max >= 0 && (!settled || last_ms > (unsigned int) settle_max * 1000)) {
+            printf("  %4u  expected settled within %d s\n", n, settle_max);
+            missed++;
+        }
+        if(writes_max >= 0 && span_writes > (unsigned int) writes_max) {
+            printf("  %4u  expected at most %d writes, %u\n", n, writes_max, span_writes);
+            missed++;
+        }
+        span_start = n;
+        span_writes = 0;
+    }
+    fclose(f);
+
+    printf("  %u samples, %u writes, %s\n", n, total_writes, missed ? "FAILED" : "ok");
+    return missed;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s trace...\n", argv[0]);
+        return 2;
+    }
+
+    for(int i = 1; i < argc; i++) {
+        if(replay(argv[i])) {
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+export $(grep -v '^#' .env | xargs -d '\n')
+curl -X GET  http://esp32-$MAC_ADDR.local/audio | jq
@@ -0,0 +1,46 @@
+#!/bin/bash
+# target: needs the bench build, pio run -e lolin_s3_mini_bench -t upload, and .env
+# bench.sh                run and compare against test/bench_baseline.json
+# bench.sh --save         run and store the result as the baseline
+# host: the portable cases, see test/bench/host.cpp
+# bench.sh --host         run and compare against test/bench/host_baseline.json
+# bench.sh --host --save  run and store the result as that baseline
+# paths are from the repo root, the last run is left in test/bench_output.json
+cd "$(dirname "$0")/.." || exit 1
+OUTPUT=test/bench_output.json
+
+if [ "$1" == "--host" ]; then
+    shift
+    BASELINE=test/bench/host_baseline.json
+    THRESHOLD=${THRESHOLD:-25} # percent, hosts are noisier
+    mkdir -p test/bin
+    ${CXX:-g++} -O2 -Wall -DBENCH_ENABLE -Itest/bench/host -Iinclude src/bench_portable.cpp src/frame.cpp \
+        src/ts.cpp src/http_url.cpp src/si47xx_cmd.cpp test/bench/host.cpp -o test/bin/bench || exit 1
+    test/bin/bench > $OUTPUT || exit 1
+else
+    export $(grep -v '^#' .env | xargs -d '\n')
+    URL=http://esp32-$MAC_ADDR.local/bench
+    BASELINE=test/bench_baseline.json # local, depends on the board
+    THRESHOLD=${THRESHOLD:-10} # percent
+
+    curl -s -X GET "$URL?run=1" > /dev/null
+    until curl -s -X GET $URL | jq -e '.state == "done"' > /dev/null; do
+        sleep 1
+    done
+    curl -s -X GET $URL | jq '.cases' > $OUTPUT
+fi
+
+if [ "$1" == "--save" ] || [ ! -f $BASELINE ]; then
+    cp $OUTPUT $BASELINE
+    echo "baseline stored in $BASELINE"
+    jq -r '.[] | [.name, .ns_per_op, .allocs_per_op, .peak_bytes] | @tsv' $BASELINE
+    exit 0
+fi
+
+jq -r --slurpfile base $BASELINE --argjson t $THRESHOLD '
+    .[] as $c | ($base[0][] | select(.name == $c.name)) as $b
+    | (($c.ns_per_op - $b.ns_per_op) * 100 / $b.ns_per_op) as $d
+    | [$c.name, $b.ns_per_op, $c.ns_per_op, ($d | floor | tostring) + "%",
+       $b.allocs_per_op, $c.allocs_per_op,
+       (if $d > $t or ($c.allocs_per_op // 0) > ($b.allocs_per_op // 0) then "REGRESSION" else "ok" end)]
+    | @tsv' $OUTPUT
@@ -0,0 +1,96 @@
+/*
+    Runs the portable bench cases (src/bench_portable.cpp) on the host:
+
+        g++ -O2 -Wall -DBENCH_ENABLE -Itest/bench/host -Iinclude src/bench_portable.cpp src/frame.cpp \
+            src/ts.cpp src/http_url.cpp src/si47xx_cmd.cpp test/bench/host.cpp -o test/bin/bench
+        test/bin/bench > test/bench_output.json
+
+    or pio run -e native_bench. Prints the "cases" array of /bench, the
+    best of BENCH_HOST_RUNS timings and no cycle or allocation counts.
+    test/bench.sh --host builds, runs and compares against
+    test/bench/host_baseline.json. Host numbers track changes to the
+    code, they say nothing about the S3's absolute times.
+*/
+
+#include <Arduino.h>
+
+#include "mem.h"
+#include "dlog.h"
+#include "bench.h"
+
+#define BENCH_HOST_RUNS 5 // the fastest counts, a host is never idle
+
+// the same calibration as bench_run() on the target
+static uint32_t bench_time_us(const bench_case *c, uint32_t iters)
+{
+    uint32_t start_us = micros();
+
+    for(uint32_t i = 0; i < iters; i++) {
+        c->op();
+    }
+    return micros() - start_us;
+}
+
+static void bench_run(const bench_case *c, bench_result *r)
+{
+    uint32_t iters = 1;
+    uint32_t us;
+
+    while((us = bench_time_us(c, iters)) < BENCH_CALIBRATE_MS * 1000 && iters < (1u << 24)) {
+        iters *= 2;
+    }
+    iters = max((uint64_t) 1, (uint64_t) iters * BENCH_TARGET_MS * 1000 / max(us, (uint32_t) 1));
+
+    r->name = c->name;
+    r->iters = iters;
+    r->us = UINT32_MAX;
+    for(unsigned int i = 0; i < BENCH_HOST_RUNS; i++) {
+        r->us = min(r->us, bench_time_us(c, iters));
+    }
+}
+
+int main()
+{
+    bench_portable_prepare();
+
+    printf("[");
+    for(unsigned int i = 0; i < bench_portable_count; i++) {
+        bench_result r = {};
+
+        bench_run(&bench_portable_cases[i], &r);
+        printf("%s\n  { \"name\": \"%s\", \"iters\": %u, \"ns_per_op\": %.1f, \"cycles_per_op\": null"
+            ", \"allocs_per_op\": null, \"bytes_per_op\": null, \"peak_bytes\": null }",
+            i ? "," : "", r.name, r.iters, r.us * 1000.0 / r.iters);
+    }
+    printf("\n]\n");
+    return 0;
+}
+
+/*
+    what the portable modules link against on the target
+*/
+
+void *mem_bulk_alloc(size_t size)
+{
+    return calloc(1, size);
+}
+
+bool dlog_admit(dlog_site *)
+{
+    return false;
+}
+
+dlog_entry *dlog_begin(dlog_site *, uint8_t, const char *, const char *, uint32_t *)
+{
+    static dlog_entry e;
+    return &e;
+}
+
+void dlog_commit(dlog_entry *, uint32_t)
+{
+}
+
+uint32_t dlog_arg(dlog_entry *, const char *)
+{
+    return 0;
+}
\ No newline at end of file
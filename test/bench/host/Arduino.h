@@ -0,0 +1,66 @@
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+/*
+    The part of Arduino.h the portable modules use, for the host bench.
+    Not a port - anything the target code needs beyond this doesn't
+    belong in a portable module.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <time.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define PROGMEM
+
+#ifndef HOST_VIRTUAL_CLOCK
+inline unsigned long micros()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+inline unsigned long millis()
+{
+    return micros() / 1000;
+}
+#else
+// a model drives the clock, see test/txm/sim.cpp
+unsigned long micros();
+unsigned long millis();
+#endif
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *buf, size_t n) {
+        size_t done = 0;
+        while(done < n && write(buf[done])) done++;
+        return done;
+    }
+
+    size_t print(const char *s) { return write((const uint8_t *) s, strlen(s)); }
+
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[256];
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        return (n > 0) ? write((const uint8_t *) buf, min((size_t) n, sizeof(buf) - 1)) : 0;
+    }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,6 @@
+#ifndef __HOST_LITTLEFS_H
+#define __HOST_LITTLEFS_H
+
+// config.h names the file system, the portable modules don't use it
+
+#endif
\ No newline at end of file
@@ -0,0 +1,7 @@
+#ifndef __HOST_WIRE_H
+#define __HOST_WIRE_H
+
+// si47xx.h holds a bus reference, the host bench never touches it
+class TwoWire;
+
+#endif
\ No newline at end of file
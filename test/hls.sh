@@ -0,0 +1,17 @@
+#!/bin/bash
+# serves a live HLS stream from this host and points the player at it
+export $(grep -v '^#' .env | xargs -d '\n')
+HOST_IP=${HOST_IP:-$(hostname -I | cut -d' ' -f1)}
+DIR=$(mktemp -d)
+ffmpeg -loglevel error -re -f lavfi -i sine=frequency=440:sample_rate=44100 -c:a aac -b:a 128k \
+    -f hls -hls_time 4 -hls_list_size 6 -hls_flags delete_segments $DIR/stream.m3u8 &
+FFMPEG=$!
+(cd $DIR && python3 -m http.server 8000 > /dev/null 2>&1) &
+SERVER=$!
+trap "kill $FFMPEG $SERVER; rm -rf $DIR" EXIT
+sleep 10
+curl -s -X GET "http://esp32-$MAC_ADDR.local/audio?play=http://$HOST_IP:8000/stream.m3u8" > /dev/null
+for i in $(seq 1 10); do
+    sleep 3
+    curl -s -X GET http://esp32-$MAC_ADDR.local/audio | jq '.sources[] | select(.hls)'
+done
@@ -0,0 +1,13 @@
+#ifndef __HOST_PLUGIN_ARDUINO_H
+#define __HOST_PLUGIN_ARDUINO_H
+
+// the bench subset, plus the pins the loader drives - test/plugin/sim.cpp models them
+#include "../../bench/host/Arduino.h"
+
+#define LOW 0
+#define HIGH 1
+
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+#endif
\ No newline at end of file
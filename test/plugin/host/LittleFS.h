@@ -0,0 +1,70 @@
+#ifndef __HOST_LITTLEFS_H
+#define __HOST_LITTLEFS_H
+
+#include <Arduino.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// files held in memory, one flat directory is all the loader lists
+class File {
+  public:
+    operator bool() const { return _data || _dir; }
+    void close() {}
+    size_t size() { return _data->size(); }
+    size_t read(uint8_t *buf, size_t n) {
+        n = min(n, _data->size() - _pos);
+        memcpy(buf, _data->data() + _pos, n);
+        _pos += n;
+        return n;
+    }
+    bool seek(size_t pos) { _pos = pos; return true; }
+    bool isDirectory() { return _dir; }
+    const char *name() { return _name.c_str(); }
+    File openNextFile();
+
+  private:
+    friend class FS;
+
+    std::vector<uint8_t> *_data = NULL;
+    size_t _pos = 0;
+    bool _dir = false;
+    std::string _path;
+    std::string _name;
+    std::vector<std::string> _entries;
+    size_t _next = 0;
+};
+
+class FS {
+  public:
+    File open(const char *path, const char * = "r", bool = false) {
+        File f;
+        std::string p(path);
+
+        for(auto &kv : files) {
+            if(kv.first.compare(0, p.size() + 1, p + "/") == 0) {
+                f._dir = true;
+                f._path = p;
+                f._entries.push_back(kv.first.substr(p.size() + 1));
+            }
+        }
+        auto it = files.find(p);
+        if(it != files.end()) {
+            f._data = &it->second;
+            f._name = p.substr(p.rfind('/') + 1);
+        }
+        return f;
+    }
+
+    std::map<std::string, std::vector<uint8_t>> files;
+};
+
+extern FS LittleFS;
+
+inline File File::openNextFile()
+{
+    return (_next < _entries.size()) ? LittleFS.open((_path + "/" + _entries[_next++]).c_str()) : File();
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef __HOST_SPI_H
+#define __HOST_SPI_H
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings {
+  public:
+    SPISettings(uint32_t hz, uint8_t, uint8_t) : hz(hz) {}
+    uint32_t hz;
+};
+
+// bytes and words go to the model in test/plugin/sim.cpp
+class SPIClass {
+  public:
+    void beginTransaction(SPISettings s) { hz = s.hz; }
+    void endTransaction() {}
+    void write(uint8_t);
+    void write16(uint16_t);
+    uint16_t transfer16(uint16_t);
+
+    uint32_t hz = 0;
+};
+
+extern SPIClass SPI;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,272 @@
+/*
+    Runs the plugin loader against a host model of the VS1053's SCI,
+    registers and WRAM:
+
+        g++ -Wall -Itest/plugin/host -Itest/bench/host -Iinclude src/plugin.cpp test/plugin/sim.cpp -o test/bin/plugin_sim
+        test/bin/plugin_sim
+
+    The model checks the SPI clock against CLKI (XTALI until CLOCKF is
+    written), counts words per SCI operation and treats writes to AIADDR
+    or to I/O space as starting the loaded code, which then changes RAM
+    behind the loader's back. I/O space doesn't read back as written.
+    Each case loads the images below and checks the outcome, a word
+    corrupted on the bus must fail the load and leave the files after
+    it reported as not loaded on /boot. Exits non-zero on a failed
+    case.
+*/
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include <vector>
+
+#include "config.h"
+#include "dlog.h"
+#include "plugin.h"
+
+#define SCI_WRITE 0x02
+#define SCI_READ 0x03
+#define SCI_CLOCKF 0x03
+#define SCI_WRAM 0x06
+#define SCI_WRAMADDR 0x07
+#define SCI_AIADDR 0x0A
+#define SCI_VOL 0x0B
+
+#define SIM_XTALI_HZ 12288000
+#define SIM_CS 8
+#define SIM_DREQ 7
+#define SIM_RAM_WORDS (100 + 600 + 3 + 2000) // read back by a clean load
+
+FS LittleFS;
+SPIClass SPI;
+
+static uint16_t g_mem[0x10000];
+static uint16_t g_regs[16];
+static uint16_t g_wramaddr;
+static uint8_t g_op;
+static uint8_t g_addr;
+static unsigned int g_bytes;       // into the current SCI operation
+static unsigned int g_burst;       // words in it
+static unsigned int g_max_burst;
+static unsigned int g_words;       // written in all
+static int g_corrupt;              // word to flip a bit in, counted from 1, -1 - none
+static unsigned int g_reads;       // RAM words read back
+static unsigned int g_io_reads;
+static unsigned int g_errors;
+static bool g_started;
+
+static void sim_reset(int corrupt)
+{
+    memset(g_mem, 0, sizeof(g_mem));
+    memset(g_regs, 0, sizeof(g_regs));
+    g_wramaddr = 0;
+    g_max_burst = g_words = g_reads = g_io_reads = g_errors = 0;
+    g_corrupt = corrupt;
+    g_started = false;
+}
+
+// the loaded code runs and keeps its state in RAM
+static void sim_start()
+{
+    if(!g_started) {
+        g_started = true;
+        g_mem[0x1800] ^= 0xFFFF;
+    }
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pin == SIM_DREQ; // DREQ always up, the model takes words at once
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    if(pin == SIM_CS && value == LOW) {
+        g_bytes = 0;
+        g_burst = 0;
+    }
+}
+
+void SPIClass::write(uint8_t b)
+{
+    if(g_bytes == 0) {
+        g_op = b;
+    } else if(g_bytes == 1) {
+        g_addr = b;
+    } else {
+        g_errors++;
+    }
+    g_bytes++;
+}
+
+void SPIClass::write16(uint16_t w)
+{
+    uint32_t clki = g_regs[SCI_CLOCKF] ? PLUGIN_CLKI_HZ : SIM_XTALI_HZ;
+
+    if(g_op != SCI_WRITE || g_bytes < 2 || hz > clki / 4) {
+        g_errors++;
+        return;
+    }
+    g_max_burst = max(g_max_burst, ++g_burst);
+    if((int) ++g_words == g_corrupt) {
+        w ^= 1;
+    }
+
+    if(g_addr == SCI_WRAMADDR) {
+        g_wramaddr = w;
+    } else if(g_addr == SCI_WRAM) {
+        if(g_wramaddr >= PLUGIN_WRAM_IO) {
+            sim_start();
+            g_wramaddr++;
+        } else {
+            g_mem[g_wramaddr++] = w;
+        }
+    } else {
+        g_regs[g_addr & 15] = w;
+        if(g_addr == SCI_AIADDR) {
+            sim_start();
+        }
+    }
+}
+
+uint16_t SPIClass::transfer16(uint16_t)
+{
+    if(g_op != SCI_READ || g_bytes < 2 || hz > PLUGIN_CLKI_HZ / 7) {
+        g_errors++;
+        return 0;
+    }
+    if(g_addr != SCI_WRAM) {
+        return g_regs[g_addr & 15];
+    }
+    if(g_wramaddr >= PLUGIN_WRAM_IO) {
+        g_io_reads++;
+        g_wramaddr++;
+        return 0xDEAD;
+    }
+    g_reads++;
+    return g_mem[g_wramaddr++];
+}
+
+/*
+    images
+*/
+
+static void sim_file(const char *name, const std::vector<uint16_t> &words)
+{
+    std::vector<uint8_t> &f = LittleFS.files[std::string(PLUGIN_DIR "/") + name];
+
+    f.clear();
+    for(uint16_t w : words) {
+        f.push_back(w & 0xFF);
+        f.push_back(w >> 8);
+    }
+}
+
+static void sim_images()
+{
+    std::vector<uint16_t> patch = {
+        SCI_WRAMADDR, 1, 0x1800, SCI_WRAM, 0x8000 | 100, 0x1234, // X RAM, repeated
+        SCI_WRAMADDR, 1, 0x8030, SCI_WRAM, 600,                   // I RAM
+    };
+    for(unsigned int i = 0; i < 600; i++) {
+        patch.push_back(i * 37);
+    }
+    patch.insert(patch.end(), {
+        SCI_WRAMADDR, 1, 0xC01A, SCI_WRAM, 1, 0x0002,             // interrupt enable, I/O
+        SCI_AIADDR, 1, 0x0050,
+        SCI_WRAMADDR, 1, 0x1900, SCI_WRAM, 3, 1, 2, 3,
+        SCI_VOL, 0x8001, 0x2020,
+    });
+
+    sim_file("10-patch.bin", patch);
+    sim_file("20-plugin.bin", { SCI_WRAMADDR, 1, 0x2000, SCI_WRAM, 0x8000 | 2000, 0xBEEF });
+    sim_file("readme.txt", { 1, 2 });
+}
+
+/*
+    cases
+*/
+
+class StringPrint : public Print {
+  public:
+    size_t write(uint8_t c) { s += (char) c; return 1; }
+    std::string s;
+};
+
+// files from first on come after a failed one - listed, but nothing of an earlier load shows
+static bool sim_untouched(const std::string &json, const char *first)
+{
+    for(auto &kv : LittleFS.files) {
+        std::string file = kv.first.substr(strlen(PLUGIN_DIR "/"));
+        std::string entry = "{ \"name\": \"" + file + "\", \"ok\": false, \"words\": 0, \"written\": 0"
+            ", \"verified\": 0, \"io\": 0, \"mismatches\": 0, \"load_us\": 0, \"verify_us\": 0 }";
+
+        if(file.size() > strlen(PLUGIN_EXT) && file.compare(file.size() - strlen(PLUGIN_EXT), std::string::npos, PLUGIN_EXT) == 0
+            && file >= first && json.find(entry) == std::string::npos) {
+            printf("  %s shows an earlier load\n", file.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// corrupt - word written wrong, -1 - none, untouched - first file the load must not reach, or NULL
+static bool sim_case(const char *name, int corrupt, bool expect_ok, const char *untouched)
+{
+    StringPrint out;
+
+    sim_reset(corrupt);
+    bool ok = plugin_load(SIM_CS, SIM_DREQ);
+    plugin_print_json(out);
+
+    printf("%s\n  load %s, %u words in at most %u per operation, %u read back, %u from I/O, %u bus errors\n  %s\n",
+        name, ok ? "ok" : "failed", g_words, g_max_burst, g_reads, g_io_reads, g_errors, out.s.c_str());
+
+    bool pass = ok == expect_ok && !g_errors && !g_io_reads && (!ok || g_reads == SIM_RAM_WORDS);
+    pass = (!untouched || sim_untouched(out.s, untouched)) && pass;
+    printf("  %s\n", pass ? "ok" : "FAILED");
+    return pass;
+}
+
+int main()
+{
+    int failed = 0;
+
+    sim_images();
+
+    failed += !sim_case("clean", -1, true, NULL);
+    failed += !sim_case("corrupt X RAM", 50, false, "20-plugin.bin");
+    failed += !sim_case("corrupt I RAM", 400, false, "20-plugin.bin");
+    failed += !sim_case("corrupt second file", 760, false, NULL);
+
+    // a new image sorts first and fails, the two behind it moved down a slot
+    failed += !sim_case("clean again", -1, true, NULL);
+    sim_file("05-early.bin", { SCI_WRAMADDR, 1, 0x3000, SCI_WRAM, 2, 7, 8 });
+    failed += !sim_case("new first file fails", 3, false, "10-patch.bin");
+
+    return failed ? 1 : 0;
+}
+
+/*
+    what plugin.cpp links against on the target
+*/
+
+bool dlog_admit(dlog_site *)
+{
+    return false;
+}
+
+dlog_entry *dlog_begin(dlog_site *, uint8_t, const char *, const char *, uint32_t *)
+{
+    static dlog_entry e;
+    return &e;
+}
+
+void dlog_commit(dlog_entry *, uint32_t)
+{
+}
+
+uint32_t dlog_arg(dlog_entry *, const char *)
+{
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+/*
+    Replays a recorded load trace through the governor policy on the host:
+
+        g++ -Wall -Wextra -Iinclude src/power_policy.cpp test/power/replay.cpp -o test/bin/replay
+        test/bin/replay test/power/steady.trace test/power/safety.trace test/power/heavy.trace
+
+    A trace has one sample per line, as power_handle() would build it:
+
+        duty margin kbps playing filling [expect]
+
+    duty and margin in percent, playing and filling 0/1, expect is the
+    level name (low, mid, high) the governor must be at after the sample.
+    The first sample starts at high, as after power_init(). Lines starting
+    with # are comments. Exits non-zero on a missed expectation.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "power_policy.h"
+
+static const char *level_names[] = { "low", "mid", "high" };
+static const char *reason_names[] = { "hold", "safety", "fill", "load", "relax" };
+
+static int level_by_name(const char *name)
+{
+    for(int i = 0; i < POWER_LEVELS; i++) {
+        if(!strcmp(name, level_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// returns the number of missed expectations, -1 if the trace can't be read
+static int replay(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+    unsigned int n = 0;
+    unsigned int changes = 0;
+    int missed = 0;
+    power_policy p;
+
+    if(!f) {
+        fprintf(stderr, "%s: can't open\n", path);
+        return -1;
+    }
+
+    power_policy_init(&p, POWER_HIGH);
+    printf("%s\n", path);
+
+    while(fgets(line, sizeof(line), f)) {
+        unsigned int duty, margin, kbps, playing, filling;
+        char expect[8] = "";
+        power_input in;
+
+        if(line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if(sscanf(line, "%u %u %u %u %u %7s", &duty, &margin, &kbps, &playing, &filling, expect) < 5) {
+            fprintf(stderr, "%s: bad line - %s", path, line);
+            fclose(f);
+            return -1;
+        }
+
+        in.duty_pct = duty;
+        in.margin_pct = margin;
+        in.kbps = kbps;
+        in.playing = playing;
+        in.filling = filling;
+        n++;
+
+        uint8_t from = p.level;
+        uint8_t reason = power_decide(&p, &in);
+
+        if(p.level != from) {
+            changes++;
+            printf("  %4u  %-4s -> %-4s  %-6s  duty %3u%%  margin %3u%%  %3u kbps\n", n,
+                level_names[from], level_names[p.level], reason_names[reason], duty, margin, kbps);
+        }
+
+        if(expect[0] && level_by_name(expect) != p.level) {
+            printf("  %4u  expected %s, at %s\n", n, expect, level_names[p.level]);
+            missed++;
+        }
+    }
+    fclose(f);
+
+    printf("  %u samples, %u changes, %s\n", n, changes, missed ? "FAILED" : "ok");
+    return missed;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s trace...\n", argv[0]);
+        return 2;
+    }
+
+    for(int i = 1; i < argc; i++) {
+        if(replay(argv[i])) {
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
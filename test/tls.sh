@@ -0,0 +1,30 @@
+#!/bin/bash
+# full vs resumed handshake against a local TLS stand-in server
+export $(grep -v '^#' .env | xargs -d '\n')
+HOST_IP=${HOST_IP:-$(hostname -I | cut -d' ' -f1)}
+RUNS=${RUNS:-5}
+DIR=tls-standin
+
+if [ ! -f $DIR/cert.pem ]; then
+    mkdir -p $DIR
+    openssl req -x509 -newkey rsa:2048 -nodes -days 365 -keyout $DIR/key.pem -out $DIR/cert.pem \
+        -subj "/CN=$HOST_IP" -addext "subjectAltName=DNS:$HOST_IP,IP:$HOST_IP" 2> /dev/null
+    ffmpeg -loglevel error -f lavfi -i sine=frequency=440:duration=600 -b:a 128k $DIR/stream.mp3
+fi
+if ! grep -qf <(sed -n 2p $DIR/cert.pem) ../data/ca.pem 2> /dev/null; then
+    cat $DIR/cert.pem >> ../data/ca.pem
+    echo "stand-in certificate added to data/ca.pem - run 'pio run -t uploadfs' and start again"
+    exit 1
+fi
+
+(cd $DIR && openssl s_server -quiet -accept 8443 -cert cert.pem -key key.pem -no_tls1_3 -WWW) &
+SERVER=$!
+trap "kill $SERVER" EXIT
+sleep 1
+
+for i in $(seq 1 $RUNS); do
+    curl -s -X GET "http://esp32-$MAC_ADDR.local/audio?play=https://$HOST_IP:8443/stream.mp3" > /dev/null
+    sleep 5
+    curl -s -X GET http://esp32-$MAC_ADDR.local/audio | jq -c '.sources[] | select(.state != "idle") | .timing'
+done
+curl -s -X GET http://esp32-$MAC_ADDR.local/net | jq
@@ -0,0 +1,17 @@
+#ifndef __HOST_TXM_ARDUINO_H
+#define __HOST_TXM_ARDUINO_H
+
+// the bench subset on the model's clock, plus the reset pins and delays the driver uses
+#define HOST_VIRTUAL_CLOCK
+#include "../../bench/host/Arduino.h"
+
+#define LOW 0
+#define HIGH 1
+#define OUTPUT 3
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+#endif
\ No newline at end of file
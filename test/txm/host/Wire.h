@@ -0,0 +1,41 @@
+#ifndef __HOST_TXM_WIRE_H
+#define __HOST_TXM_WIRE_H
+
+#include <Arduino.h>
+
+#define WIRE_BUFFER_SIZE 32
+
+// the TwoWire calls I2cBus makes, transfers go to the bus model in test/txm/sim.cpp
+class TwoWire {
+  public:
+    TwoWire(uint8_t num) : num(num) {}
+
+    bool begin() { return true; }
+    void setClock(uint32_t hz) { clock = hz; }
+    void setTimeOut(uint16_t ms) { timeout_ms = ms; }
+
+    void beginTransmission(uint16_t addr) { _addr = addr; _tx_len = 0; }
+    size_t write(const uint8_t *buf, size_t n);
+    uint8_t endTransmission(bool stop = true);
+
+    size_t requestFrom(uint16_t addr, size_t n, bool stop = true);
+    size_t readBytes(uint8_t *buf, size_t n);
+    int available() { return _rx_len - _rx_pos; }
+    int read() { return (_rx_pos < _rx_len) ? _rx[_rx_pos++] : -1; }
+
+    uint8_t num;
+    uint32_t clock = 100000;
+    uint16_t timeout_ms = 50;
+
+  private:
+    uint8_t _addr = 0;
+    uint8_t _tx[WIRE_BUFFER_SIZE];
+    size_t _tx_len = 0;
+    uint8_t _rx[WIRE_BUFFER_SIZE];
+    size_t _rx_len = 0;
+    size_t _rx_pos = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,629 @@
+/*
+    Brings up Si4713 transmitters through txm.cpp and the driver against
+    a host model of the I2C buses, TCA9548A muxes and chips:
+
+        g++ -Wall -Itest/txm/host -Itest/bench/host -Iinclude src/i2c_bus.cpp src/si47xx.cpp src/si47xx_cmd.cpp src/txm.cpp test/txm/sim.cpp -o test/bin/txm_sim
+        test/bin/txm_sim
+
+    Time is virtual: a transfer takes its bits at the bus clock plus
+    SIM_XFER_US of driver cost, delays advance the clock and the rest of
+    the main loop takes SIM_LOOP_US between txm_handle() calls. A chip
+    acks only out of reset and on the selected mux channel, takes one
+    command at a time and is CTS or tuned after the times in sim_cmds.
+    A command sent while the chip is busy or before POWER_UP, and two
+    chips acking one address, are counted as bus errors. Each case
+    brings up 8 units, prints /fm as the board would at the moment all
+    of them are up, and checks how many came up, how fast, and that the
+    bus trace reads back with the cost the model charged. Exits non-zero
+    on a failed case.
+
+    With files, reads I2cBus traces as /fm_trace returns them
+
+        curl "http://esp32-$MAC_ADDR.local/fm_trace?unit=0&enable=1"
+        curl "http://esp32-$MAC_ADDR.local/fm_trace?unit=0" > unit0.trace
+        test/bin/txm_sim unit0.trace
+
+    and reports the bus time per address and what a transfer costs on
+    the board beyond its bits, which is what SIM_XFER_US should be.
+*/
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include <string>
+
+#include "dlog.h"
+#include "mem.h"
+#include "si47xx_cmd.h"
+#include "txm.h"
+
+#define SIM_BUSES 2
+#define SIM_LOOP_US 200   // the rest of the main loop
+#define SIM_XFER_US 30    // driver cost of a transfer beyond its bits
+#define SIM_RUN_MS 5000
+#define SIM_READY_MS 600  // slowest unit up, bring-up in parallel keeps it near one chip's
+#define SIM_ERRORS_SHOWN 5
+
+#define SIM_CTS 0x80
+#define SIM_ERR 0x40
+#define SIM_STC 0x01
+
+typedef struct
+{
+    unsigned int cmd;
+    uint32_t cts_us;  // command to CTS, 0 - CTS by the time the status is read
+    uint32_t stc_us;  // command to STC, 0 - doesn't tune
+    uint8_t resp_len;
+} sim_cmd;
+
+static const sim_cmd sim_cmds[] = {
+    { CMD_POWER_UP, 110000, 0, 0 },  // crystal start
+    { CMD_GET_REV, 0, 0, 8 },
+    { CMD_SET_PROPERTY, 0, 0, 0 },
+    { CMD_GET_INT_STATUS, 0, 0, 0 },
+    { CMD_TX_TUNE_FREQ, 0, 100000, 0 },
+    { CMD_TX_TUNE_POWER, 0, 20000, 0 },
+    { CMD_TX_TUNE_STATUS, 0, 0, 7 },
+    { CMD_TX_ASQ_STATUS, 0, 0, 4 },
+    { CMD_TX_RDS_BUFF, 0, 0, 5 },
+    { CMD_TX_RDS_PS, 0, 0, 0 },
+};
+
+#define SIM_CMDS (sizeof(sim_cmds) / sizeof(sim_cmds[0]))
+
+typedef struct
+{
+    uint8_t bus;
+    uint8_t addr;
+    int channel;    // -1 - on the bus directly
+    int reset_pin;  // -1 - shared reset, already done
+    bool absent;
+} sim_unit;
+
+typedef struct
+{
+    const char *name;
+    bool mux[SIM_BUSES];
+    unsigned int count;
+    sim_unit units[TXM_MAX];
+    unsigned int ready;  // units that must come up
+} sim_case;
+
+typedef struct
+{
+    sim_unit unit;
+    bool in_reset;
+    bool powered;
+    uint8_t status;   // ERR and STC, CTS follows cts_ns
+    uint64_t cts_ns;
+    uint64_t stc_ns;  // tuning until, 0 - not tuning
+    uint8_t resp_len;
+    uint8_t resp[SI47XX_RESP_SIZE];
+} sim_chip;
+
+typedef struct
+{
+    uint32_t lines;
+    uint32_t malformed;
+    uint32_t errors;
+    uint32_t first_us;
+    uint32_t end_us;
+    uint64_t bus_us;
+    uint32_t addr_lines[128];
+    uint64_t addr_us[128];
+    uint32_t timed;     // untruncated ok transfers, their length is known
+    int64_t extra_us;   // their time beyond the bits
+} sim_trace;
+
+TwoWire Wire(0);
+TwoWire Wire1(1);
+
+static TwoWire *sim_wires[SIM_BUSES] = { &Wire, &Wire1 };
+
+static uint64_t g_now_ns;
+static sim_chip g_chips[TXM_MAX];
+static unsigned int g_chip_count;
+static bool g_has_mux[SIM_BUSES];
+static uint8_t g_mux[SIM_BUSES];
+static unsigned int g_errors;
+static bool g_up;
+static uint32_t g_up_ms;
+
+static void sim_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void sim_error(const char *fmt, ...)
+{
+    if(g_errors++ < SIM_ERRORS_SHOWN) {
+        va_list args;
+
+        va_start(args, fmt);
+        printf("  model: ");
+        vprintf(fmt, args);
+        printf("\n");
+        va_end(args);
+    }
+}
+
+/*
+    clock and pins
+*/
+
+unsigned long micros()
+{
+    return g_now_ns / 1000;
+}
+
+unsigned long millis()
+{
+    return g_now_ns / 1000000;
+}
+
+void delay(uint32_t ms)
+{
+    g_now_ns += ms * 1000000ULL;
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    g_now_ns += us * 1000ULL;
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    for(unsigned int i = 0; i < g_chip_count; i++) {
+        sim_chip *c = &g_chips[i];
+
+        if(c->unit.reset_pin != pin) {
+            continue;
+        }
+        c->in_reset = (value == LOW);
+        if(c->in_reset) {
+            c->powered = false;
+            c->status = 0;
+            c->cts_ns = c->stc_ns = 0;
+        }
+    }
+}
+
+/*
+    chips
+*/
+
+static uint8_t sim_status(sim_chip *c)
+{
+    if(c->stc_ns && g_now_ns >= c->stc_ns) {
+        c->status |= SIM_STC;
+        c->stc_ns = 0;
+    }
+    return c->status | ((g_now_ns >= c->cts_ns) ? SIM_CTS : 0);
+}
+
+// the chip acking addr, NULL - nobody does
+static sim_chip *sim_find(uint8_t bus, uint8_t addr)
+{
+    sim_chip *found = NULL;
+
+    for(unsigned int i = 0; i < g_chip_count; i++) {
+        sim_chip *c = &g_chips[i];
+
+        if(c->unit.bus != bus || c->unit.addr != addr || c->unit.absent || c->in_reset) {
+            continue;
+        }
+        if(c->unit.channel >= 0 && !(g_has_mux[bus] && (g_mux[bus] & (1 << c->unit.channel)))) {
+            continue;
+        }
+        if(found) {
+            sim_error("bus %u: two chips ack %02x", bus, addr);
+        }
+        found = c;
+    }
+    return found;
+}
+
+static void sim_command(sim_chip *c, const uint8_t *tx)
+{
+    const sim_cmd *cmd = NULL;
+
+    if(!(sim_status(c) & SIM_CTS)) {
+        sim_error("%02x got %02x while busy", c->unit.addr, tx[0]);
+        return;
+    }
+    for(unsigned int i = 0; i < SIM_CMDS; i++) {
+        if(sim_cmds[i].cmd == tx[0]) {
+            cmd = &sim_cmds[i];
+        }
+    }
+
+    memset(c->resp, 0, sizeof(c->resp));
+    c->resp_len = 0;
+    c->status &= ~SIM_ERR;
+    if(!cmd || (!c->powered && tx[0] != CMD_POWER_UP)) {
+        sim_error("%02x got %02x %s", c->unit.addr, tx[0], cmd ? "before POWER_UP" : "it doesn't know");
+        c->status |= SIM_ERR;
+        return;
+    }
+
+    c->cts_ns = g_now_ns + cmd->cts_us * 1000ULL;
+    c->resp_len = cmd->resp_len;
+    if(cmd->stc_us) {
+        c->status &= ~SIM_STC;
+        c->stc_ns = g_now_ns + cmd->stc_us * 1000ULL;
+    }
+
+    if(tx[0] == CMD_POWER_UP) {
+        c->powered = true;
+    } else if(tx[0] == CMD_GET_REV) {
+        const uint8_t rev[] = { SI47XX_CHIP_VERSION, '3', '0', 0, 0, '3', '0', 'D' };
+        memcpy(c->resp, rev, sizeof(rev));
+    } else if(tx[0] == CMD_TX_ASQ_STATUS) {
+        c->resp[3] = (uint8_t) -20; // input level, dBfs
+    }
+}
+
+/*
+    buses
+*/
+
+static bool sim_write(uint8_t bus, uint8_t addr, const uint8_t *tx, size_t n)
+{
+    if(g_has_mux[bus] && addr == I2C_MUX_ADDR) {
+        if(n == 1) {
+            g_mux[bus] = tx[0];
+        }
+        return true;
+    }
+
+    sim_chip *c = sim_find(bus, addr);
+    if(!c) {
+        return false;
+    }
+    if(n) {
+        sim_command(c, tx);
+    }
+    return true;
+}
+
+static bool sim_read(uint8_t bus, uint8_t addr, uint8_t *rx, size_t n)
+{
+    if(g_has_mux[bus] && addr == I2C_MUX_ADDR) {
+        memset(rx, g_mux[bus], n);
+        return true;
+    }
+
+    sim_chip *c = sim_find(bus, addr);
+    if(!c || !n) {
+        return c != NULL;
+    }
+
+    rx[0] = sim_status(c);
+    for(size_t i = 1; i < n; i++) {
+        rx[i] = ((rx[0] & SIM_CTS) && i <= c->resp_len) ? c->resp[i - 1] : 0;
+    }
+    return true;
+}
+
+// start, address and data bytes with their ack bits, the stop if sent
+static void sim_wire(const TwoWire *w, unsigned int bits, bool stop)
+{
+    g_now_ns += (uint64_t) bits * 1000000000ULL / w->clock;
+    if(stop) {
+        g_now_ns += SIM_XFER_US * 1000ULL;
+    }
+}
+
+size_t TwoWire::write(const uint8_t *buf, size_t n)
+{
+    n = min(n, sizeof(_tx) - _tx_len);
+    memcpy(_tx + _tx_len, buf, n);
+    _tx_len += n;
+    return n;
+}
+
+uint8_t TwoWire::endTransmission(bool stop)
+{
+    bool ack = sim_write(num, _addr, _tx, _tx_len);
+
+    sim_wire(this, 1 + (1 + (ack ? _tx_len : 0)) * 9 + stop, stop || !ack);
+    return ack ? 0 : 2; // 2 - address nacked
+}
+
+size_t TwoWire::requestFrom(uint16_t addr, size_t n, bool stop)
+{
+    n = min(n, sizeof(_rx));
+    _rx_pos = 0;
+    _rx_len = sim_read(num, addr, _rx, n) ? n : 0;
+
+    sim_wire(this, 1 + (1 + _rx_len) * 9 + 1, true);
+    return _rx_len;
+}
+
+size_t TwoWire::readBytes(uint8_t *buf, size_t n)
+{
+    n = min(n, (size_t) available());
+    memcpy(buf, _rx + _rx_pos, n);
+    _rx_pos += n;
+    return n;
+}
+
+/*
+    traces
+*/
+
+static bool sim_hex(const char *s, const char *end, unsigned int *bytes)
+{
+    unsigned int digits = 0;
+
+    for(; s < end; s++) {
+        if(isxdigit((unsigned char) *s)) {
+            digits++;
+        } else if(!isspace((unsigned char) *s)) {
+            return false;
+        }
+    }
+    *bytes = digits / 2;
+    return !(digits & 1);
+}
+
+// one line as I2cBus::print_trace() writes it, clock - the bus clock on the board
+static void sim_trace_line(sim_trace *t, const char *line, uint32_t clock)
+{
+    unsigned int ts, dur, addr, result, tx, rx;
+    char op[3];
+    int n = 0;
+
+    if(sscanf(line, "%u %u %2s %x %u %n", &ts, &dur, op, &addr, &result, &n) != 5 || addr > 0x7F) {
+        t->malformed++;
+        return;
+    }
+    const char *slash = strchr(line + n, '/');
+    if(!slash || !sim_hex(line + n, slash, &tx) || !sim_hex(slash + 1, slash + strlen(slash), &rx)
+        || (strcmp(op, "W") && strcmp(op, "R") && strcmp(op, "WR"))
+        || (!strcmp(op, "W") && rx) || (!strcmp(op, "R") && tx)) {
+        t->malformed++;
+        return;
+    }
+
+    if(!t->lines++) {
+        t->first_us = ts;
+    }
+    t->end_us = max(t->end_us, ts + dur);
+    t->bus_us += dur;
+    t->addr_lines[addr]++;
+    t->addr_us[addr] += dur;
+    if(result) {
+        t->errors++;
+        return;
+    }
+
+    // the data is cut at I2C_TRACE_DATA bytes, only shorter transfers have a known length
+    if(tx + rx < I2C_TRACE_DATA) {
+        unsigned int bits = 0;
+
+        if(op[0] == 'W') {
+            bits += 1 + (1 + tx) * 9 + (op[1] ? 0 : 1);
+        }
+        if(op[0] == 'R' || op[1] == 'R') {
+            bits += 1 + (1 + rx) * 9 + 1;
+        }
+        t->timed++;
+        t->extra_us += (int64_t) dur - (int64_t) bits * 1000000 / clock;
+    }
+}
+
+static void sim_trace_text(sim_trace *t, const char *text, uint32_t clock)
+{
+    while(*text) {
+        const char *eol = strchr(text, '\n');
+        std::string line(text, eol ? eol - text : strlen(text));
+
+        if(!line.empty() && line[0] != '#') {
+            sim_trace_line(t, line.c_str(), clock);
+        }
+        text += line.size() + (eol ? 1 : 0);
+    }
+}
+
+static int64_t sim_trace_extra(const sim_trace *t)
+{
+    return t->timed ? t->extra_us / (int64_t) t->timed : 0;
+}
+
+static void sim_trace_print(const sim_trace *t, uint32_t clock)
+{
+    uint32_t span_us = t->end_us - t->first_us;
+
+    printf("  %u transfers over %u us, bus %llu us (%u%%), %u errors, %u malformed lines\n",
+        t->lines, span_us, (unsigned long long) t->bus_us,
+        span_us ? (unsigned int) (t->bus_us * 100 / span_us) : 0, t->errors, t->malformed);
+    for(unsigned int a = 0; a < 128; a++) {
+        if(t->addr_lines[a]) {
+            printf("  %02x: %u transfers, %llu us\n", a, t->addr_lines[a], (unsigned long long) t->addr_us[a]);
+        }
+    }
+    if(t->timed) {
+        printf("  %lld us per transfer beyond its bits at %u kHz, over %u transfers\n",
+            (long long) sim_trace_extra(t), clock / 1000, t->timed);
+    }
+}
+
+static bool sim_trace_file(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    sim_trace t = {};
+    std::string text;
+    char buf[256];
+
+    if(!f) {
+        printf("%s: can't open\n", path);
+        return false;
+    }
+    while(fgets(buf, sizeof(buf), f)) {
+        text += buf;
+    }
+    fclose(f);
+
+    sim_trace_text(&t, text.c_str(), I2C_BUS_CLOCK);
+    printf("%s\n", path);
+    sim_trace_print(&t, I2C_BUS_CLOCK);
+    return t.lines && !t.malformed;
+}
+
+/*
+    cases
+*/
+
+class StringPrint : public Print {
+  public:
+    size_t write(uint8_t c) { s += (char) c; return 1; }
+    std::string s;
+};
+
+static bool sim_run(const sim_case *sc)
+{
+    txm_config cfg[TXM_MAX];
+    I2cBus *buses[SIM_BUSES];
+    uint32_t ready_ms[TXM_MAX] = {};
+    unsigned int ready = 0;
+    uint32_t slowest_ms = 0;
+    StringPrint out;
+    bool pass = true;
+
+    printf("%s\n", sc->name);
+
+    g_now_ns = 0;
+    g_errors = 0;
+    g_up = false;
+    g_chip_count = sc->count;
+    for(unsigned int i = 0; i < sc->count; i++) {
+        g_chips[i] = sim_chip();
+        g_chips[i].unit = sc->units[i];
+        g_chips[i].in_reset = sc->units[i].reset_pin >= 0;
+    }
+    for(unsigned int b = 0; b < SIM_BUSES; b++) {
+        g_has_mux[b] = sc->mux[b];
+        g_mux[b] = 0;
+        buses[b] = new I2cBus(*sim_wires[b]);
+        buses[b]->trace(true);
+    }
+    for(unsigned int i = 0; i < sc->count; i++) {
+        const sim_unit *u = &sc->units[i];
+        cfg[i] = { buses[u->bus], u->addr, u->reset_pin, u->channel, 88100 + i * 400, 115 };
+    }
+
+    txm_init(cfg, sc->count, "ESP32 FM");
+    while(!g_up && millis() < SIM_RUN_MS) {
+        txm_handle();
+        for(unsigned int i = 0; i < sc->count; i++) {
+            if(!ready_ms[i] && txm_ready(i)) {
+                ready_ms[i] = millis();
+                slowest_ms = max(slowest_ms, ready_ms[i]);
+                ready++;
+            }
+        }
+        g_now_ns += SIM_LOOP_US * 1000ULL;
+    }
+
+    txm_print_json(out);
+    printf("  %s\n", out.s.c_str());
+    printf("  %u/%u up, slowest in %u ms, all done %s%u ms, %u bus errors\n", ready, sc->count,
+        slowest_ms, g_up ? "in " : "- not after ", g_up ? g_up_ms : SIM_RUN_MS, g_errors);
+    pass = g_up && ready == sc->ready && slowest_ms <= SIM_READY_MS && !g_errors;
+
+    // the trace reads back, and charges what the model did
+    for(unsigned int b = 0; b < SIM_BUSES; b++) {
+        StringPrint text;
+        sim_trace t = {};
+
+        if(!buses[b]->stats.transactions) {
+            continue;
+        }
+        buses[b]->print_trace(text);
+        sim_trace_text(&t, text.s.c_str(), I2C_BUS_CLOCK);
+        printf("  trace of bus %u\n", b);
+        sim_trace_print(&t, I2C_BUS_CLOCK);
+
+        int64_t extra = sim_trace_extra(&t);
+        pass = t.lines == min(buses[b]->stats.transactions, (uint32_t) I2C_TRACE_SIZE) && !t.malformed
+            && (!t.timed || (extra >= SIM_XFER_US - 1 && extra <= SIM_XFER_US + 1)) && pass;
+        delete buses[b];
+    }
+
+    printf("  %s\n", pass ? "ok" : "FAILED");
+    return pass;
+}
+
+static const sim_case sim_cases[] = {
+    { "8 behind a mux on one bus", { true, false }, 8, {
+        { 0, 0x63, 0, 10 }, { 0, 0x63, 1, 11 }, { 0, 0x63, 2, 12 }, { 0, 0x63, 3, 13 },
+        { 0, 0x63, 4, 14 }, { 0, 0x63, 5, 15 }, { 0, 0x63, 6, 16 }, { 0, 0x63, 7, 17 },
+    }, 8 },
+    { "4 behind a mux on each of two buses", { true, true }, 8, {
+        { 0, 0x63, 0, 10 }, { 0, 0x63, 1, 11 }, { 0, 0x63, 2, 12 }, { 0, 0x63, 3, 13 },
+        { 1, 0x63, 0, 14 }, { 1, 0x63, 1, 15 }, { 1, 0x63, 2, 16 }, { 1, 0x63, 3, 17 },
+    }, 8 },
+    { "2 per mux channel, shared reset", { true, false }, 8, {
+        { 0, 0x11, 0, -1 }, { 0, 0x63, 0, -1 }, { 0, 0x11, 1, -1 }, { 0, 0x63, 1, -1 },
+        { 0, 0x11, 2, -1 }, { 0, 0x63, 2, -1 }, { 0, 0x11, 3, -1 }, { 0, 0x63, 3, -1 },
+    }, 8 },
+    { "one of 8 missing", { true, false }, 8, {
+        { 0, 0x63, 0, 10 }, { 0, 0x63, 1, 11 }, { 0, 0x63, 2, 12 }, { 0, 0x63, 3, 13 },
+        { 0, 0x63, 4, 14 }, { 0, 0x63, 5, 15, true }, { 0, 0x63, 6, 16 }, { 0, 0x63, 7, 17 },
+    }, 7 },
+};
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    if(argc > 1) {
+        for(int i = 1; i < argc; i++) {
+            failed += !sim_trace_file(argv[i]);
+        }
+        return failed ? 1 : 0;
+    }
+
+    for(const sim_case &sc : sim_cases) {
+        failed += !sim_run(&sc);
+    }
+    return failed ? 1 : 0;
+}
+
+/*
+    what the modules link against on the target
+*/
+
+void *mem_bulk_alloc(size_t size)
+{
+    return calloc(1, size);
+}
+
+bool dlog_admit(dlog_site *)
+{
+    return true;
+}
+
+dlog_entry *dlog_begin(dlog_site *, uint8_t, const char *, const char *fmt, uint32_t *)
+{
+    static dlog_entry e;
+
+    e.fmt = fmt;
+    return &e;
+}
+
+// txm_handle() logs once every unit is up or failed
+void dlog_commit(dlog_entry *e, uint32_t)
+{
+    if(!strcmp(e->fmt, "Transmitters up in %u ms")) {
+        g_up = true;
+        g_up_ms = e->args[0];
+    }
+}
+
+uint32_t dlog_arg(dlog_entry *, const char *)
+{
+    return 0;
+}
@@ -0,0 +1,7 @@
+#!/bin/bash
+export $(grep -v '^#' .env | xargs -d '\n')
+URL=http://esp32-$MAC_ADDR.local/ui/
+ETAG=$(curl -s -D - -o /dev/null -H 'Accept-Encoding: gzip' $URL | grep -i '^etag:' | cut -d' ' -f2 | tr -d '\r')
+curl -s -o /dev/null -H 'Accept-Encoding: gzip' -w "index: %{size_download} bytes in %{time_total}s, etag $ETAG\n" $URL
+curl -s -o /dev/null -H "If-None-Match: $ETAG" -w "revalidate: %{http_code}\n" $URL
+curl -X GET  http://esp32-$MAC_ADDR.local/ui_stats | jq
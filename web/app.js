@@ -0,0 +1,154 @@
+// Polls the JSON endpoints one at a time, so the UI never adds more
+// than one request to the device at once.
+var POLL_MS = 2000;
+var WIFI_GIVE_UP_MS = 60000; // trial timeout plus the rollback
+var t0 = performance.now();
+var interactive = false;
+
+function $(id) {
+  return document.getElementById(id);
+}
+
+// values come from the stream (ICY titles, URLs), never parse them as markup
+function fill(id, pairs) {
+  var dl = $(id);
+  dl.textContent = '';
+  for (var i = 0; i < pairs.length; i++) {
+    var dt = document.createElement('dt');
+    var dd = document.createElement('dd');
+    dt.textContent = pairs[i][0];
+    dd.textContent = pairs[i][1];
+    dl.appendChild(dt);
+    dl.appendChild(dd);
+  }
+}
+
+function get(url) {
+  return fetch(url).then(function (r) {
+    return r.json();
+  });
+}
+
+function showAudio(a) {
+  var s = a.active >= 0 ? a.sources[a.active] : null;
+  fill('audio', [
+    ['state', s ? s.state : 'stopped'],
+    ['title', a.title || '-'],
+    ['url', s ? s.url : '-'],
+    ['buffer', s ? Math.round(100 * s.buffered / s.size) + '%' : '-'],
+    ['volume', a.volume],
+    ['underruns', a.underruns]
+  ]);
+  $('state').textContent = s ? s.state : 'stopped';
+  $('state').className = 'badge ' + (s && s.state === 'ready' ? 'ok' : 'bad');
+}
+
+function showFm(f) {
+  var pairs = [];
+  for (var i = 0; i < f.units.length; i++) {
+    var u = f.units[i];
+    pairs.push(['#' + i, u.state + ', ' + (u.freq / 1000).toFixed(1) + ' MHz']);
+  }
+  fill('fm', pairs);
+}
+
+function showAgc(g) {
+  fill('agc', [
+    ['level', g.level + ' dBFS'],
+    ['target', g.target + ' dBFS'],
+    ['gain', g.gain + ' dB']
+  ]);
+  $('agc_enable').checked = g.enabled;
+}
+
+function showSchedule(s) {
+  fill('schedule', [
+    ['synced', s.synced],
+    ['entries', s.entries],
+    ['current', s.current],
+    ['switches', s.switches]
+  ]);
+}
+
+function poll() {
+  get('/audio').then(showAudio)
+    .then(function () { return get('/fm'); }).then(showFm)
+    .then(function () { return get('/agc'); }).then(showAgc)
+    .then(function () { return get('/schedule'); }).then(showSchedule)
+    .then(function () {
+      if (!interactive) {
+        interactive = true;
+        $('timing').textContent = 'interactive in ' + Math.round(performance.now() - t0) + ' ms';
+      }
+    })
+    .catch(function () {
+      $('state').textContent = 'offline';
+      $('state').className = 'badge bad';
+    })
+    .then(function () {
+      setTimeout(poll, POLL_MS);
+    });
+}
+
+function loadNets() {
+  get('/wifi_list').then(function (n) {
+    if (n.result !== 'ok') {
+      setTimeout(loadNets, POLL_MS);
+      return;
+    }
+    $('ssid').textContent = '';
+    for (var i = 0; i < n.list.length; i++) {
+      var o = document.createElement('option');
+      o.textContent = n.list[i].ssid;
+      $('ssid').appendChild(o);
+    }
+  });
+}
+
+$('agc_enable').onchange = function () {
+  get('/agc?enable=' + (this.checked ? 1 : 0)).then(showAgc);
+};
+
+$('wifi').onsubmit = function (e) {
+  e.preventDefault();
+  fetch('/wifi_config', {
+    method: 'POST',
+    headers: { 'Content-Type': 'application/json' },
+    body: JSON.stringify({ ssid: $('ssid').value, key: $('key').value })
+  }).then(function (r) {
+    return r.json();
+  }).then(function (r) {
+    if (r.result !== 'ok') {
+      $('wifi_result').textContent = r.explain;
+      return;
+    }
+    $('wifi_result').textContent = 'connecting, the link drops while the device switches...';
+    wifiStatus(performance.now() + WIFI_GIVE_UP_MS, r.hostname);
+  });
+};
+
+// The device has one radio: joining the new network drops the old one,
+// so requests made over it fail until the trial is over. Keep polling
+// through the outage; on success the device is only reachable on the
+// new network, by its mDNS name.
+function wifiStatus(deadline, hostname) {
+  get('/wifi_status').then(function (s) {
+    if (s.state === 'connecting') {
+      setTimeout(wifiStatus, POLL_MS, deadline, hostname);
+    } else if (s.state === 'done') {
+      $('wifi_result').textContent = 'connected to ' + s.ssid + ' as ' + s.ip + ' in ' + s.elapsed_ms + ' ms';
+    } else {
+      $('wifi_result').textContent = 'failed (' + s.reason + '), previous network restored';
+    }
+  }).catch(function () {
+    if (performance.now() < deadline) {
+      $('wifi_result').textContent = 'link down, waiting for the device...';
+      setTimeout(wifiStatus, POLL_MS, deadline, hostname);
+    } else {
+      $('wifi_result').textContent = 'no answer - if it joined the new network, open http://' + hostname + '/ui/ from there';
+    }
+  });
+}
+
+poll();
+loadNets();